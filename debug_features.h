@@ -54,6 +54,10 @@ extern "C" {
 // #define TRACE_STATIC_MASK   (TRACE_CORE)
 #define TRACE_STATIC_MASK   (-1)
 
+// highest level compiled in for hierarchical categories (log_cat_* macros)
+// #define CATEGORY_STATIC_LEVEL   LOGGER_LEVEL_INFO
+#define CATEGORY_STATIC_LEVEL   LOGGER_LEVEL_TRACE
+
 #ifdef __cplusplus
 }
 #endif
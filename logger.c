@@ -28,15 +28,40 @@
 #include <stdarg.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define write _write
+#define close _close
+#else
+#include <unistd.h>
+#endif // _WIN32
 
 #include "logger.h"
 
+// lines longer than this are rendered into heap buffer
+#define LOGGER_LINE_SIZE 1024
+
 static unsigned int log_level;
 static const char* log_file;
+static int log_fd = -1;
+
+static void logger_open_(void)
+{
+    if(log_file) log_fd = open(log_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+}
 
+// Log file is opened once and kept open. Every line is written with one write() to
+// descriptor opened with O_APPEND, so lines from different threads and processes
+// are never mixed. If file can't be opened it is opened again by the next log line.
 void logger_set_filename(const char* log_file_name)
 {
+    if(log_fd >= 0) close(log_fd);
+    log_fd = -1;
     log_file = log_file_name;
+    logger_open_();
 }
 
 void logger_set_level(unsigned int level)
@@ -45,25 +70,57 @@ void logger_set_level(unsigned int level)
 }
 
 
-// we are using three calls to fprintf/vfprintf so this is NOT thread-safe
+// whole line is rendered to one buffer and written with a single write()
 static void log_msg(const char* level, const char* format, va_list args)
 {
-    FILE* fp;
-    fp = fopen(log_file, "a");
-    if(fp)
+    char buffer[LOGGER_LINE_SIZE];
+    char* line = buffer;
+    struct tm TM;
+    time_t now;
+    int prefix, len, written;
+    va_list copy;
+
+    if(log_fd < 0)
     {
-        struct tm TM, *ptm;
-        time_t now;
-        time(&now);
-        ptm = localtime(&now);
-        TM = *ptm;
-        fprintf(fp, "%04d-%02d-%02d %02d:%02d:%02d [%s] ",
-            TM.tm_year + 1900, TM.tm_mon + 1, TM.tm_mday,
-            TM.tm_hour, TM.tm_min, TM.tm_sec, level);
-        vfprintf(fp, format, args);
-        fprintf(fp, "\n");
-        fclose(fp);
+        logger_open_();
+        if(log_fd < 0) return;
     }
+
+    time(&now);
+#ifdef _WIN32
+    localtime_s(&TM, &now);
+#else
+    localtime_r(&now, &TM);
+#endif // _WIN32
+    prefix = snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d %02d:%02d:%02d [%s] ",
+        TM.tm_year + 1900, TM.tm_mon + 1, TM.tm_mday,
+        TM.tm_hour, TM.tm_min, TM.tm_sec, level);
+
+    va_copy(copy, args);
+    len = vsnprintf(buffer + prefix, sizeof(buffer) - prefix, format, args);
+    if(len < 0) len = 0;
+    else if(prefix + len + 1 >= (int) sizeof(buffer))
+    {
+        // message doesn't fit, render it again to buffer of the right size
+        line = (char*) malloc(prefix + len + 2);
+        if(line)
+        {
+            memcpy(line, buffer, prefix);
+            vsnprintf(line + prefix, len + 1, format, copy);
+        }
+        else
+        {
+            line = buffer;
+            len = sizeof(buffer) - prefix - 2;
+        }
+    }
+    va_end(copy);
+
+    len += prefix;
+    line[len++] = '\n';
+    written = (int) write(log_fd, line, len);
+    (void) written;     // there is no place to report failed log write
+    if(line != buffer) free(line);
 }
 
 
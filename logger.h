@@ -43,7 +43,9 @@ enum
 };
 
 // set log file name. NOTE: caller must provide storage for
-// this string
+// this string. File is kept open, if it can't be opened every log line tries
+// to open it again. File renamed by log rotation is written until this
+// function is called again.
 void logger_set_filename(const char* log_file_name);
 void logger_set_level(unsigned int level);
 
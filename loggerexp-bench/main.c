@@ -0,0 +1,493 @@
+// main.c
+// benchmarks for loggerexp
+//
+// usage: loggerexp-bench config [threads] [milliseconds]
+//        loggerexp-bench compress [lines]
+//        loggerexp-bench percpu [threads] [milliseconds]
+//        loggerexp-bench flush [lines]
+//        loggerexp-bench const [lines]
+//
+// config: measures cost of disabled log_debug() check in reader threads while another
+// thread is writing to the logger or reconfiguring it. Compares logger_config_
+// (cache-line isolated) with configuration words that share cache line with
+// frequently written data, using the same check for both.
+//
+// compress: writes the same lines to plain file sink and to gzip sink with different
+// compression levels and compares bytes written, CPU time of logging thread and CPU time
+// of whole process (which includes gzip writer thread).
+//
+// percpu: throughput of log_info() from 1 to threads threads with synchronous logging
+// (one mutex), asynchronous logging with one shared buffer and asynchronous logging with
+// per-CPU buffers. Lines go to a sink which does nothing, so only logging path is measured.
+//
+// flush: cost of file logging with flush after every line, with flush policy (64 KB buffer,
+// 100 ms, flush on ERROR) and without flushing, and how old the last line can get before it
+// is in the file when logging stops.
+//
+// const: cost of log_info() and log_trace_enter() with constant message and no arguments,
+// which copy message after prefix, compared with the same lines formatted by vsnprintf()
+// as they were before (logger_msg_to_() with "%s " format "\n"). Lines go to a sink which
+// keeps only the last line, to check that both paths make the same line.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "../loggerexp.h"
+#include "../loggerexp_gzip.h"
+#include "../debug_features.h"
+
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static double cpu_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+// ###################################  config benchmark  ###################################
+
+enum
+{
+    WRITER_NONE,            // no other thread
+    WRITER_LOGGING,         // other thread is logging (writes fp, mutex)
+    WRITER_ISOLATED,        // other thread writes hot data and reconfigures every 1 ms
+    WRITER_SHARED,          // other thread writes hot data in cache line with config words
+};
+
+static const char* const writer_names[] =
+{
+    "readers only",
+    "logging thread",
+    "reconfig + hot data, isolated",
+    "hot data, shared cache line",
+};
+
+// configuration words as they were before logger_config_ (plain globals
+// next to frequently written data)
+static struct
+{
+    unsigned log_level;
+    unsigned debug_mask;
+    unsigned long hot;
+} shared_line LOGGER_CACHE_ALIGNED;
+
+static struct
+{
+    unsigned long hot;
+} isolated_line LOGGER_CACHE_ALIGNED;
+
+static volatile int stop;
+static int writer_mode;
+static unsigned long dummy;
+
+
+// The check of log_debug() with configuration words given by pointers, so readers run
+// the same code for logger_config_ and shared_line and only cache line placement differs.
+static inline int debug_enabled(const unsigned* log_level, const unsigned* debug_mask, unsigned feature)
+{
+    return (feature & DEBUG_STATIC_MASK) &&
+           (LOGGER_ATOMIC_LOAD(*log_level) >= LOGGER_LEVEL_DEBUG || LOGGER_ATOMIC_LOAD(logger_thread_.log_level) >= LOGGER_LEVEL_DEBUG) &&
+           ((LOGGER_ATOMIC_LOAD(*debug_mask) & feature) || (LOGGER_ATOMIC_LOAD(logger_thread_.debug_mask) & feature));
+}
+
+
+static void* reader(void* arg)
+{
+    unsigned long n = 0, hits = 0;
+    const unsigned* log_level = &logger_config_.log_level;
+    const unsigned* debug_mask = &logger_config_.debug_mask;
+
+    if(writer_mode == WRITER_SHARED)
+    {
+        log_level = &shared_line.log_level;
+        debug_mask = &shared_line.debug_mask;
+    }
+
+    while(!stop)
+    {
+        int i;
+        for(i = 0; i < 1000; i++)
+        {
+            if(debug_enabled(log_level, debug_mask, VARDEBUG)) hits++;
+        }
+        n += 1000;
+    }
+    *(unsigned long*) arg = n;
+    __atomic_fetch_add(&dummy, hits, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+static void* writer(void* arg)
+{
+    double last = now_ns();
+    unsigned n = 0;
+
+    (void) arg;
+    while(!stop)
+    {
+        switch(writer_mode)
+        {
+        case WRITER_LOGGING:
+            log_info("writer %u", n++);
+            break;
+        case WRITER_ISOLATED:
+            __atomic_fetch_add(&isolated_line.hot, 1, __ATOMIC_RELAXED);
+            if(now_ns() - last > 1e6)
+            {
+                logger_config_t config;
+                logger_get_config(&config);
+                config.trace_mask ^= 1;
+                logger_set_config(&config);
+                last = now_ns();
+            }
+            break;
+        case WRITER_SHARED:
+            __atomic_fetch_add(&shared_line.hot, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    return 0;
+}
+
+
+static void bench_config(int threads, int ms)
+{
+    int mode;
+
+    logger_open("/dev/null", LOGGER_OPTION_FILE | LOGGER_OPTION_KEEP_FILE_OPEN);
+    logger_set_log_level(LOGGER_LEVEL_INFO);
+    logger_set_debug_mask(CSVDEBUG);
+    shared_line.log_level = LOGGER_LEVEL_INFO;
+    shared_line.debug_mask = CSVDEBUG;
+
+    printf("%d reader threads, %d ms per test\n", threads, ms);
+    for(mode = WRITER_NONE; mode <= WRITER_SHARED; mode++)
+    {
+        pthread_t tid[64], wtid;
+        unsigned long count[64];
+        unsigned long total = 0;
+        struct timespec sl = { ms / 1000, (ms % 1000) * 1000000L };
+        int i;
+
+        writer_mode = mode;
+        stop = 0;
+        for(i = 0; i < threads; i++) pthread_create(&tid[i], 0, reader, &count[i]);
+        if(mode != WRITER_NONE) pthread_create(&wtid, 0, writer, 0);
+        nanosleep(&sl, 0);
+        stop = 1;
+        for(i = 0; i < threads; i++)
+        {
+            pthread_join(tid[i], 0);
+            total += count[i];
+        }
+        if(mode != WRITER_NONE) pthread_join(wtid, 0);
+
+        printf("%-32s %8.3f ns per disabled log_debug() check per thread\n", writer_names[mode],
+            (double) ms * 1e6 * threads / total);
+    }
+    logger_close();
+}
+
+
+// ###################################  compress benchmark  ###################################
+
+static void bench_compress(long lines)
+{
+    static const char* const file_name = "/tmp/loggerexp-bench.log";
+    static const int levels[] = { 0, 1, 6, 9 };     // 0 is plain file sink
+    double plain_size = 1;
+    unsigned i;
+
+    printf("%ld lines per test\n", lines);
+    printf("%-12s %12s %8s %14s %14s %10s\n", "sink", "bytes", "ratio", "thread ns/line", "process ns/line", "wall ms");
+
+    for(i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+    {
+        logger_t* lg;
+        logger_gzip_sink_t* gz = 0;
+        logger_sink_t* sink = 0;
+        struct stat st;
+        char name[32];
+        long n;
+
+        unlink(file_name);
+        if(levels[i]) lg = logger_create(0, LOGGER_OPTION_MILLISECONDS);
+        else lg = logger_create(file_name, LOGGER_OPTION_FILE | LOGGER_OPTION_KEEP_FILE_OPEN | LOGGER_OPTION_MILLISECONDS);
+        logger_set_log_level_of(lg, LOGGER_LEVEL_DEBUG);
+        logger_set_debug_mask_of(lg, VARDEBUG);
+        if(levels[i])
+        {
+            gz = logger_gzip_sink_create(file_name, levels[i], 8 * LOGGER_GZIP_FRAME, LOGGER_OVERFLOW_DROP_NEWEST);
+            sink = logger_add_sink(lg, &logger_gzip_sink_ops, gz, LOGGER_LEVEL_TRACE, ~0u, ~0u);
+        }
+
+        double wall = now_ns(), thread = cpu_ns(CLOCK_THREAD_CPUTIME_ID), process = cpu_ns(CLOCK_PROCESS_CPUTIME_ID);
+        for(n = 0; n < lines; n++)
+        {
+            log_debug_to(lg, VARDEBUG, "request %ld from 10.0.%ld.%ld took %ld us", n, (n >> 8) & 255, n & 255, n % 997);
+        }
+        thread = cpu_ns(CLOCK_THREAD_CPUTIME_ID) - thread;
+        // writer thread must finish before process time is taken
+        if(sink) logger_remove_sink(lg, sink);
+        logger_destroy(lg);
+        process = cpu_ns(CLOCK_PROCESS_CPUTIME_ID) - process;
+        wall = now_ns() - wall;
+
+        if(stat(file_name, &st)) st.st_size = 0;
+        if(levels[i]) snprintf(name, sizeof(name), "gzip -%d", levels[i]);
+        else snprintf(name, sizeof(name), "plain");
+        if(!levels[i]) plain_size = st.st_size ? st.st_size : 1;
+        printf("%-12s %12lld %8.2f %14.1f %14.1f %10.1f\n", name, (long long) st.st_size, plain_size / (st.st_size ? st.st_size : 1),
+            thread / lines, process / lines, wall / 1e6);
+    }
+    unlink(file_name);
+}
+
+
+// ###################################  percpu benchmark  ###################################
+
+static void null_sink_write(void* ctx, const logger_record_t* records, unsigned n)
+{
+    (void) ctx;
+    (void) records;
+    (void) n;
+}
+
+static const logger_sink_ops_t null_sink_ops = { null_sink_write, 0, 0 };
+
+
+static void* percpu_logger(void* arg)
+{
+    unsigned long n = 0;
+
+    while(!stop)
+    {
+        log_info("request %lu took %d us", n, 42);
+        n++;
+    }
+    *(unsigned long*) arg = n;
+    return 0;
+}
+
+
+static void bench_percpu(int max_threads, int ms)
+{
+    static const char* const mode_names[] = { "sync", "async", "async percpu" };
+    int mode, threads;
+
+    if(max_threads > 64) max_threads = 64;
+    logger_open("/dev/null", 0);
+    logger_set_log_level(LOGGER_LEVEL_INFO);
+    logger_add_sink(&logger_default_, &null_sink_ops, 0, LOGGER_LEVEL_TRACE, ~0u, ~0u);
+
+    printf("%d ms per test, written lines/s (ns per written line per thread, dropped %%)\n", ms);
+    printf("%-8s", "threads");
+    for(mode = 0; mode < 3; mode++) printf(" %28s", mode_names[mode]);
+    printf("\n");
+
+    for(threads = 1; threads <= max_threads; threads++)
+    {
+        printf("%-8d", threads);
+        for(mode = 0; mode < 3; mode++)
+        {
+            pthread_t tid[64];
+            unsigned long count[64], total = 0, written;
+            unsigned long long dropped[LOGGER_LEVEL_TRACE + 1];
+            struct timespec sl = { ms / 1000, (ms % 1000) * 1000000L };
+            char result[64];
+            int i;
+
+            if(mode == 1) logger_async_start(4 << 20, LOGGER_OVERFLOW_DROP_NEWEST, 0);
+            if(mode == 2) logger_async_start_percpu(4 << 20, LOGGER_OVERFLOW_DROP_NEWEST, 0);
+            stop = 0;
+            for(i = 0; i < threads; i++) pthread_create(&tid[i], 0, percpu_logger, &count[i]);
+            nanosleep(&sl, 0);
+            stop = 1;
+            for(i = 0; i < threads; i++)
+            {
+                pthread_join(tid[i], 0);
+                total += count[i];
+            }
+            // counts are kept after logger_async_stop(), synchronous logging drops nothing
+            if(mode) logger_get_dropped(dropped);
+            else memset(dropped, 0, sizeof(dropped));
+            logger_async_stop();
+
+            // dropped lines never reached the sink, so they don't count in throughput
+            written = total - (unsigned long) dropped[LOGGER_LEVEL_INFO];
+            snprintf(result, sizeof(result), "%.3g (%.0f ns, %.0f%%)", written * 1e3 / ms,
+                written ? (double) ms * 1e6 * threads / written : 0.0, total ? 100.0 * dropped[LOGGER_LEVEL_INFO] / total : 0.0);
+            printf(" %28s", result);
+        }
+        printf("\n");
+    }
+    logger_close();
+}
+
+
+// ###################################  flush benchmark  ###################################
+
+static void bench_flush(long lines)
+{
+    static const char* const file_name = "/tmp/loggerexp-bench.log";
+    static const char* const names[] = { "every line", "policy", "none" };
+    int mode;
+
+    printf("%ld lines per test\n", lines);
+    printf("%-12s %12s %24s\n", "flush", "ns/line", "last line in file after");
+
+    for(mode = 0; mode < 3; mode++)
+    {
+        unsigned options = LOGGER_OPTION_FILE | LOGGER_OPTION_KEEP_FILE_OPEN | LOGGER_OPTION_MILLISECONDS;
+        struct stat st;
+        char stale[32];
+        long n;
+        int ms;
+
+        unlink(file_name);
+        if(mode == 0) options |= LOGGER_OPTION_FLUSH_FILE;
+        logger_t* lg = logger_create(file_name, options);
+        logger_set_log_level_of(lg, LOGGER_LEVEL_INFO);
+        if(mode == 1) logger_set_flush_policy_of(lg, 64 * 1024, 100, LOGGER_LEVEL_ERROR);
+
+        double wall = now_ns();
+        for(n = 0; n < lines; n++)
+        {
+            log_info_to(lg, "request %ld from 10.0.%ld.%ld took %ld us", n, (n >> 8) & 255, n & 255, n % 997);
+        }
+        wall = now_ns() - wall;
+
+        // new file with one line, wait until line gets in it
+        logger_destroy(lg);
+        unlink(file_name);
+        lg = logger_create(file_name, options);
+        logger_set_log_level_of(lg, LOGGER_LEVEL_INFO);
+        if(mode == 1) logger_set_flush_policy_of(lg, 64 * 1024, 100, LOGGER_LEVEL_ERROR);
+        log_info_to(lg, "last line");
+        for(ms = 0; ms < 1000; ms++)
+        {
+            struct timespec ts = { 0, 1000000 };
+            if(!stat(file_name, &st) && st.st_size > 0) break;
+            nanosleep(&ts, 0);
+        }
+        logger_destroy(lg);
+        if(ms < 1000) snprintf(stale, sizeof(stale), "%d ms", ms);
+        else snprintf(stale, sizeof(stale), "never");
+        printf("%-12s %12.1f %24s\n", names[mode], wall / lines, stale);
+    }
+    unlink(file_name);
+}
+
+
+// ###################################  const benchmark  ###################################
+
+static char last_line[1024];
+
+// keeps body of the last line
+static void last_sink_write(void* ctx, const logger_record_t* records, unsigned n)
+{
+    const logger_record_t* r = &records[n - 1];
+    unsigned len = r->len - r->body;
+
+    (void) ctx;
+    if(len >= sizeof(last_line)) len = sizeof(last_line) - 1;
+    memcpy(last_line, r->line + r->body, len);
+    last_line[len] = 0;
+}
+
+static const logger_sink_ops_t last_sink_ops = { last_sink_write, 0, 0 };
+
+
+static void bench_const(long lines)
+{
+    static const char* const names[] = { "info vsnprintf", "info const", "enter vsnprintf", "enter const" };
+    char lines_made[4][256];
+    int mode;
+    long i;
+
+    logger_open("/dev/null", 0);
+    logger_set_log_level(LOGGER_LEVEL_TRACE);
+    logger_add_sink(&logger_default_, &last_sink_ops, 0, LOGGER_LEVEL_TRACE, ~0u, ~0u);
+
+    printf("%ld lines per test\n", lines);
+    printf("%-16s %10s\n", "path", "ns/line");
+    for(mode = 0; mode < 4; mode++)
+    {
+        double start = now_ns();
+        for(i = 0; i < lines; i++)
+        {
+            char logger_tmp_buffer__[512];
+            switch(mode)
+            {
+                case 0:
+                    logger_msg_to_(&logger_default_, logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_INFO, 0, "[INFO]", 0, 0, 0, 0,
+                        "%s " "connection closed by peer" "\n", logger_tmp_buffer__);
+                    break;
+                case 1:
+                    log_info("connection closed by peer");
+                    break;
+                case 2:
+                    logger_msg_to_(&logger_default_, logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_TRACE, 0, "  >>>>  ", 0, __func__, __FILE__, __LINE__,
+                        "%s " "args: void" "\n", logger_tmp_buffer__);
+                    break;
+                case 3:
+                    log_trace_enter("args: void");
+                    break;
+            }
+        }
+        double wall = now_ns() - start;
+        strcpy(lines_made[mode], last_line);
+        printf("%-16s %10.1f\n", names[mode], wall / lines);
+    }
+
+    // line numbers differ between enter lines
+    printf("info lines are %s\n", strcmp(lines_made[0], lines_made[1]) ? "DIFFERENT" : "the same");
+    printf("enter lines: %s", lines_made[2]);
+    printf("             %s", lines_made[3]);
+    logger_close();
+}
+
+
+int main(int argc, char ** argv)
+{
+    int threads = 4, ms = 1000;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s config [threads] [milliseconds]\n", argv[0]);
+        fprintf(stderr, "       %s compress [lines]\n", argv[0]);
+        fprintf(stderr, "       %s percpu [threads] [milliseconds]\n", argv[0]);
+        fprintf(stderr, "       %s flush [lines]\n", argv[0]);
+        fprintf(stderr, "       %s const [lines]\n", argv[0]);
+        return 1;
+    }
+    if(argc > 2) threads = atoi(argv[2]);
+    if(argc > 3) ms = atoi(argv[3]);
+    if(threads < 1) threads = 1;
+    if(threads > 64) threads = 64;
+
+    if(!strcmp(argv[1], "config")) bench_config(threads, ms);
+    else if(!strcmp(argv[1], "percpu")) bench_percpu(threads, ms);
+    else if(!strcmp(argv[1], "flush")) bench_flush(argc > 2 ? atol(argv[2]) : 1000000);
+    else if(!strcmp(argv[1], "const")) bench_const(argc > 2 ? atol(argv[2]) : 1000000);
+    else if(!strcmp(argv[1], "compress")) bench_compress(argc > 2 ? atol(argv[2]) : 1000000);
+    else
+    {
+        fprintf(stderr, "unknown benchmark %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+// main.c
+// loggerexp-cat: decompress and print log files written by loggerexp gzip sink
+//
+// usage: loggerexp-cat file.gz [file.gz ...]
+//
+// Files are sequences of independent gzip members. Last member of a file written by
+// a process that crashed can be incomplete, it is printed as far as it can be
+// decompressed and reported on stderr.
+
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+
+// returns 0 if file is complete, 1 if last member is truncated, 2 on error
+static int cat_file(const char* name)
+{
+    static unsigned char in[64 * 1024], out[256 * 1024];
+    z_stream z;
+    int ret = Z_OK, in_member = 0;
+    unsigned long long offset = 0;     // file offset of current member
+    FILE* f = fopen(name, "rb");
+
+    if(!f)
+    {
+        perror(name);
+        return 2;
+    }
+
+    memset(&z, 0, sizeof(z));
+    // windowBits 15 + 16 accepts only gzip format
+    if(inflateInit2(&z, 15 + 16) != Z_OK)
+    {
+        fclose(f);
+        return 2;
+    }
+
+    for(;;)
+    {
+        if(!z.avail_in)
+        {
+            z.avail_in = fread(in, 1, sizeof(in), f);
+            z.next_in = in;
+            if(!z.avail_in) break;
+        }
+
+        z.next_out = out;
+        z.avail_out = sizeof(out);
+        in_member = 1;
+        ret = inflate(&z, Z_NO_FLUSH);
+        fwrite(out, 1, sizeof(out) - z.avail_out, stdout);
+
+        if(ret == Z_STREAM_END)
+        {
+            // next member starts right after this one
+            offset += z.total_in;
+            inflateReset(&z);
+            in_member = 0;
+            ret = Z_OK;
+        }
+        else if(ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+            fprintf(stderr, "%s: %s in frame at offset %llu\n", name, z.msg ? z.msg : "error", offset);
+            break;
+        }
+    }
+
+    inflateEnd(&z);
+    fclose(f);
+
+    if(ret != Z_OK && ret != Z_BUF_ERROR) return 2;
+    if(in_member)
+    {
+        fprintf(stderr, "%s: last frame is truncated\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+
+int main(int argc, char ** argv)
+{
+    int i, result = 0;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s file.gz [file.gz ...]\n", argv[0]);
+        return 2;
+    }
+
+    for(i = 1; i < argc; i++)
+    {
+        int r = cat_file(argv[i]);
+        if(r > result) result = r;
+    }
+    return result;
+}
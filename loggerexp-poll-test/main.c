@@ -0,0 +1,140 @@
+// main.c
+// testing loggerexp polled asynchronous logging with an epoll event loop
+//
+// Single threaded event loop: timerfd ticks every millisecond and every tick logs a burst of
+// lines, logger descriptor is drained in slices of at most BUDGET lines when it is readable.
+// Buffer is smaller than a few bursts, so log calls also have to drain it themselves
+// (LOGGER_OVERFLOW_BLOCK). Test checks that no thread was started, that no drain wrote more
+// than BUDGET lines, that descriptor is not readable when buffer is empty and that every
+// line reached the log in order.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "../loggerexp.h"
+
+#define LOG_FILE "loggerexp-poll.log"
+#define TICKS 200
+#define BURST 50
+#define BUDGET 16
+
+
+static int thread_count(void)
+{
+    FILE* fp = fopen("/proc/self/status", "r");
+    char line[256];
+    int n = -1;
+
+    if(!fp) return -1;
+    while(fgets(line, sizeof(line), fp)) if(sscanf(line, "Threads: %d", &n) == 1) break;
+    fclose(fp);
+    return n;
+}
+
+
+// Returns number of lines in log file which are in order, or -1 if a line is out of order.
+static int check_lines(void)
+{
+    FILE* fp = fopen(LOG_FILE, "r");
+    char line[1024];
+    int n = 0, tick, i;
+
+    if(!fp) return 0;
+    while(fgets(line, sizeof(line), fp))
+    {
+        const char* p = strstr(line, "tick ");
+        if(!p || sscanf(p, "tick %d line %d", &tick, &i) != 2) continue;
+        if(tick * BURST + i != n)
+        {
+            n = -1;
+            break;
+        }
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+
+int main(int argc, char ** argv)
+{
+    struct epoll_event ev, events[4];
+    struct itimerspec its = { { 0, 1000000 }, { 0, 1000000 } };
+    unsigned long long drains = 0, drained = 0, expirations;
+    unsigned max_drain = 0;
+    int ticks = 0, threads = 0, failed = 0, i, n;
+
+    unlink(LOG_FILE);
+    logger_open(LOG_FILE, LOGGER_OPTION_FILE | LOGGER_OPTION_KEEP_FILE_OPEN | LOGGER_OPTION_MILLISECONDS);
+    logger_set_log_level(LOGGER_LEVEL_INFO);
+    int log_fd = logger_async_start_polled(16 * 1024, LOGGER_OVERFLOW_BLOCK);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    int ep = epoll_create1(0);
+    if(log_fd < 0 || timer_fd < 0 || ep < 0)
+    {
+        perror("setup");
+        return 1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = log_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, log_fd, &ev);
+    ev.data.fd = timer_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, timer_fd, &ev);
+    timerfd_settime(timer_fd, 0, &its, 0);
+
+    while(ticks < TICKS)
+    {
+        n = epoll_wait(ep, events, 4, 1000);
+        for(i = 0; i < n; i++)
+        {
+            if(events[i].data.fd == timer_fd)
+            {
+                int j;
+                if(read(timer_fd, &expirations, sizeof(expirations)) < 0) continue;
+                for(j = 0; j < BURST; j++) log_info("tick %d line %d", ticks, j);
+                ticks++;
+            }
+            else
+            {
+                unsigned k = logger_drain(BUDGET);
+                drains++;
+                drained += k;
+                if(k > max_drain) max_drain = k;
+            }
+        }
+        if(thread_count() > threads) threads = thread_count();
+    }
+
+    // drain the rest, then descriptor must not be readable
+    unsigned k;
+    while((k = logger_drain(BUDGET)) > 0)
+    {
+        drains++;
+        drained += k;
+        if(k > max_drain) max_drain = k;
+    }
+    timerfd_settime(timer_fd, 0, &(struct itimerspec) { { 0, 0 }, { 0, 0 } }, 0);
+    n = epoll_wait(ep, events, 4, 0);
+    for(i = 0; i < n; i++) if(events[i].data.fd == log_fd) failed = 1;
+    printf("descriptor readable with empty buffer: %s\n", failed ? "yes" : "no");
+
+    unsigned long long dropped[LOGGER_LEVEL_TRACE + 1];
+    logger_get_dropped(dropped);
+    logger_async_stop();
+    logger_close();
+
+    printf("threads: %d\n", threads);
+    printf("%llu drains wrote %llu lines (largest %u, budget %d), dropped %llu\n",
+        drains, drained, max_drain, BUDGET, dropped[LOGGER_LEVEL_INFO]);
+    n = check_lines();
+    printf("lines in log: %d of %d%s\n", n, TICKS * BURST, n < 0 ? " (out of order)" : "");
+    if(threads != 1 || max_drain > BUDGET || dropped[LOGGER_LEVEL_INFO] || n != TICKS * BURST) failed = 1;
+
+    close(timer_fd);
+    close(ep);
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed;
+}
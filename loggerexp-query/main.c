@@ -0,0 +1,184 @@
+// main.c
+// loggerexp-query: print lines of log file in time window and up to level using sidecar index
+//
+// usage: loggerexp-query [-f from] [-t to] [-l level] [-v] file.log
+//
+// from and to are timestamps in log file format or their prefix ("2019-05-04 13:20",
+// "2019-05-04 13:20:31.5"), to includes all lines which start with it.
+// level is fatal, error, warn, info, debug, trace or number, lines up to that level are printed.
+// Blocks of file.log that can't contain matching lines are skipped using file.log.idx
+// (see LOGGER_OPTION_INDEX), lines after the last indexed block are always read.
+// -v prints how much of the file was read to stderr.
+
+#define _FILE_OFFSET_BITS 64    // off_t of fseeko() and ftello() is 64 bits for large log files
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "../loggerexp.h"
+
+static const char* from = 0;
+static const char* to = 0;
+static size_t from_len, to_len;
+static unsigned max_level = LOGGER_LEVEL_TRACE;
+
+
+// Level of line, lines are "timestamp (tid) severity ...". Debug feature lines have
+// [FEATURE] severity so anything in brackets that is not known level is debug.
+static unsigned line_level(const char* line, size_t len)
+{
+    const char* p = (const char*) memchr(line, ')', len);
+
+    if(!p || (size_t)(p - line) + 3 > len) return LOGGER_LEVEL_INFO;
+    p += 2;
+    if(!strncmp(p, "[FATAL]", 7)) return LOGGER_LEVEL_FATAL;
+    if(!strncmp(p, "[ERROR]", 7)) return LOGGER_LEVEL_ERROR;
+    if(!strncmp(p, "[WARN]", 6)) return LOGGER_LEVEL_WARN;
+    if(!strncmp(p, "[INFO]", 6)) return LOGGER_LEVEL_INFO;
+    if(!strncmp(p, "[TRACE]", 7) || !strncmp(p, "  >>>>", 6) || !strncmp(p, "  <<<<", 6) || !strncmp(p, "  <<>>", 6))
+        return LOGGER_LEVEL_TRACE;
+    return LOGGER_LEVEL_DEBUG;
+}
+
+
+// Print matching lines of len bytes at offset of file f. Returns 0 if line after
+// time window was found, so nothing after it can match.
+static int scan(FILE* f, unsigned long long offset, unsigned long long len, unsigned long long* bytes_read)
+{
+    static char line[64 * 1024];
+    int more = 1;
+
+    if(fseeko(f, (off_t) offset, SEEK_SET)) return 1;
+    while(len && fgets(line, sizeof(line), f))
+    {
+        size_t n = strlen(line);
+        len = n < len ? len - n : 0;
+        *bytes_read += n;
+
+        if(from && strncmp(line, from, from_len) < 0) continue;
+        if(to && strncmp(line, to, to_len) > 0)
+        {
+            more = 0;
+            break;
+        }
+        if(line_level(line, n) > max_level) continue;
+        fputs(line, stdout);
+    }
+    return more;
+}
+
+
+static int parse_level(const char* s, unsigned* level)
+{
+    static const char* const names[] = { "fatal", "error", "warn", "info", "debug", "trace" };
+    unsigned i;
+
+    for(i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if(!strcasecmp(s, names[i]))
+        {
+            *level = i;
+            return 0;
+        }
+    }
+    if(s[0] < '0' || s[0] > '9') return -1;
+    *level = atoi(s);
+    return 0;
+}
+
+
+int main(int argc, char ** argv)
+{
+    logger_index_entry_t* index = 0;
+    unsigned long long end = 0, bytes_read = 0, size;
+    size_t n = 0, i, skipped = 0;
+    int verbose = 0, opt;
+    char* idx_name;
+    FILE *f, *fi;
+
+    for(opt = 1; opt < argc - 1; opt++)
+    {
+        if(!strcmp(argv[opt], "-v")) verbose = 1;
+        else if(!strcmp(argv[opt], "-f") && opt + 2 < argc) from = argv[++opt];
+        else if(!strcmp(argv[opt], "-t") && opt + 2 < argc) to = argv[++opt];
+        else if(!strcmp(argv[opt], "-l") && opt + 2 < argc && !parse_level(argv[opt + 1], &max_level)) opt++;
+        else break;
+    }
+    if(opt != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-f from] [-t to] [-l level] [-v] file.log\n", argv[0]);
+        return 2;
+    }
+    if(from) from_len = strlen(from);
+    if(to) to_len = strlen(to);
+
+    f = fopen(argv[opt], "r");
+    if(!f)
+    {
+        perror(argv[opt]);
+        return 2;
+    }
+    if(fseeko(f, 0, SEEK_END) || ftello(f) < 0)
+    {
+        perror(argv[opt]);
+        fclose(f);
+        return 2;
+    }
+    size = (unsigned long long) ftello(f);
+
+    // index is optional, without it whole file is scanned
+    idx_name = (char*) malloc(strlen(argv[opt]) + 5);
+    if(!idx_name)
+    {
+        fprintf(stderr, "out of memory\n");
+        fclose(f);
+        return 2;
+    }
+    sprintf(idx_name, "%s.idx", argv[opt]);
+    fi = fopen(idx_name, "rb");
+    if(fi)
+    {
+        off_t idx_size = fseeko(fi, 0, SEEK_END) ? -1 : ftello(fi);
+        n = idx_size > 0 ? (size_t) idx_size / sizeof(logger_index_entry_t) : 0;
+        fseeko(fi, 0, SEEK_SET);
+        // without memory whole file is scanned
+        index = (logger_index_entry_t*) malloc(n * sizeof(logger_index_entry_t) + 1);
+        if(!index || fread(index, sizeof(logger_index_entry_t), n, fi) != n) n = 0;
+        fclose(fi);
+    }
+    free(idx_name);
+
+    for(i = 0; i < n; i++)
+    {
+        const logger_index_entry_t* e = &index[i];
+
+        // index doesn't match file (file was truncated or replaced)
+        if(e->offset + e->length > size)
+        {
+            n = i;
+            break;
+        }
+        end = e->offset + e->length;
+
+        // block starts after time window, so do all blocks after it
+        if(to && strncmp(e->time, to, to_len) > 0) break;
+        // next block starts before time window, so all lines of this block are before it
+        if(from && i + 1 < n && strncmp(index[i + 1].time, from, from_len) < 0) { skipped++; continue; }
+        if(!(e->levels & ((2u << max_level) - 1))) { skipped++; continue; }
+
+        if(!scan(f, e->offset, e->length, &bytes_read)) break;
+    }
+
+    // lines after the last indexed block
+    if(i == n && end < size) scan(f, end, size - end, &bytes_read);
+
+    if(verbose)
+    {
+        fprintf(stderr, "%zu index entries, %zu blocks skipped, read %llu of %llu bytes\n",
+            n, skipped, bytes_read, size);
+    }
+    free(index);
+    fclose(f);
+    return 0;
+}
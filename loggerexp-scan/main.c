@@ -0,0 +1,332 @@
+// main.c
+// loggerexp-scan: fast multi-threaded filter for loggerexp log files
+//
+// usage: loggerexp-scan [-j threads] [-l level] [-p tid] [-F feature] [-f from] [-t to] [-s text] file.log
+//
+// -l level     lines up to level (fatal, error, warn, info, debug, trace or number)
+// -p tid       lines of thread tid (number in parentheses after timestamp)
+// -F feature   lines with [feature] severity (debug feature name, ERROR, INFO ...)
+// -f from      lines with timestamp >= from, from can be timestamp prefix ("2019-05-04 13:20")
+// -t to        lines with timestamp <= to, all lines that start with to are included
+// -s text      lines that contain text
+//
+// File is mapped to memory and split in chunks which end at new line. Chunks are filtered
+// by a pool of threads using SSE2 search for new lines and text (memchr/memmem without SSE2)
+// and results are written in file order.
+
+#define _GNU_SOURCE     // memmem()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../loggerexp.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif // __SSE2__
+
+#define CHUNK_SIZE (4 * 1024 * 1024)
+
+// filters
+static unsigned max_level = LOGGER_LEVEL_TRACE;
+static long tid = -1;
+static const char* feature = 0;
+static size_t feature_len;
+static const char* from = 0;
+static size_t from_len;
+static const char* to = 0;
+static size_t to_len;
+static const char* text = 0;
+static size_t text_len;
+
+// mapped file and chunks
+static const char* data;
+static size_t size;
+
+typedef struct chunk_s
+{
+    size_t begin, end;
+    char* out;                  // matching lines
+    size_t out_len, out_size;
+    int done;
+} chunk_t;
+
+static chunk_t* chunks;
+static size_t nchunks;
+static size_t next_chunk = 0;       // next chunk to be filtered
+static size_t written = 0;          // chunks before this one are written
+static size_t window;               // maximum number of chunks filtered but not written
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+
+// find new line in [p, end), returns end if there is none
+static const char* find_newline(const char* p, const char* end)
+{
+#if defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+
+    while(p + 16 <= end)
+    {
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p), nl));
+        if(mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif // __SSE2__
+    const char* q = (const char*) memchr(p, '\n', end - p);
+    return q ? q : end;
+}
+
+
+// find text in [p, end), returns 0 if there is none
+static const char* find_text(const char* p, const char* end)
+{
+#if defined(__SSE2__)
+    // compare first and last byte of text at 16 positions at once and check rest of
+    // text only where both match
+    if(text_len > 1)
+    {
+        const __m128i first = _mm_set1_epi8(text[0]);
+        const __m128i last = _mm_set1_epi8(text[text_len - 1]);
+
+        while(p + text_len - 1 + 16 <= end)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*) p);
+            __m128i b = _mm_loadu_si128((const __m128i*)(p + text_len - 1));
+            unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+            while(mask)
+            {
+                unsigned i = __builtin_ctz(mask);
+                if(!memcmp(p + i + 1, text + 1, text_len - 2)) return p + i;
+                mask &= mask - 1;
+            }
+            p += 16;
+        }
+    }
+#endif // __SSE2__
+    if((size_t)(end - p) < text_len) return 0;
+    return (const char*) memmem(p, end - p, text, text_len);
+}
+
+
+// Level of line, lines are "timestamp (tid) severity ...". Debug feature lines have
+// [FEATURE] severity so anything in brackets that is not known level is debug.
+static unsigned line_level(const char* p, const char* end)
+{
+    if(end - p >= 7 && !strncmp(p, "[FATAL]", 7)) return LOGGER_LEVEL_FATAL;
+    if(end - p >= 7 && !strncmp(p, "[ERROR]", 7)) return LOGGER_LEVEL_ERROR;
+    if(end - p >= 6 && !strncmp(p, "[WARN]", 6)) return LOGGER_LEVEL_WARN;
+    if(end - p >= 6 && !strncmp(p, "[INFO]", 6)) return LOGGER_LEVEL_INFO;
+    if(end - p >= 7 && !strncmp(p, "[TRACE]", 7)) return LOGGER_LEVEL_TRACE;
+    if(end - p >= 6 && (!strncmp(p, "  >>>>", 6) || !strncmp(p, "  <<<<", 6) || !strncmp(p, "  <<>>", 6))) return LOGGER_LEVEL_TRACE;
+    return LOGGER_LEVEL_DEBUG;
+}
+
+
+// Returns nonzero if line [p, end) matches all filters except text.
+static int line_matches(const char* p, const char* end)
+{
+    const char* paren;
+    const char* sev;
+    size_t len = end - p;
+
+    if(from && (len < from_len ? memcmp(p, from, len) <= 0 : memcmp(p, from, from_len) < 0)) return 0;
+    if(to && memcmp(p, to, len < to_len ? len : to_len) > 0) return 0;
+    if(max_level == LOGGER_LEVEL_TRACE && tid < 0 && !feature) return 1;
+
+    paren = (const char*) memchr(p, '(', len);
+    if(!paren) return 0;
+    sev = (const char*) memchr(paren, ')', end - paren);
+    if(!sev || end - sev < 2) return 0;
+    if(tid >= 0 && strtol(paren + 1, 0, 10) != tid) return 0;
+    sev += 2;
+    if(feature && ((size_t)(end - sev) < feature_len + 2 || sev[0] != '[' ||
+       memcmp(sev + 1, feature, feature_len) || sev[feature_len + 1] != ']')) return 0;
+    if(line_level(sev, end) > max_level) return 0;
+    return 1;
+}
+
+
+static void chunk_append(chunk_t* c, const char* p, size_t len)
+{
+    if(c->out_len + len > c->out_size)
+    {
+        size_t n = c->out_size ? c->out_size * 2 : 64 * 1024;
+        while(n < c->out_len + len) n *= 2;
+        c->out = (char*) realloc(c->out, n);
+        if(!c->out)
+        {
+            perror("loggerexp-scan");
+            exit(2);
+        }
+        c->out_size = n;
+    }
+    memcpy(c->out + c->out_len, p, len);
+    c->out_len += len;
+}
+
+
+static void filter_chunk(chunk_t* c)
+{
+    const char* p = data + c->begin;
+    const char* end = data + c->end;
+
+    if(text)
+    {
+        // look for text first, most lines don't have it
+        const char* m;
+        while(p < end && (m = find_text(p, end)) != 0)
+        {
+            const char* b = m;
+            while(b > p && b[-1] != '\n') b--;
+            const char* e = find_newline(m, end);
+            if(e < end) e++;
+            if(line_matches(b, e)) chunk_append(c, b, e - b);
+            p = e;
+        }
+        return;
+    }
+
+    while(p < end)
+    {
+        const char* e = find_newline(p, end);
+        if(e < end) e++;
+        if(line_matches(p, e)) chunk_append(c, p, e - p);
+        p = e;
+    }
+}
+
+
+static void* worker(void* arg)
+{
+    (void) arg;
+    for(;;)
+    {
+        size_t i;
+
+        pthread_mutex_lock(&mutex);
+        // don't get too far ahead of writer, filtered chunks are kept in memory
+        while(next_chunk < nchunks && next_chunk >= written + window) pthread_cond_wait(&cond, &mutex);
+        i = next_chunk++;
+        pthread_mutex_unlock(&mutex);
+        if(i >= nchunks) break;
+
+        filter_chunk(&chunks[i]);
+
+        pthread_mutex_lock(&mutex);
+        chunks[i].done = 1;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+    return 0;
+}
+
+
+static int parse_level(const char* s, unsigned* level)
+{
+    static const char* const names[] = { "fatal", "error", "warn", "info", "debug", "trace" };
+    unsigned i;
+
+    for(i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if(!strcasecmp(s, names[i]))
+        {
+            *level = i;
+            return 0;
+        }
+    }
+    if(s[0] < '0' || s[0] > '9') return -1;
+    *level = atoi(s);
+    return 0;
+}
+
+
+int main(int argc, char ** argv)
+{
+    pthread_t threads[64];
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN), opt, fd;
+    struct stat st;
+    size_t i;
+
+    for(opt = 1; opt + 2 < argc && argv[opt][0] == '-'; opt += 2)
+    {
+        const char* value = argv[opt + 1];
+        if(!strcmp(argv[opt], "-j")) nthreads = atoi(value);
+        else if(!strcmp(argv[opt], "-l") && !parse_level(value, &max_level)) ;
+        else if(!strcmp(argv[opt], "-p")) tid = atol(value);
+        else if(!strcmp(argv[opt], "-F")) feature = value, feature_len = strlen(value);
+        else if(!strcmp(argv[opt], "-f")) from = value, from_len = strlen(value);
+        else if(!strcmp(argv[opt], "-t")) to = value, to_len = strlen(value);
+        else if(!strcmp(argv[opt], "-s") && value[0]) text = value, text_len = strlen(value);
+        else break;
+    }
+    if(opt != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-j threads] [-l level] [-p tid] [-F feature] [-f from] [-t to] [-s text] file.log\n", argv[0]);
+        return 2;
+    }
+    if(nthreads < 1) nthreads = 1;
+    if(nthreads > 64) nthreads = 64;
+    window = 4 * nthreads;
+
+    fd = open(argv[opt], O_RDONLY);
+    if(fd < 0 || fstat(fd, &st))
+    {
+        perror(argv[opt]);
+        return 2;
+    }
+    size = st.st_size;
+    if(!size) return 1;
+    data = (const char*) mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED)
+    {
+        perror(argv[opt]);
+        return 2;
+    }
+    madvise((void*) data, size, MADV_SEQUENTIAL);
+
+    // chunks end after new line so every line is in one chunk
+    chunks = (chunk_t*) calloc(size / CHUNK_SIZE + 1, sizeof(chunk_t));
+    for(i = 0; i < size; nchunks++)
+    {
+        size_t end = i + CHUNK_SIZE < size ? i + CHUNK_SIZE : size;
+        end = find_newline(data + end - 1, data + size) - data;
+        if(end < size) end++;
+        chunks[nchunks].begin = i;
+        chunks[nchunks].end = end;
+        i = end;
+    }
+
+    for(opt = 0; opt < nthreads; opt++) pthread_create(&threads[opt], 0, worker, 0);
+
+    // write chunks in file order
+    int found = 0;
+    for(i = 0; i < nchunks; i++)
+    {
+        pthread_mutex_lock(&mutex);
+        while(!chunks[i].done) pthread_cond_wait(&cond, &mutex);
+        pthread_mutex_unlock(&mutex);
+
+        if(chunks[i].out_len) found = 1;
+        fwrite(chunks[i].out, 1, chunks[i].out_len, stdout);
+        free(chunks[i].out);
+
+        pthread_mutex_lock(&mutex);
+        written = i + 1;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    for(opt = 0; opt < nthreads; opt++) pthread_join(threads[opt], 0);
+    munmap((void*) data, size);
+    close(fd);
+    free(chunks);
+
+    // like grep, 1 means nothing was found
+    return found ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+// main.c
+// testing loggerexp shared memory ring with pre-forked workers
+//
+// Parent creates ring and collects lines to loggerexp-shm.log. One worker crashes while it
+// copies a line into the ring, leaving reserved slots which are never committed. Other
+// workers log short and long lines. Test checks that every worker line reached the log and
+// that collector skipped slots of crashed worker instead of waiting for it forever.
+// Second, small ring checks a writer which crashes right after it reserved slots, before it
+// stored it's pid, in a slot whose old writer is still alive.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../loggerexp.h"
+#include "../loggerexp_shm.h"
+
+#define RING_NAME "/loggerexp-shm-test"
+#define SMALL_RING_NAME "/loggerexp-shm-test-small"
+#define SMALL_SLOTS 64
+#define LOG_FILE "loggerexp-shm.log"
+#define WORKERS 4
+#define LINES 2000
+
+
+static void worker(logger_shm_ring_t* ring, int id)
+{
+    char text[600];
+    int i;
+
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = 0;
+
+    // worker logs only to ring
+    logger_open(0, 0);
+    logger_set_log_level(LOGGER_LEVEL_INFO);
+    logger_add_sink(&logger_default_, &logger_shm_sink_ops, ring, LOGGER_LEVEL_INFO, 0, 0);
+    for(i = 0; i < LINES; i++)
+    {
+        if(i % 100 == 0) log_info("worker %d line %d long %s", id, i, text);
+        else log_info("worker %d line %d", id, i);
+    }
+    _exit(0);
+}
+
+
+// Worker which crashes in the middle of writing a line: line text is in unreadable memory,
+// so it dies after it reserved slots and before it committed them.
+static void crashing_worker(logger_shm_ring_t* ring)
+{
+    char* bad = (char*) mmap(0, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    logger_record_t r = { 0 };
+
+    r.line = bad;
+    r.len = 100;
+    r.level = LOGGER_LEVEL_INFO;
+    logger_shm_sink_ops.write_batch(ring, &r, 1);
+    _exit(0);
+}
+
+
+// Write one line of text to ring without logger.
+static void write_line(logger_shm_ring_t* ring, const char* text)
+{
+    logger_record_t r = { 0 };
+
+    r.line = text;
+    r.len = strlen(text);
+    r.level = LOGGER_LEVEL_INFO;
+    logger_shm_sink_ops.write_batch(ring, &r, 1);
+}
+
+
+// Worker which crashes after it reserved a slot, before it stored it's pid: all slots
+// after the first page of the ring are made read-only in this process, so it can move ring
+// head but it can't write to the slot. Its lines move head past the first page first.
+static void crashing_reserve_worker(logger_shm_ring_t* ring)
+{
+    FILE* fp = fopen("/proc/self/maps", "r");
+    char line[512];
+    unsigned long start = 0, end = 0;
+    long page = sysconf(_SC_PAGESIZE);
+    int i;
+
+    for(i = 0; i < 20; i++) write_line(ring, "small ring line\n");
+    while(fp && fgets(line, sizeof(line), fp))
+    {
+        if(strstr(line, SMALL_RING_NAME) && sscanf(line, "%lx-%lx", &start, &end) == 2) break;
+        start = 0;
+    }
+    if(fp) fclose(fp);
+    if(!start || mprotect((void*)(start + page), end - start - page, PROT_READ)) _exit(1);
+    write_line(ring, "never written\n");
+    _exit(0);
+}
+
+
+// Collect from ring until it has at least n lines of dead writers skipped and it is empty,
+// or timeout ms passes. Returns 0 on success.
+static int collect_small(logger_shm_ring_t* ring, logger_t* lg, unsigned long long n, int timeout)
+{
+    logger_shm_stats_t stats;
+
+    for(; timeout > 0; timeout -= 10)
+    {
+        logger_shm_collect(ring, lg, ~0u);
+        logger_shm_stats(ring, &stats);
+        if(stats.reclaimed >= n && !logger_shm_collect(ring, lg, ~0u)) return 0;
+        usleep(10000);
+    }
+    return 1;
+}
+
+
+// Slots of the small ring are filled by this process, so old pid in every slot is pid of
+// a live process. Writer which dies before it stores it's pid must not be taken for it.
+static int test_crash_after_reserve(logger_t* lg)
+{
+    logger_shm_ring_t* ring = logger_shm_create(SMALL_RING_NAME, SMALL_SLOTS);
+    logger_shm_stats_t stats;
+    int i, status, failed = 0;
+
+    if(!ring) return 1;
+    for(i = 0; i < SMALL_SLOTS + 6; i++)
+    {
+        write_line(ring, "small ring line\n");
+        logger_shm_collect(ring, lg, ~0u);
+    }
+
+    if(fork() == 0) crashing_reserve_worker(ring);
+    wait(&status);
+    printf("crashing reserve worker: %s\n", WIFSIGNALED(status) ? "crashed" : "did not crash");
+    if(!WIFSIGNALED(status)) failed = 1;
+
+    write_line(ring, "small ring after crash\n");
+    if(collect_small(ring, lg, 1, 10 * LOGGER_SHM_DEAD_MS)) failed = 1;
+    logger_shm_stats(ring, &stats);
+    printf("small ring: collected %llu lines, skipped %llu lines of dead writers\n", stats.collected, stats.reclaimed);
+    if(stats.reclaimed != 1 || stats.collected != SMALL_SLOTS + 6 + 20 + 1) failed = 1;
+    logger_shm_close(ring);
+    return failed;
+}
+
+
+static int count_lines(int id)
+{
+    FILE* fp = fopen(LOG_FILE, "r");
+    char line[1024], pattern[32];
+    int n = 0;
+
+    if(!fp) return 0;
+    snprintf(pattern, sizeof(pattern), "worker %d line ", id);
+    while(fgets(line, sizeof(line), fp)) if(strstr(line, pattern)) n++;
+    fclose(fp);
+    return n;
+}
+
+
+int main(int argc, char ** argv)
+{
+    logger_shm_stats_t stats;
+    int i, status, failed = 0;
+
+    unlink(LOG_FILE);
+    logger_shm_ring_t* ring = logger_shm_create(RING_NAME, 16384);
+    logger_t* lg = logger_create(LOG_FILE, LOGGER_OPTION_FILE | LOGGER_OPTION_KEEP_FILE_OPEN | LOGGER_OPTION_MILLISECONDS);
+    if(!ring || !lg)
+    {
+        perror("ring");
+        return 1;
+    }
+    logger_set_log_level_of(lg, LOGGER_LEVEL_INFO);
+    logger_shm_collector_start(ring, lg);
+
+    if(fork() == 0) crashing_worker(ring);
+    wait(&status);
+    printf("crashing worker: %s\n", WIFSIGNALED(status) ? "crashed" : "did not crash");
+
+    for(i = 0; i < WORKERS; i++) if(fork() == 0) worker(ring, i);
+    for(i = 0; i < WORKERS; i++) wait(&status);
+
+    logger_shm_collector_stop(ring);
+    logger_shm_stats(ring, &stats);
+    printf("collected %llu lines, dropped %llu, skipped %llu lines of dead writers\n",
+        stats.collected, stats.dropped, stats.reclaimed);
+    if(stats.reclaimed != 1 || stats.dropped) failed = 1;
+
+    if(test_crash_after_reserve(lg)) failed = 1;
+
+    logger_destroy(lg);
+    for(i = 0; i < WORKERS; i++)
+    {
+        int n = count_lines(i);
+        printf("worker %d: %d of %d lines\n", i, n, LINES);
+        if(n != LINES) failed = 1;
+    }
+    logger_shm_close(ring);
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed;
+}
@@ -0,0 +1,135 @@
+// main.c
+// testing loggerexp socket sink against local stand-in collector
+//
+// Collector is a thread listening on Unix domain socket and counting received lines.
+// Test checks that lines are delivered, that lines logged while collector is down are
+// kept or dropped and counted, and that sink reconnects when collector comes back.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../loggerexp.h"
+#include "../loggerexp_socket.h"
+
+#define SOCKET_PATH "/tmp/loggerexp-socket-test.sock"
+#define LINES 1000
+
+static volatile int collector_stop;
+static volatile unsigned collector_lines;
+static pthread_t collector_thread;
+
+
+static void* collector(void* arg)
+{
+    int lfd = (int)(long) arg, fd = -1;
+    char buf[4096];
+
+    while(!collector_stop)
+    {
+        struct pollfd pfd = { fd >= 0 ? fd : lfd, POLLIN, 0 };
+        if(poll(&pfd, 1, 10) <= 0) continue;
+        if(fd < 0)
+        {
+            fd = accept(lfd, 0, 0);
+            continue;
+        }
+        ssize_t n = read(fd, buf, sizeof(buf)), i;
+        if(n <= 0)
+        {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        for(i = 0; i < n; i++) if(buf[i] == '\n') collector_lines++;
+    }
+    if(fd >= 0) close(fd);
+    close(lfd);
+    return 0;
+}
+
+
+static void collector_start(void)
+{
+    struct sockaddr_un addr;
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SOCKET_PATH);
+    unlink(SOCKET_PATH);
+    if(bind(lfd, (struct sockaddr*) &addr, sizeof(addr)) || listen(lfd, 1))
+    {
+        perror("collector");
+        exit(1);
+    }
+    collector_stop = 0;
+    pthread_create(&collector_thread, 0, collector, (void*)(long) lfd);
+}
+
+
+static void collector_end(void)
+{
+    collector_stop = 1;
+    pthread_join(collector_thread, 0);
+    unlink(SOCKET_PATH);
+}
+
+
+// wait until collector gets expected number of lines or 3 seconds pass
+static int wait_lines(unsigned expected)
+{
+    int i;
+
+    for(i = 0; i < 300 && collector_lines < expected; i++)
+    {
+        logger_flush();
+        usleep(10000);
+    }
+    return collector_lines == expected;
+}
+
+
+int main(int argc, char ** argv)
+{
+    logger_socket_stats_t stats;
+    int i, failed = 0;
+
+    // no built in sinks, only socket sink
+    logger_open("loggerexp-socket.log", 0);
+    logger_set_log_level(LOGGER_LEVEL_INFO);
+
+    collector_start();
+    logger_socket_sink_t* s = logger_socket_sink_create("unix:" SOCKET_PATH, 64 * 1024, LOGGER_OVERFLOW_DROP_OLDEST);
+    logger_sink_t* sink = logger_add_sink(&logger_default_, &logger_socket_sink_ops, s, LOGGER_LEVEL_INFO, 0, 0);
+
+    for(i = 0; i < LINES; i++) log_info("connected line %d", i);
+    if(!wait_lines(LINES)) failed = 1;
+    printf("connected: collector got %u of %d lines\n", collector_lines, LINES);
+
+    // collector is down, lines are kept in 64 KB buffer and oldest are dropped
+    collector_end();
+    for(i = 0; i < 4 * LINES; i++) log_info("disconnected line %d", i);
+    usleep(300000);
+    logger_socket_sink_stats(s, &stats);
+    printf("disconnected: buffered %u bytes, dropped %llu lines\n", stats.buffered, stats.dropped_lines);
+    if(!stats.dropped_lines || stats.connected) failed = 1;
+
+    // collector is back, sink reconnects and sends what was kept
+    collector_start();
+    if(!wait_lines(5 * LINES - stats.dropped_lines)) failed = 1;
+    logger_socket_sink_stats(s, &stats);
+    printf("reconnected: collector got %u lines, reconnects %u, sent %llu bytes\n",
+        collector_lines, stats.reconnects, stats.sent_bytes);
+    if(stats.reconnects != 1 || collector_lines + stats.dropped_lines != 5 * LINES) failed = 1;
+
+    logger_remove_sink(&logger_default_, sink);
+    collector_end();
+    logger_close();
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed;
+}
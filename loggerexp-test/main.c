@@ -2,9 +2,45 @@
 // testing loggerexp
 
 #include <stdio.h>
+#include <string.h>
 #include "../loggerexp.h"
 #include "../debug_features.h"
+#include "../loggerexp_chrome.h"
 
+LOGGER_CATEGORY_DECLARE(cat_http, LOGGER_LEVEL_TRACE);
+LOGGER_CATEGORY_DECLARE(cat_parser, LOGGER_LEVEL_DEBUG);
+LOGGER_CATEGORY_DEFINE(cat_http);
+LOGGER_CATEGORY_DEFINE(cat_parser);
+
+// sink that only counts lines it gets
+static void count_sink_write(void* ctx, const logger_record_t* records, unsigned n)
+{
+    *(unsigned*) ctx += n;
+}
+
+static const logger_sink_ops_t count_sink_ops = { count_sink_write, 0, 0 };
+
+// sink that counts lines it gets and lines with weight mark of sampled lines
+typedef struct
+{
+    unsigned lines;
+    unsigned marked;
+    const char* mark;
+} sample_count_t;
+
+static void sample_sink_write(void* ctx, const logger_record_t* records, unsigned n)
+{
+    sample_count_t* c = (sample_count_t*) ctx;
+    unsigned i;
+
+    for(i = 0; i < n; i++)
+    {
+        c->lines++;
+        if(strstr(records[i].line, c->mark)) c->marked++;
+    }
+}
+
+static const logger_sink_ops_t sample_sink_ops = { sample_sink_write, 0, 0 };
 
 void test_function(void)
 {
@@ -17,6 +53,29 @@ void test_function(void)
     log_trace_exit("result: void");
 }
 
+// scoped timing, one line with elapsed time when function returns
+void timed_function(void)
+{
+    log_trace_scope("timed_function");
+    log_condtrace_scope_over(CALLTRACE, 1000000, "timed_function slow path");
+
+    printf("Inside timed function\n");
+}
+
+// lines of other instance, with it's own level and masks
+void audit_function(logger_t* lg)
+{
+    log_trace_scope_to(lg, "audit_function");
+    log_condtrace_enter_to(lg, CALLTRACE, "args: %p", (void*) lg);
+
+    log_info_to(lg, "Audit status: %d", 1);
+    log_debug_to(lg, VARDEBUG, "Audit value: %d", 2);
+    log_debug_to(lg, CSVDEBUG, "Not enabled in audit log: %d", 3);
+    log_cat_info_to(lg, cat_http, "Audit category value: %d", 4);
+
+    log_condtrace_exit_to(lg, CALLTRACE, "result: void");
+}
+
 int main(int argc, char ** argv)
 {
     const char * log_file = "loggerexp.log";
@@ -38,12 +97,99 @@ int main(int argc, char ** argv)
     log_warn("Warning: %d", 345);
     log_info("Status: %d", 456);
 
+    // trace enter/exit and scopes also go to Chrome trace file for chrome://tracing or Perfetto
+    logger_chrome_sink_t* trace = logger_chrome_sink_create("loggerexp-trace.json", 64 * 1024);
+    logger_sink_t* trace_sink = logger_add_sink(&logger_default_, &logger_chrome_sink_ops, trace, LOGGER_LEVEL_TRACE, ~0u, ~0u);
     test_function();
+    timed_function();
+    logger_remove_sink(&logger_default_, trace_sink);
 
     log_debug(CSVDEBUG, "Some value: %d", 567);
     log_debug(VARDEBUG, "Some value: %d", 678);
 
+    cat_http = logger_category_register("net.http");
+    cat_parser = logger_category_register("net.http.parser");
+    logger_category_set_level("net", LOGGER_LEVEL_TRACE);
+    log_cat_info(cat_http, "Category value: %d", 789);
+    log_cat_debug(cat_parser, "Category value: %d", 890);
+    log_cat_trace(cat_parser, "Compiled out: %d", 901);
+
+    // stderr gets only errors, counting sink gets everything up to info, except debug lines
+    unsigned count = 0;
+    logger_sink_set_filter(&logger_default_, logger_get_sink(&logger_default_, LOGGER_OPTION_STDERR), LOGGER_LEVEL_ERROR, 0, 0);
+    logger_sink_t* sink = logger_add_sink(&logger_default_, &count_sink_ops, &count, LOGGER_LEVEL_INFO, 0, 0);
+    log_error("Sink error: %d", 1);
+    log_info("Sink info: %d", 2);
+    log_debug(VARDEBUG, "Sink debug: %d", 3);
+    logger_remove_sink(&logger_default_, sink);
+    printf("Counting sink got %u lines\n", count);
+
+    // sampling: every 10th VARDEBUG line and about 1 of 10 CALLTRACE lines, marked with weight
+    sample_count_t debug_count = { 0, 0, "{w=10}" }, trace_count = { 0, 0, "{w=10}" };
+    int failed = 0, i;
+    logger_set_debug_sampling(VARDEBUG, 10, LOGGER_SAMPLE_EVERY);
+    logger_set_trace_sampling(CALLTRACE, 10, LOGGER_SAMPLE_RANDOM);
+    sink = logger_add_sink(&logger_default_, &sample_sink_ops, &debug_count, LOGGER_LEVEL_DEBUG, VARDEBUG, 0);
+    for(i = 0; i < 200; i++) log_debug_sampled(VARDEBUG, "Sampled value: %d", i);
+    logger_remove_sink(&logger_default_, sink);
+    sink = logger_add_sink(&logger_default_, &sample_sink_ops, &trace_count, LOGGER_LEVEL_TRACE, 0, CALLTRACE);
+    for(i = 0; i < 200; i++) log_condtrace_sampled(CALLTRACE, "Sampled trace: %d", i);
+    logger_remove_sink(&logger_default_, sink);
+    logger_set_debug_sampling(VARDEBUG, 0, LOGGER_SAMPLE_EVERY);
+    logger_set_trace_sampling(CALLTRACE, 0, LOGGER_SAMPLE_EVERY);
+    printf("Sampled debug: %u of 200 lines, %u with weight\n", debug_count.lines, debug_count.marked);
+    printf("Sampled trace: %u of 200 lines, %u with weight\n", trace_count.lines, trace_count.marked);
+    if(debug_count.lines != 20 || debug_count.marked != 20) failed = 1;
+    if(trace_count.lines < 5 || trace_count.lines > 50 || trace_count.marked != trace_count.lines) failed = 1;
+
+    // asynchronous logging, debug lines are dropped first if writer thread can't keep up
+    unsigned long long dropped[LOGGER_LEVEL_TRACE + 1];
+    logger_async_start(64 * 1024, LOGGER_OVERFLOW_DROP_BY_LEVEL, 0);
+    for(i = 0; i < 100; i++) log_debug(CSVDEBUG, "Async value: %d", i);
+    log_error("Async error: %d", i);
+    logger_async_stop();
+    logger_get_dropped(dropped);
+    printf("Async dropped %llu debug lines\n", dropped[LOGGER_LEVEL_DEBUG]);
+
+    // fatal lines are on disk when log_fatal() returns, errors are synced in groups within 20 ms
+    logger_set_durability(LOGGER_LEVEL_FATAL, LOGGER_LEVEL_ERROR, 20);
+    for(i = 0; i < 20; i++) log_error("Durable error: %d", i);
+    log_fatal("Durable fatal: %d", i);
+    printf("20 errors and 1 fatal line took %llu syncs\n", logger_get_sync_count_of(&logger_default_));
+
+    // request id is added to every line of this thread
+    logger_mdc_push("req", "%d", 42);
+    logger_mdc_push("user", "%s", "bob");
+    log_warn("Request with context: %d", 1);
+    logger_mdc_pop();
+    log_warn("Request with context: %d", 2);
+    logger_mdc_clear();
+
+    // debug lines are kept per request and written only before an error of that request
+    logger_set_log_level(LOGGER_LEVEL_WARN);
+    logger_backtrace_t* bt = logger_backtrace_create(16 * 1024, LOGGER_LEVEL_WARN, LOGGER_LEVEL_DEBUG, -1, 0);
+    logger_backtrace_attach(bt);
+    log_debug(VARDEBUG, "Request 1 step: %d", 1);
+    logger_backtrace_discard();
+    log_debug(VARDEBUG, "Request 2 step: %d", 1);
+    log_debug(VARDEBUG, "Request 2 step: %d", 2);
+    log_error("Request 2 failed: %d", -1);
+    logger_backtrace_attach(0);
+    logger_backtrace_destroy(bt);
+
+    // instance with it's own file, written with log_*_to() macros
+    logger_t* audit = logger_create("loggerexp-audit.log", LOGGER_OPTION_FILE | LOGGER_OPTION_KEEP_FILE_OPEN | LOGGER_OPTION_MILLISECONDS);
+    if(audit)
+    {
+        logger_set_log_level_of(audit, LOGGER_LEVEL_TRACE);
+        logger_enable_debug_of(audit, VARDEBUG);
+        logger_enable_trace_of(audit, CALLTRACE);
+        audit_function(audit);
+        logger_destroy(audit);
+    }
+
     logger_close();
 
-    return 0;
+    if(failed) printf("Sampling check FAILED\n");
+    return failed;
 }
@@ -24,21 +24,99 @@
 
 // simple logging for C
 
+#define _FILE_OFFSET_BITS 64    // fopen(), fseeko() and ftello() handle log files over 2 GB on 32-bit systems
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // sched_getcpu()
+#endif
+
 
 #include <stdio.h>
 #include <stdarg.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #include "loggerexp.h"
 
+#ifdef _WIN32
+#include <malloc.h>
+#define strcasecmp _stricmp
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#else
+#include <strings.h>
+#endif // _WIN32
+
 #if LOGGER_SYSLOG
 #include <syslog.h>   // syslog(3), openlog(3), closelog(3)
 #include <unistd.h>
 #endif // LOGGER_SYSLOG
 
+#if LOGGER_ASYNC
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif // __linux__
+#endif // LOGGER_ASYNC
+
+// per-CPU buffers find current CPU using rseq area registered by glibc 2.35+,
+// with older glibc sched_getcpu() is used
+#if LOGGER_ASYNC && defined(__linux__)
+#include <sched.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#include <sys/rseq.h>
+#define LOGGER_RSEQ 1
+#endif
+#endif // LOGGER_ASYNC
+
+// raw timestamps are read from TSC on x86-64, see CLOCK section
+#ifndef LOGGER_TSC
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+#define LOGGER_TSC 1
+#else
+#define LOGGER_TSC 0
+#endif
+#endif // LOGGER_TSC
+
+#if LOGGER_TSC
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif // LOGGER_TSC
+
+#if LOGGER_WATCH
+#include <sys/inotify.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#endif // LOGGER_WATCH
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+    #define LOGGER_ATOMIC_CAS(x, expected, desired) \
+        (_InterlockedCompareExchange((volatile long*)&(x), (long)(desired), (long)(expected)) == (long)(expected))
+    #define LOGGER_FENCE() MemoryBarrier()
+    #define LOGGER_FENCE_ACQUIRE() MemoryBarrier()
+    #define LOGGER_FENCE_RELEASE() MemoryBarrier()
+    #define LOGGER_PAUSE() YieldProcessor()
+#else
+    #define LOGGER_ATOMIC_CAS(x, expected, desired) \
+        __atomic_compare_exchange_n(&(x), &(expected), (desired), 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+    #define LOGGER_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+    #define LOGGER_FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+    #define LOGGER_FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+    #if defined(__i386__) || defined(__x86_64__)
+        #define LOGGER_PAUSE() __builtin_ia32_pause()
+    #else
+        #define LOGGER_PAUSE() do {} while(0)
+    #endif
+#endif // _MSC_VER
+
 
 
 
@@ -52,30 +130,63 @@
 
 
 
-// logger_log_level_ constants
+// logger_config_.log_level constants
 // FATAL is 0 (never masked)
 // ERROR is 1
 // WARN is 2
 // INFO is 3
 // DEBUG is 4
 // TRACE is 5
-unsigned logger_log_level_ = 0;
-
-// debug level bits (0 .. 31) are for debugging using log_debug_ex() function
-unsigned logger_debug_mask_ = 0;
-unsigned logger_trace_mask_ = 0;
+//
+// debug_mask bits (0 .. 31) are for debugging using log_debug() macro
+// trace_mask bits (0 .. 31) are for tracing using log_condtrace_*() macros
 
-unsigned logger_options_ = LOGGER_OPTION_FILE;
-static const char* log_file = 0;
-static FILE* fp = 0;
+// Sink slot. Built in sinks have option set to LOGGER_OPTION_* bit that enables them.
+// Slots are changed inside configuration block update (see logger_config_write_begin_())
+// and active is set last so logging threads never see half initialized slot.
+struct logger_sink_s
+{
+    const logger_sink_ops_t* ops;
+    void* ctx;
+    unsigned level;
+    unsigned debug_mask;
+    unsigned trace_mask;
+    unsigned option;
+    unsigned active;
+    unsigned closing;               // removed but not yet closed, slot can't be reused
+};
 
+// Logger instance. Configuration block must be first because log macros
+// read it directly through pointer to instance (see logger_config_of()).
+// Level and masks in config are the ones set by user limited by sink filters,
+// the ones set by user are kept in requested.
+struct logger_s
+{
+    logger_config_t config;
+    logger_config_t requested;
+    struct logger_sink_s sinks[LOGGER_MAX_SINKS];
+    const char* log_file;
+    char* log_file_copy;            // copy of log_file for instances made by logger_create_ex()
+    FILE* fp;
 #ifdef _WIN32
-CRITICAL_SECTION mutex;
+    CRITICAL_SECTION mutex;
 #else
-pthread_mutex_t mutex;
+    pthread_mutex_t mutex;
 #endif // _WIN32
+    char *file_name_prefix;
 
-static char *file_name_prefix = 0;
+    struct logger_async_s* async;   // allocated by first logger_async_start_of()
+    struct logger_sync_s* sync;     // allocated by first logger_set_durability_of()
+    struct logger_flusher_s* flusher;   // allocated by first logger_set_flush_policy_of()
+
+    // sidecar index, protected by mutex
+    struct logger_index_s* index;   // allocated when index is enabled first time
+    int idx_started;                // index got offset of log file since it was enabled
+    unsigned long long offset;      // size of log file
+    unsigned long long file_dev;    // device and inode of open log file (LOGGER_OPTION_REOPEN)
+    unsigned long long file_ino;
+    unsigned long long reopen_check;    // monotonic ms of next rotation check
+};
 
 /*
     Code for logging to syslog
@@ -113,339 +224,4153 @@ static void logger_syslog_open_(void)
 
 
 
+// ###################################  BUILT IN SINKS  ###################################
 
 
-// Set log file name and options. Caller must provide storage for string
-// log_file_name. If LOGGER_OPTION_KEEP_FILE_OPEN option is specified we will open
-// named log file and save file handle for later use.
-void logger_open_ex(const char* log_file_name, unsigned options, const char* file)
+// Sidecar index is built by index thread: file sink only queues offset, length, level,
+// feature and timestamp of lines it wrote, blocks are made and index file is written by
+// index thread, so logging threads don't do index work. Without threads (or if thread
+// can't be started) file sink builds index from queue itself.
+
+#ifndef LOGGER_INDEX_QUEUE
+#define LOGGER_INDEX_QUEUE (64 * 1024)    // most lines waiting for index thread
+#endif // LOGGER_INDEX_QUEUE
+
+#ifndef LOGGER_INDEX_INTERVAL_MS
+#define LOGGER_INDEX_INTERVAL_MS 200
+#endif // LOGGER_INDEX_INTERVAL_MS
+
+typedef struct
 {
-    log_file = log_file_name;
-    logger_options_ = options;
+    unsigned long long offset;      // offset of line in log file
+    unsigned len;                   // 0 if log file was opened again, offset is it's size
+    unsigned feature;
+    unsigned char level;
+    unsigned char trace;
+    unsigned char truncated;        // log file was opened again and is new or truncated
+    unsigned char retry;            // index was enabled again, open index file if it failed
+    unsigned char time_len;
+    char time[32];
+} logger_index_line_t;
 
-#ifdef _WIN32
-    InitializeCriticalSection(&mutex);
-#else
-    pthread_mutexattr_t attr;
-	pthread_mutexattr_init (&attr);
-    pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE_NP);
-    pthread_mutex_init(&mutex, &attr);
-#endif // _WIN32
+struct logger_index_s
+{
+    char* name;                     // log file name + ".idx"
+    FILE* fp;
+    int failed;                     // index file couldn't be opened, tried again with new log file
+    logger_index_entry_t block;     // block being filled
+    unsigned long long end;         // end of last line indexed
+    char last_time[32];             // timestamp of last line indexed
 
-    // we have to find file_name_prefix to the last directory separator in file
-    file_name_prefix = strdup(file);
-    if(file_name_prefix)
+    logger_index_line_t* lines;     // queued by file sink
+    unsigned len;
+    unsigned size;
+#if LOGGER_ASYNC
+    logger_index_line_t* out;       // used by index thread
+    unsigned out_size;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+    int stop;
+    int flush;
+#endif // LOGGER_ASYNC
+};
+
+
+// Write entry for block being filled to index and start new block.
+static void logger_index_write_(struct logger_index_s* ix)
+{
+    if(ix->block.length)
     {
-        char *p1 = strrchr(file_name_prefix, '/');
-        char *p2 = strrchr(file_name_prefix, '\\');
-        if(p1 && !p2) p1[1] = 0;
-        else if(!p1 && p2) p2[1] = 0;
-        else if(p1 > p2) p1[1] = 0;
-        else p2[1] = 0;
+        if(ix->fp) fwrite(&ix->block, sizeof(ix->block), 1, ix->fp);
+        memset(&ix->block, 0, sizeof(ix->block));
     }
+}
+
+
+// Log file was opened again. Index of empty or truncated log file is stale, it is started
+// again. Partial block is dropped, it's lines are scanned by tools.
+static void logger_index_reset_(struct logger_index_s* ix, const logger_index_line_t* l)
+{
+    memset(&ix->block, 0, sizeof(ix->block));
+    ix->end = l->offset;
+    ix->last_time[0] = 0;
+    if(!l->truncated && (ix->fp || (ix->failed && !l->retry))) return;
+    if(ix->fp) fclose(ix->fp);
+    ix->fp = fopen(ix->name, l->truncated ? "w" : "a");
+    ix->failed = !ix->fp;
+}
 
 
-    if(logger_options_ & LOGGER_OPTION_KEEP_FILE_OPEN)
+// Add queued lines to blocks and write entries of done blocks.
+static void logger_index_build_(struct logger_index_s* ix, const logger_index_line_t* lines, unsigned n)
+{
+    logger_index_entry_t* b = &ix->block;
+    unsigned i;
+
+    for(i = 0; i < n; i++)
     {
-        if(logger_options_ & LOGGER_OPTION_FILE)
+        const logger_index_line_t* l = &lines[i];
+
+        if(!l->len)
         {
-            if(fp) fclose(fp);
-            fp = fopen(log_file, "a");
+            logger_index_reset_(ix, l);
+            continue;
         }
-#if LOGGER_SYSLOG
-        if(logger_options_ & LOGGER_OPTION_SYSLOG)
+
+        // lines that didn't fit in queue are covered by block with all bits set
+        if(l->offset > ix->end)
         {
-            logger_syslog_open_();
+            if(!b->length)
+            {
+                b->offset = ix->end;
+                memcpy(b->time, ix->last_time, sizeof(b->time));
+            }
+            b->length += l->offset - ix->end;
+            b->levels = b->debug_features = b->trace_features = ~0u;
         }
-#endif // LOGGER_SYSLOG
+        else if(l->offset < ix->end) continue;
+
+        if(!b->length)
+        {
+            b->offset = l->offset;
+            memcpy(b->time, l->time, l->time_len);
+        }
+        b->length += l->len;
+        b->levels |= 1u << l->level;
+        if(l->trace) b->trace_features |= l->feature;
+        else b->debug_features |= l->feature;
+        ix->end = l->offset + l->len;
+        memcpy(ix->last_time, l->time, l->time_len);
+        ix->last_time[l->time_len] = 0;
+        if(b->length >= LOGGER_INDEX_BLOCK) logger_index_write_(ix);
     }
 }
 
 
+#if LOGGER_ASYNC
+static void logger_async_deadline_(struct timespec* ts, unsigned ms);
 
-// this function will close log file (if open) and set file handle to NULL.
-void logger_close(void)
+// Takes queued lines every LOGGER_INDEX_INTERVAL_MS (or when queue is filling up or flush
+// is requested) and builds index from them.
+static void* logger_index_thread_(void* arg)
 {
-    if(fp)
+    struct logger_index_s* ix = (struct logger_index_s*) arg;
+
+    pthread_mutex_lock(&ix->mutex);
+    for(;;)
     {
-        fclose(fp);
-        fp = 0;
+        while(!ix->stop && !ix->len) pthread_cond_wait(&ix->cond, &ix->mutex);
+
+        struct timespec deadline;
+        logger_async_deadline_(&deadline, LOGGER_INDEX_INTERVAL_MS);
+        while(!ix->stop && !ix->flush && ix->len < LOGGER_INDEX_QUEUE / 4 &&
+              pthread_cond_timedwait(&ix->cond, &ix->mutex, &deadline) != ETIMEDOUT) ;
+
+        logger_index_line_t* tmp = ix->out;
+        unsigned tmp_size = ix->out_size, n = ix->len;
+        int stop = ix->stop;
+        ix->out = ix->lines;
+        ix->out_size = ix->size;
+        ix->lines = tmp;
+        ix->size = tmp_size;
+        ix->len = 0;
+        ix->flush = 0;
+        pthread_mutex_unlock(&ix->mutex);
+
+        logger_index_build_(ix, ix->out, n);
+        // last block is indexed too, it is done
+        if(stop) logger_index_write_(ix);
+        if(ix->fp) fflush(ix->fp);
+
+        pthread_mutex_lock(&ix->mutex);
+        if(stop) break;
     }
-    if(file_name_prefix)
+    pthread_mutex_unlock(&ix->mutex);
+    return 0;
+}
+#endif // LOGGER_ASYNC
+
+
+// Allocate index of lg and start it's thread. Returns 0 if there is no memory.
+static struct logger_index_s* logger_index_create_(logger_t* lg)
+{
+    struct logger_index_s* ix = (struct logger_index_s*) calloc(1, sizeof(struct logger_index_s));
+    size_t len = strlen(lg->log_file);
+
+    if(!ix) return 0;
+    ix->name = (char*) malloc(len + 5);
+    if(!ix->name)
     {
-        free(file_name_prefix);
-        file_name_prefix = 0;
+        free(ix);
+        return 0;
     }
-#if LOGGER_SYSLOG
-    if(syslog_open)
+    memcpy(ix->name, lg->log_file, len);
+    memcpy(ix->name + len, ".idx", 5);
+
+#if LOGGER_ASYNC
+    pthread_condattr_t attr;
+    pthread_mutex_init(&ix->mutex, 0);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ix->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    ix->running = !pthread_create(&ix->thread, 0, logger_index_thread_, ix);
+#endif // LOGGER_ASYNC
+    return ix;
+}
+
+
+// Queue line r at offset of log file, or reset (r is 0) if log file was opened again. Called
+// by file sink with instance lock and index mutex held.
+static void logger_index_queue_(struct logger_index_s* ix, const logger_record_t* r, unsigned long long offset, int truncated, int retry)
+{
+    logger_index_line_t* l;
+
+    if(ix->len == ix->size)
     {
-        closelog();
-        syslog_open = 0;
+        unsigned size = ix->size ? 2 * ix->size : 256;
+        if(size > LOGGER_INDEX_QUEUE) size = LOGGER_INDEX_QUEUE;
+        l = size > ix->size ? (logger_index_line_t*) realloc(ix->lines, size * sizeof(logger_index_line_t)) : 0;
+        // line is covered by block with all bits set, reset can't be lost
+        if(!l)
+        {
+            if(!r && ix->len)
+            {
+                l = &ix->lines[ix->len - 1];
+                l->len = 0;
+                l->offset = offset;
+                l->truncated |= truncated;
+                l->retry |= retry;
+            }
+            return;
+        }
+        ix->lines = l;
+        ix->size = size;
     }
-#endif // LOGGER_SYSLOG
 
-#ifdef _WIN32
-    DeleteCriticalSection(&mutex);
-#else
-    pthread_mutex_destroy(&mutex);
-#endif // _WIN32
+    l = &ix->lines[ix->len++];
+    l->offset = offset;
+    l->truncated = truncated;
+    l->retry = retry;
+    if(!r)
+    {
+        l->len = 0;
+        return;
+    }
+    l->len = r->len;
+    l->feature = r->feature;
+    l->level = r->level;
+    l->trace = r->trace;
+    l->time_len = r->body ? r->body - 1 : 0;
+    if(l->time_len > sizeof(l->time) - 1) l->time_len = sizeof(l->time) - 1;
+    memcpy(l->time, r->line, l->time_len);
 }
 
 
-// Set log level to one of LOGGER_LEVEL_FATAL, LOGGER_LEVEL_ERROR,
-// LOGGER_LEVEL_WARNING, LOGGER_LEVEL_INFO.
-// logger_log_level_ will affect logging using log_fatal, log_error,
-// log_warn, log_info and log_debug functions.
-void logger_set_log_level(unsigned level)
+// Queued lines are given to index thread, or index is built right away without it.
+static void logger_index_kick_(struct logger_index_s* ix, unsigned queued, int flush)
 {
-    logger_log_level_ = level;
+#if LOGGER_ASYNC
+    if(ix->running)
+    {
+        // thread is woken by first line, then it waits for more
+        if((queued && queued == ix->len) || ix->len >= LOGGER_INDEX_QUEUE / 4 || flush)
+        {
+            ix->flush |= flush;
+            pthread_cond_signal(&ix->cond);
+        }
+        return;
+    }
+#endif // LOGGER_ASYNC
+    (void) queued;
+    logger_index_build_(ix, ix->lines, ix->len);
+    ix->len = 0;
+    if(flush && ix->fp) fflush(ix->fp);
 }
 
 
-// This function is used to set bits in logger_debug_mask_
-// Every bit in mask controls one feature that you want to debug.
-void logger_set_debug_mask(unsigned mask)
+// Ask index thread to write what is queued, called by file sink flush with instance lock held.
+static void logger_index_flush_(struct logger_index_s* ix)
 {
-    logger_debug_mask_ = mask;
+#if LOGGER_ASYNC
+    if(ix->running) pthread_mutex_lock(&ix->mutex);
+#endif // LOGGER_ASYNC
+    logger_index_kick_(ix, 0, 1);
+#if LOGGER_ASYNC
+    if(ix->running) pthread_mutex_unlock(&ix->mutex);
+#endif // LOGGER_ASYNC
 }
 
 
-// This function is used to get logger_debug_mask_
-unsigned logger_get_debug_mask(void)
+// Stop index thread, index what is queued and free index.
+static void logger_index_free_(logger_t* lg)
 {
-    return logger_debug_mask_;
+    struct logger_index_s* ix = lg->index;
+
+    if(!ix) return;
+#if LOGGER_ASYNC
+    if(ix->running)
+    {
+        pthread_mutex_lock(&ix->mutex);
+        ix->stop = 1;
+        pthread_cond_signal(&ix->cond);
+        pthread_mutex_unlock(&ix->mutex);
+        pthread_join(ix->thread, 0);
+    }
+    pthread_cond_destroy(&ix->cond);
+    pthread_mutex_destroy(&ix->mutex);
+    free(ix->out);
+#endif // LOGGER_ASYNC
+    logger_index_build_(ix, ix->lines, ix->len);
+    logger_index_write_(ix);
+    if(ix->fp) fclose(ix->fp);
+    free(ix->lines);
+    free(ix->name);
+    free(ix);
+    lg->index = 0;
+    lg->idx_started = 0;
 }
 
 
-// Enable debuging for feature (bitmask)
-void logger_enable_debug(unsigned feature)
+// Open log file of instance lg and index file if it is enabled. File offset is taken
+// from the file every time it is opened, so changes made by others (truncation,
+// rotation) are seen. If file became shorter index is started again.
+static void logger_file_open_(logger_t* lg, unsigned options)
 {
-    logger_debug_mask_ |= feature;
+    if(!lg->log_file) return;
+    lg->fp = fopen(lg->log_file, "a");
+    if(!lg->fp) return;
+
+    long long size = fseeko(lg->fp, 0, SEEK_END) ? -1 : (long long) ftello(lg->fp);
+    if(size < 0) size = 0;
+
+#ifndef _WIN32
+    struct stat st;
+    if(!fstat(fileno(lg->fp), &st))
+    {
+        lg->file_dev = st.st_dev;
+        lg->file_ino = st.st_ino;
+    }
+    lg->reopen_check = logger_monotonic_ns() / 1000000 + LOGGER_REOPEN_CHECK_MS;
+#endif // _WIN32
+
+    if((options & LOGGER_OPTION_INDEX) && (!lg->idx_started || (unsigned long long) size < lg->offset))
+    {
+        // index of empty or truncated log file is stale
+        int truncated = !size || (lg->idx_started && (unsigned long long) size < lg->offset);
+        if(!lg->index) lg->index = logger_index_create_(lg);
+        if(lg->index)
+        {
+            struct logger_index_s* ix = lg->index;
+#if LOGGER_ASYNC
+            if(ix->running) pthread_mutex_lock(&ix->mutex);
+#endif // LOGGER_ASYNC
+            logger_index_queue_(ix, 0, size, truncated, !lg->idx_started);
+            logger_index_kick_(ix, 1, 0);
+#if LOGGER_ASYNC
+            if(ix->running) pthread_mutex_unlock(&ix->mutex);
+#endif // LOGGER_ASYNC
+        }
+        lg->idx_started = 1;
+    }
+    lg->offset = size;
 }
 
 
-// Disable debuging for feature (bitmask)
-void logger_disable_debug(unsigned feature)
+// file sink, ctx is logger instance
+// Returns 1 if log file was moved or deleted (rotated) since it was opened. File name is
+// checked at most every LOGGER_REOPEN_CHECK_MS milliseconds, now is logger_monotonic_ns() time
+// of the last line, so clock is not read again.
+static int logger_file_rotated_(logger_t* lg, unsigned long long now)
 {
-    logger_debug_mask_ &= ~feature;
+#ifndef _WIN32
+    struct stat st;
+
+    now /= 1000000;
+
+    if(now < lg->reopen_check) return 0;
+    lg->reopen_check = now + LOGGER_REOPEN_CHECK_MS;
+    if(stat(lg->log_file, &st)) return 1;
+    return (unsigned long long) st.st_dev != lg->file_dev || (unsigned long long) st.st_ino != lg->file_ino;
+#else
+    // open file can't be renamed or deleted on Windows
+    (void) now;
+    return 0;
+#endif // _WIN32
 }
 
-// Enable trace for feature (bitmask)
-void logger_enable_trace(unsigned feature)
+
+#if LOGGER_ASYNC
+static void logger_sync_lines_(logger_t* lg, int level);
+static void logger_sync_reopen_(logger_t* lg);
+static void logger_sync_wait_(logger_t* lg, const logger_record_t* records, unsigned n);
+static int logger_flusher_lines_(logger_t* lg, int level);
+static void logger_flusher_setvbuf_(logger_t* lg);
+#endif // LOGGER_ASYNC
+
+
+static void logger_file_sink_write_(void* ctx, const logger_record_t* records, unsigned n)
+{
+    logger_t* lg = (logger_t*) ctx;
+    unsigned options = LOGGER_ATOMIC_LOAD(lg->config.options);
+    unsigned i;
+
+    // index was just enabled, file is opened again to get it's offset
+    if(!(options & LOGGER_OPTION_INDEX)) lg->idx_started = 0;
+    else if(lg->fp && !lg->idx_started)
+    {
+        fclose(lg->fp);
+        lg->fp = 0;
+    }
+    // lines written to rotated file after it was moved are still in it, new ones go to new file
+    if(lg->fp && (options & LOGGER_OPTION_REOPEN) && logger_file_rotated_(lg, records[n - 1].time))
+    {
+        fclose(lg->fp);
+        lg->fp = 0;
+    }
+    if(!lg->fp)
+    {
+        logger_file_open_(lg, options);
+#if LOGGER_ASYNC
+        if(lg->fp && lg->flusher) logger_flusher_setvbuf_(lg);
+        // file could be rotated or replaced since it was last opened
+        if(lg->fp && lg->sync) logger_sync_reopen_(lg);
+#endif // LOGGER_ASYNC
+    }
+    if(!lg->fp) return;
+
+    int level = LOGGER_LEVEL_TRACE + 1;
+    struct logger_index_s* ix = lg->idx_started ? lg->index : 0;
+    unsigned queued = 0;
+#if LOGGER_ASYNC
+    if(ix && ix->running) pthread_mutex_lock(&ix->mutex);
+#endif // LOGGER_ASYNC
+    for(i = 0; i < n; i++)
+    {
+        fwrite(records[i].line, 1, records[i].len, lg->fp);
+        if(ix) logger_index_queue_(ix, &records[i], lg->offset, 0, 0), queued++;
+        lg->offset += records[i].len;
+        if(records[i].level < level) level = records[i].level;
+    }
+    if(ix)
+    {
+        logger_index_kick_(ix, queued, 0);
+#if LOGGER_ASYNC
+        if(ix->running) pthread_mutex_unlock(&ix->mutex);
+#endif // LOGGER_ASYNC
+    }
+
+#if LOGGER_ASYNC
+    if(lg->sync) logger_sync_lines_(lg, level);
+    // flush policy replaces flushing of every line
+    if(lg->flusher && logger_flusher_lines_(lg, level)) ;
+    else
+#endif // LOGGER_ASYNC
+    if(options & LOGGER_OPTION_FLUSH_FILE) fflush(lg->fp);
+    if(options & (LOGGER_OPTION_KEEP_FILE_OPEN | LOGGER_OPTION_REOPEN)) ;
+    else
+    {
+        fclose(lg->fp);
+        lg->fp = 0;
+    }
+}
+
+
+static void logger_file_sink_flush_(void* ctx)
 {
-    logger_trace_mask_ |= feature;
+    logger_t* lg = (logger_t*) ctx;
+    if(lg->fp) fflush(lg->fp);
+    if(lg->index) logger_index_flush_(lg->index);
 }
 
-// Disable trace for feature (bitmask)
-void logger_disable_trace(unsigned feature)
+
+static void logger_stderr_sink_write_(void* ctx, const logger_record_t* records, unsigned n)
 {
-    logger_trace_mask_ &= ~feature;
+    unsigned i;
+    (void) ctx;
+    for(i = 0; i < n; i++) fwrite(records[i].line, 1, records[i].len, stderr);
 }
 
 
-// This function is used to set bits in logger_trace_mask_
-// Every bit in mask controls one feature that you want to trace.
-void logger_set_trace_mask(unsigned mask)
+static void logger_stderr_sink_flush_(void* ctx)
 {
-    logger_trace_mask_ = mask;
+    (void) ctx;
+    fflush(stderr);
 }
 
 
-// This function is used to get logger_trace_mask_
-unsigned logger_get_trace_mask(void)
+// syslog gets line without timestamp and without trailing new line
+static void logger_syslog_sink_write_(void* ctx, const logger_record_t* records, unsigned n)
 {
-    return logger_trace_mask_;
+    (void) ctx;
+#if LOGGER_SYSLOG
+    unsigned i;
+
+    if(! syslog_open) logger_syslog_open_();
+    for(i = 0; i < n; i++)
+    {
+        const logger_record_t* r = &records[i];
+        int priority;
+        int len = r->len - r->body;
+
+        switch(r->level)
+        {
+            case 0: priority = LOG_CRIT; break;
+            case 1: priority = LOG_ERR; break;
+            case 2: priority = LOG_WARNING; break;
+            case 3: priority = LOG_INFO; break;
+            default: priority = LOG_DEBUG;
+        }
+        if(len > 0 && r->line[r->len - 1] == '\n') len--;
+        syslog(priority, "%.*s", len, r->line + r->body);
+    }
+#else
+    (void) records;
+    (void) n;
+#endif // LOGGER_SYSLOG
 }
 
 
+static const logger_sink_ops_t logger_file_sink_ops_ = { logger_file_sink_write_, logger_file_sink_flush_, 0 };
+static const logger_sink_ops_t logger_stderr_sink_ops_ = { logger_stderr_sink_write_, logger_stderr_sink_flush_, 0 };
+static const logger_sink_ops_t logger_syslog_sink_ops_ = { logger_syslog_sink_write_, 0, 0 };
 
-static void make_timestamp(char* buffer, unsigned buff_size)
+// initializer for built in sinks of instance lg, syslog doesn't get debug and trace lines
+#define LOGGER_BUILTIN_SINKS_(lg) \
+    { &logger_file_sink_ops_, (lg), LOGGER_LEVEL_TRACE, ~0u, ~0u, LOGGER_OPTION_FILE, 1, 0 }, \
+    { &logger_stderr_sink_ops_, (lg), LOGGER_LEVEL_TRACE, ~0u, ~0u, LOGGER_OPTION_STDERR, 1, 0 }, \
+    { &logger_syslog_sink_ops_, (lg), LOGGER_LEVEL_INFO, 0, 0, LOGGER_OPTION_SYSLOG, 1, 0 }
+
+
+// default instance used by log_* macros, logger_config_ is it's configuration block
+logger_t logger_default_ =
 {
-    struct tm TM, *ptm;
-    unsigned ms = 0;
+    .config = { .options = LOGGER_OPTION_FILE },
+    .requested = { .options = LOGGER_OPTION_FILE },
+    .sinks = { LOGGER_BUILTIN_SINKS_(&logger_default_) }
+};
 
-#ifdef WIN32
-    /* 64-bit value representing the number of 100-nanosecond intervals since January 1, 1601 00:00 UTC */
-    FILETIME               filetime;
-    ULARGE_INTEGER         x;
-    ULONGLONG              usec;
-    /* microseconds betweeen Jan 1,1601 and Jan 1,1970 */
-    static const ULONGLONG epoch_offset_us = 11644473600000000ULL;
 
-//#if _WIN32_WINNT >= _WIN32_WINNT_WIN8
-//    GetSystemTimePreciseAsFileTime(&filetime);
-//#else
-    GetSystemTimeAsFileTime(&filetime);
-//#endif
-    x.LowPart =  filetime.dwLowDateTime;
-    x.HighPart = filetime.dwHighDateTime;
-    usec = x.QuadPart / 10  -  epoch_offset_us;
-    time_t now = (time_t)(usec / 1000000ULL);
-    usec = usec % 1000000ULL;
-    ms = (unsigned)(usec / 1000ULL);
-    ptm = localtime(&now);
-    TM = *ptm;
-#else // ! WIN32
-    struct timeval ts;
-    gettimeofday(&ts, 0);
-    ms = ts.tv_usec / 1000;
-    ptm = localtime(&ts.tv_sec);
-    TM = *ptm;
-#endif // WIN32
 
-    if(logger_options_ & LOGGER_OPTION_MILLISECONDS)
-    {
-        snprintf(buffer, buff_size, "%04d-%02d-%02d %02d:%02d:%02d.%03d",
-            TM.tm_year + 1900, TM.tm_mon + 1, TM.tm_mday,
-            TM.tm_hour, TM.tm_min, TM.tm_sec, ms);
-    }
-    else
+#if LOGGER_WATCH
+static pthread_t watch_thread;
+static int watch_running = 0;
+static int watch_pipe[2] = { -1, -1 };
+static int watch_fd = -1;
+static char* watch_file = 0;
+static const char* watch_name = 0;
+#endif // LOGGER_WATCH
+
+
+
+// Start update of configuration block. Writers are serialized by spinning on odd seq value
+// so this works before logger_open() and doesn't need any initialized mutex.
+// Returns new (odd) seq that must be passed to logger_config_write_end_().
+static unsigned logger_config_write_begin_(logger_config_t* config)
+{
+    unsigned seq;
+
+    for(;;)
     {
-        snprintf(buffer, buff_size, "%04d-%02d-%02d %02d:%02d:%02d",
-            TM.tm_year + 1900, TM.tm_mon + 1, TM.tm_mday,
-            TM.tm_hour, TM.tm_min, TM.tm_sec);
+        seq = LOGGER_ATOMIC_LOAD(config->seq);
+        if(!(seq & 1) && LOGGER_ATOMIC_CAS(config->seq, seq, seq + 1)) break;
+        LOGGER_PAUSE();
     }
+    // seq must be visible as odd before any field is changed
+    LOGGER_FENCE();
+    return seq + 1;
 }
 
 
-void logger_lock(void)
+// Finish update of configuration block and publish new configuration.
+static void logger_config_write_end_(logger_config_t* config, unsigned seq)
 {
-#ifdef _WIN32
-    EnterCriticalSection(&mutex);
-#else
-    pthread_mutex_lock(&mutex);
-#endif // _WIN32
+    LOGGER_FENCE_RELEASE();
+    LOGGER_ATOMIC_STORE(config->seq, seq + 1);
 }
 
 
-void logger_unlock(void)
+
+// Publish level and masks of instance lg. Published level is requested level limited to the
+// highest level any enabled sink accepts and published masks are requested masks limited
+// to features any enabled sink accepts, so log macros skip lines no sink would write.
+// Must be called between logger_config_write_begin_() and logger_config_write_end_().
+static void logger_publish_(logger_t* lg)
 {
-#ifdef _WIN32
-    LeaveCriticalSection(&mutex);
-#else
-    pthread_mutex_unlock(&mutex);
-#endif // _WIN32
+    unsigned options = LOGGER_ATOMIC_LOAD(lg->requested.options);
+    unsigned level = 0, debug_mask = 0, trace_mask = 0, i;
+
+    for(i = 0; i < LOGGER_MAX_SINKS; i++)
+    {
+        struct logger_sink_s* s = &lg->sinks[i];
+        if(!s->active || (s->option && !(options & s->option))) continue;
+        if(s->level > level) level = s->level;
+        debug_mask |= s->debug_mask;
+        trace_mask |= s->trace_mask;
+    }
+    if(lg->requested.log_level < level) level = lg->requested.log_level;
+
+    LOGGER_ATOMIC_STORE(lg->config.debug_mask, lg->requested.debug_mask & debug_mask);
+    LOGGER_ATOMIC_STORE(lg->config.trace_mask, lg->requested.trace_mask & trace_mask);
+    LOGGER_ATOMIC_STORE(lg->config.options, options);
+    LOGGER_ATOMIC_STORE(lg->config.log_level, level);
 }
 
 
-static const char* logger_stripfile(const char* file)
+
+// Simple spin lock for data which is rarely changed and can be used before logger_open()
+// initializes logger mutex (categories, thread registry).
+static void logger_spin_lock_(unsigned* lock)
 {
-    const char *p = file_name_prefix;
+    for(;;)
+    {
+        unsigned expected = 0;
+        if(LOGGER_ATOMIC_CAS(*lock, expected, 1)) break;
+        LOGGER_PAUSE();
+    }
+}
 
-    if(!file) return file;
 
-    while(*p == *file) ++p, ++file;
-    return file;
+static void logger_spin_unlock_(unsigned* lock)
+{
+    LOGGER_FENCE_RELEASE();
+    LOGGER_ATOMIC_STORE(*lock, 0);
 }
 
-// helper function for C++ class name
-// class name is returned by typeid(*this).name() and on some
-// compilers like GCC/G++ class name have numeric prefix that
-// need to be stripped off.
-static const char* logger_stralpha(const char* name)
+
+
+#if LOGGER_TSC
+static void logger_clock_init_(void);
+#endif // LOGGER_TSC
+
+
+// Initialize instance lg. It is common part of logger_open_ex() and logger_create_ex().
+static void logger_init_(logger_t* lg, const char* log_file_name, unsigned options, const char* file)
 {
-    int i = 0;
+    static const struct logger_sink_s builtin[] = { LOGGER_BUILTIN_SINKS_(0) };
+    unsigned i;
 
-    if(!name) return name;
+#if LOGGER_TSC
+    logger_clock_init_();
+#endif // LOGGER_TSC
 
-    while(name[i])
+    lg->log_file = log_file_name;
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    for(i = 0; i < sizeof(builtin) / sizeof(builtin[0]); i++)
     {
-        if(name[i] >= '0' && name[i] <= '9')
-        {
-            i++;
-            continue;
-        }
-        return name + i;
+        if(lg->sinks[i].active) continue;
+        lg->sinks[i] = builtin[i];
+        lg->sinks[i].ctx = lg;
     }
-    return name;
-}
+    LOGGER_ATOMIC_STORE(lg->requested.options, options);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
 
+#ifdef _WIN32
+    InitializeCriticalSection(&lg->mutex);
+#else
+    pthread_mutexattr_t attr;
+	pthread_mutexattr_init (&attr);
+    pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE_NP);
+    pthread_mutex_init(&lg->mutex, &attr);
+#endif // _WIN32
 
-// "%s (%d) [FATAL] " format "\n", time_stamp, getpid()
-// "%s (%d) [%s] %s @ %s:%d " format "\n", time_stamp, getpid(), #feature, __func__, __FILE__, __LINE__
-// "%s (%d) [ENTERING %s] @ %s:%d " format "\n", time_stamp, getpid(), __func__, __FILE__, __LINE__
-// "%s (%d) [ENTERING %s::%s] @ %s:%d " format "\n", time_stamp, getpid(), logger_stralpha_(typeid(*this).name()), __func__, __FILE__, __LINE__
-void logger_msg_ex_(char* buff, unsigned len, int nseverity, const char* severity, const char* theclass, const char* func, const char* file, int line, const char* format, ...)
-{
-    if(logger_options_ & (LOGGER_OPTION_FILE | LOGGER_OPTION_STDERR))
+    // we have to find file_name_prefix to the last directory separator in file
+    lg->file_name_prefix = strdup(file);
+    if(lg->file_name_prefix)
     {
-        const char* class_name = logger_stralpha(theclass);
-        const char* file_name = logger_stripfile(file);
-        make_timestamp(buff, len);
-        char *p = buff + strlen(buff);
-        len -= p - buff;
-        unsigned pid = GETPID();
-        if(!class_name) class_name = "";
-        if(!file_name) file_name = "";
-
-        // print first part
-        if(!func) snprintf(p, len, " (%d) %s", pid, severity);
-        else if(!theclass) snprintf(p, len, " (%d) %s %s @ %s:%d", pid, severity, func, file_name, line);
-        else snprintf(p, len, " (%d) %s %s::%s @ %s:%d", pid, severity, class_name, func, file_name, line);
-        p[len - 1] = 0;
+        char *p1 = strrchr(lg->file_name_prefix, '/');
+        char *p2 = strrchr(lg->file_name_prefix, '\\');
+        if(p1 && (!p2 || p1 > p2)) p1[1] = 0;
+        else if(p2) p2[1] = 0;
+        else lg->file_name_prefix[0] = 0;   // no directory in file name
+    }
 
-        logger_lock();
 
-        if(logger_options_ & LOGGER_OPTION_FILE)
+    if(options & (LOGGER_OPTION_KEEP_FILE_OPEN | LOGGER_OPTION_REOPEN))
+    {
+        if(options & LOGGER_OPTION_FILE)
         {
-            if(!fp && log_file) fp = fopen(log_file, "a");
-            if(fp)
-            {
-                va_list args;
-                va_start (args, format);
-                vfprintf(fp, format, args);
-                va_end (args);
-
-                if(logger_options_ & LOGGER_OPTION_FLUSH_FILE) fflush(fp);
-                if(logger_options_ & LOGGER_OPTION_KEEP_FILE_OPEN) ;
-                else
-                {
-                    fclose(fp);
-                    fp = 0;
-                }
-            }
+            if(lg->fp) fclose(lg->fp);
+            logger_file_open_(lg, options);
         }
-
-        if(logger_options_ & LOGGER_OPTION_STDERR)
+#if LOGGER_SYSLOG
+        if(options & LOGGER_OPTION_SYSLOG)
         {
-            va_list args;
-            va_start (args, format);
-            vfprintf(stderr, format, args);
-            va_end (args);
+            logger_syslog_open_();
         }
-
-        logger_unlock();
+#endif // LOGGER_SYSLOG
     }
+}
 
-#if LOGGER_SYSLOG
 
-    if(logger_options_ & LOGGER_OPTION_SYSLOG)
-    {
-        if(! syslog_open) logger_syslog_open_();
-        switch(nseverity)
-        {
-            case 0: nseverity = LOG_CRIT; break;
-            case 1: nseverity = LOG_ERR; break;
-            case 2: nseverity = LOG_WARNING; break;
-            case 3: nseverity = LOG_INFO; break;
-            default: nseverity = LOG_DEBUG;
-        }
+#if LOGGER_ASYNC
+static void logger_async_free_(logger_t* lg);
+static void logger_sync_free_(logger_t* lg);
+static void logger_flusher_free_(logger_t* lg);
+#endif // LOGGER_ASYNC
 
-        int len;
-        if(logger_options_ & LOGGER_OPTION_MILLISECONDS) len = 24;
-        else len = 20;
-        int slen = strlen(buff);
-        memmove(buff, buff + len, slen - len);
-        buff[slen - len - 1] = 0;
 
-        va_list ptr;
-        va_start(ptr, format);
-        vsyslog(nseverity, format, ptr);
-        va_end(ptr);
-    }
+// Close file of instance lg and free it's resources. Common part of logger_close()
+// and logger_destroy().
+static void logger_fini_(logger_t* lg)
+{
+#if LOGGER_ASYNC
+    logger_async_free_(lg);
+    logger_flusher_free_(lg);
+    logger_sync_free_(lg);
+#endif // LOGGER_ASYNC
 
-#endif // LOGGER_SYSLOG
+    if(lg->fp)
+    {
+        fclose(lg->fp);
+        lg->fp = 0;
+    }
+    logger_index_free_(lg);
+    if(lg->file_name_prefix)
+    {
+        free(lg->file_name_prefix);
+        lg->file_name_prefix = 0;
+    }
 
+#ifdef _WIN32
+    DeleteCriticalSection(&lg->mutex);
+#else
+    pthread_mutex_destroy(&lg->mutex);
+#endif // _WIN32
+}
+
+
+// Set log file name and options. Caller must provide storage for string
+// log_file_name. If LOGGER_OPTION_KEEP_FILE_OPEN option is specified we will open
+// named log file and save file handle for later use.
+void logger_open_ex(const char* log_file_name, unsigned options, const char* file)
+{
+    logger_init_(&logger_default_, log_file_name, options, file);
+}
+
+
+
+// this function will close log file (if open) and set file handle to NULL.
+void logger_close(void)
+{
+#if LOGGER_WATCH
+    logger_watch_stop();
+#endif // LOGGER_WATCH
+
+    logger_fini_(&logger_default_);
+
+#if LOGGER_SYSLOG
+    if(syslog_open)
+    {
+        closelog();
+        syslog_open = 0;
+    }
+#endif // LOGGER_SYSLOG
+}
+
+
+// Create new logger instance with it's own file, lock, level, masks and options.
+logger_t* logger_create_ex(const char* log_file_name, unsigned options, const char* file)
+{
+    logger_t* lg;
+
+    // instance must be aligned to cache line because of it's configuration block
+#ifdef _WIN32
+    lg = (logger_t*) _aligned_malloc(sizeof(logger_t), LOGGER_CACHE_LINE);
+    if(!lg) return 0;
+#else
+    if(posix_memalign((void**) &lg, LOGGER_CACHE_LINE, sizeof(logger_t))) return 0;
+#endif // _WIN32
+    memset(lg, 0, sizeof(logger_t));
+
+    if(log_file_name)
+    {
+        lg->log_file_copy = strdup(log_file_name);
+        log_file_name = lg->log_file_copy;
+    }
+    logger_init_(lg, log_file_name, options, file);
+    return lg;
+}
+
+
+// Close and free logger instance created by logger_create_ex().
+void logger_destroy(logger_t* lg)
+{
+    if(!lg || lg == &logger_default_) return;
+
+    logger_fini_(lg);
+    free(lg->log_file_copy);
+#ifdef _WIN32
+    _aligned_free(lg);
+#else
+    free(lg);
+#endif // _WIN32
+}
+
+
+// Set log level to one of LOGGER_LEVEL_FATAL, LOGGER_LEVEL_ERROR,
+// LOGGER_LEVEL_WARNING, LOGGER_LEVEL_INFO.
+// logger_config_.log_level will affect logging using log_fatal, log_error,
+// log_warn, log_info and log_debug functions.
+void logger_set_log_level(unsigned level)
+{
+    logger_set_log_level_of(&logger_default_, level);
+}
+
+
+// This function is used to set bits in logger_config_.debug_mask
+// Every bit in mask controls one feature that you want to debug.
+void logger_set_debug_mask(unsigned mask)
+{
+    logger_set_debug_mask_of(&logger_default_, mask);
+}
+
+
+// This function is used to get logger_config_.debug_mask
+unsigned logger_get_debug_mask(void)
+{
+    return LOGGER_ATOMIC_LOAD(logger_default_.requested.debug_mask);
+}
+
+
+// Enable debuging for feature (bitmask)
+void logger_enable_debug(unsigned feature)
+{
+    logger_enable_debug_of(&logger_default_, feature);
+}
+
+
+// Disable debuging for feature (bitmask)
+void logger_disable_debug(unsigned feature)
+{
+    logger_disable_debug_of(&logger_default_, feature);
+}
+
+// Enable trace for feature (bitmask)
+void logger_enable_trace(unsigned feature)
+{
+    logger_enable_trace_of(&logger_default_, feature);
+}
+
+// Disable trace for feature (bitmask)
+void logger_disable_trace(unsigned feature)
+{
+    logger_disable_trace_of(&logger_default_, feature);
+}
+
+
+// This function is used to set bits in logger_config_.trace_mask
+// Every bit in mask controls one feature that you want to trace.
+void logger_set_trace_mask(unsigned mask)
+{
+    logger_set_trace_mask_of(&logger_default_, mask);
+}
+
+
+// This function is used to get logger_config_.trace_mask
+unsigned logger_get_trace_mask(void)
+{
+    return LOGGER_ATOMIC_LOAD(logger_default_.requested.trace_mask);
+}
+
+
+// Copy consistent snapshot of configuration block (level, masks and options) to config.
+void logger_get_config(logger_config_t* config)
+{
+    logger_get_config_of(&logger_default_, config);
+}
+
+
+// Atomically replace level, masks and options with the ones from config.
+void logger_set_config(const logger_config_t* config)
+{
+    logger_set_config_of(&logger_default_, config);
+}
+
+
+// Set log level of instance lg
+void logger_set_log_level_of(logger_t* lg, unsigned level)
+{
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    LOGGER_ATOMIC_STORE(lg->requested.log_level, level);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
+}
+
+
+// Set debug mask of instance lg
+void logger_set_debug_mask_of(logger_t* lg, unsigned mask)
+{
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    LOGGER_ATOMIC_STORE(lg->requested.debug_mask, mask);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
+}
+
+
+// Set trace mask of instance lg
+void logger_set_trace_mask_of(logger_t* lg, unsigned mask)
+{
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    LOGGER_ATOMIC_STORE(lg->requested.trace_mask, mask);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
+}
+
+
+// Enable debuging for feature (bitmask) of instance lg
+void logger_enable_debug_of(logger_t* lg, unsigned feature)
+{
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    LOGGER_ATOMIC_STORE(lg->requested.debug_mask, lg->requested.debug_mask | feature);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
+}
+
+
+// Disable debuging for feature (bitmask) of instance lg
+void logger_disable_debug_of(logger_t* lg, unsigned feature)
+{
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    LOGGER_ATOMIC_STORE(lg->requested.debug_mask, lg->requested.debug_mask & ~feature);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
+}
+
+
+// Enable trace for feature (bitmask) of instance lg
+void logger_enable_trace_of(logger_t* lg, unsigned feature)
+{
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    LOGGER_ATOMIC_STORE(lg->requested.trace_mask, lg->requested.trace_mask | feature);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
+}
+
+
+// Disable trace for feature (bitmask) of instance lg
+void logger_disable_trace_of(logger_t* lg, unsigned feature)
+{
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    LOGGER_ATOMIC_STORE(lg->requested.trace_mask, lg->requested.trace_mask & ~feature);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
+}
+
+
+// Copy consistent snapshot of configuration of instance lg to config. Level and masks
+// are the ones set by user, not limited by sink filters.
+void logger_get_config_of(logger_t* lg, logger_config_t* config)
+{
+    unsigned seq;
+
+    for(;;)
+    {
+        seq = LOGGER_ATOMIC_LOAD(lg->config.seq);
+        LOGGER_FENCE_ACQUIRE();
+        if(seq & 1)
+        {
+            LOGGER_PAUSE();
+            continue;
+        }
+        config->log_level = LOGGER_ATOMIC_LOAD(lg->requested.log_level);
+        config->debug_mask = LOGGER_ATOMIC_LOAD(lg->requested.debug_mask);
+        config->trace_mask = LOGGER_ATOMIC_LOAD(lg->requested.trace_mask);
+        config->options = LOGGER_ATOMIC_LOAD(lg->requested.options);
+        LOGGER_FENCE_ACQUIRE();
+        if(LOGGER_ATOMIC_LOAD(lg->config.seq) == seq) break;
+    }
+    config->seq = seq;
+}
+
+
+// Atomically replace level, masks and options of instance lg with the ones from config.
+void logger_set_config_of(logger_t* lg, const logger_config_t* config)
+{
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    LOGGER_ATOMIC_STORE(lg->requested.debug_mask, config->debug_mask);
+    LOGGER_ATOMIC_STORE(lg->requested.trace_mask, config->trace_mask);
+    LOGGER_ATOMIC_STORE(lg->requested.options, config->options);
+    LOGGER_ATOMIC_STORE(lg->requested.log_level, config->log_level);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
+}
+
+
+
+// ###################################  CATEGORIES  ###################################
+
+
+// level of every category, indexed by category id
+unsigned char logger_category_level_[LOGGER_MAX_CATEGORIES];
+
+// category names are never freed, so logger_category_name() doesn't need lock
+static const char* category_name[LOGGER_MAX_CATEGORIES] = { "" };
+static unsigned category_count = 1;
+static unsigned category_lock = 0;
+
+
+// find category with name of length len, must be called with category lock held
+static int logger_category_find_(const char* name, size_t len)
+{
+    unsigned i;
+
+    for(i = 0; i < category_count; i++)
+    {
+        if(!strncmp(category_name[i], name, len) && category_name[i][len] == 0) return i;
+    }
+    return -1;
+}
+
+
+// add category with name of length len, must be called with category lock held
+static unsigned logger_category_add_(const char* name, size_t len, unsigned parent)
+{
+    unsigned id = category_count;
+    char* p;
+
+    if(id >= LOGGER_MAX_CATEGORIES) return 0;
+    p = (char*) malloc(len + 1);
+    if(!p) return 0;
+    memcpy(p, name, len);
+    p[len] = 0;
+
+    category_name[id] = p;
+    LOGGER_ATOMIC_STORE8(logger_category_level_[id], logger_category_level_[parent]);
+    // name must be visible before id can be used
+    LOGGER_FENCE_RELEASE();
+    LOGGER_ATOMIC_STORE(category_count, id + 1);
+    return id;
+}
+
+
+// Register category name and return it's id. Missing parent categories are registered too.
+unsigned logger_category_register(const char* name)
+{
+    unsigned id = 0;
+    size_t len = 0;
+
+    logger_spin_lock_(&category_lock);
+    while(name[len])
+    {
+        const char* dot = strchr(name + len, '.');
+        int found;
+
+        len = dot ? (size_t)(dot - name) : strlen(name);
+        found = logger_category_find_(name, len);
+        if(found >= 0) id = found;
+        else
+        {
+            id = logger_category_add_(name, len, id);
+            if(!id) break;
+        }
+        if(dot) len++;
+    }
+    logger_spin_unlock_(&category_lock);
+    return id;
+}
+
+
+// Find registered category. Returns it's id or -1 if name is not registered.
+int logger_category_find(const char* name)
+{
+    int id;
+
+    logger_spin_lock_(&category_lock);
+    id = logger_category_find_(name, strlen(name));
+    logger_spin_unlock_(&category_lock);
+    return id;
+}
+
+
+// Set level of category name and all of it's children.
+int logger_category_set_level(const char* name, unsigned level)
+{
+    size_t len = strlen(name);
+    unsigned i;
+    int found = 0;
+
+    logger_spin_lock_(&category_lock);
+    for(i = 0; i < category_count; i++)
+    {
+        const char* n = category_name[i];
+        if(len == 0 || (!strncmp(n, name, len) && (n[len] == 0 || n[len] == '.')))
+        {
+            LOGGER_ATOMIC_STORE8(logger_category_level_[i], level);
+            found = 1;
+        }
+    }
+    logger_spin_unlock_(&category_lock);
+    return found ? 0 : -1;
+}
+
+
+// Get level of category id.
+unsigned logger_category_get_level(unsigned id)
+{
+    if(id >= LOGGER_MAX_CATEGORIES) return 0;
+    return LOGGER_ATOMIC_LOAD8(logger_category_level_[id]);
+}
+
+
+// Get name of category id.
+const char* logger_category_name(unsigned id)
+{
+    if(id >= LOGGER_ATOMIC_LOAD(category_count)) return "";
+    LOGGER_FENCE_ACQUIRE();
+    return category_name[id];
+}
+
+
+
+// ###################################  THREAD OVERRIDES  ###################################
+
+
+// overrides of calling thread, checked by logger_is_* macros
+LOGGER_THREAD_LOCAL logger_thread_t logger_thread_;
+
+// registered threads, protected by thread_lock
+static logger_thread_t* thread_list = 0;
+static unsigned thread_lock = 0;
+
+#ifndef _WIN32
+// used only to unregister thread when it exits
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+static void logger_thread_exit_(void* arg)
+{
+    (void) arg;
+    logger_thread_unregister();
+}
+
+static void logger_thread_key_init_(void)
+{
+    pthread_key_create(&thread_key, logger_thread_exit_);
+}
+#endif // _WIN32
+
+
+// Register calling thread so it's overrides can be set by other threads using it's thread id.
+void logger_thread_register(void)
+{
+    logger_thread_t* t = &logger_thread_;
+
+    if(t->registered) return;
+    t->tid = GETPID();
+
+    logger_spin_lock_(&thread_lock);
+    t->next = thread_list;
+    thread_list = t;
+    t->registered = 1;
+    logger_spin_unlock_(&thread_lock);
+
+#ifndef _WIN32
+    pthread_once(&thread_key_once, logger_thread_key_init_);
+    pthread_setspecific(thread_key, t);
+#endif // _WIN32
+}
+
+
+// Unregister calling thread. On Linux it is called automatically when thread exits.
+void logger_thread_unregister(void)
+{
+    logger_thread_t* t = &logger_thread_;
+    logger_thread_t** pp;
+
+    if(!t->registered) return;
+
+    logger_spin_lock_(&thread_lock);
+    for(pp = &thread_list; *pp; pp = &(*pp)->next)
+    {
+        if(*pp == t)
+        {
+            *pp = t->next;
+            break;
+        }
+    }
+    t->registered = 0;
+    logger_spin_unlock_(&thread_lock);
+}
+
+
+// Set level, debug mask and trace mask overrides for thread tid.
+int logger_thread_set_override(long tid, unsigned level, unsigned debug_mask, unsigned trace_mask)
+{
+    logger_thread_t* t;
+
+    if(tid == 0)
+    {
+        logger_thread_register();
+        tid = logger_thread_.tid;
+    }
+
+    logger_spin_lock_(&thread_lock);
+    for(t = thread_list; t; t = t->next)
+    {
+        if(t->tid == tid)
+        {
+            LOGGER_ATOMIC_STORE(t->debug_mask, debug_mask);
+            LOGGER_ATOMIC_STORE(t->trace_mask, trace_mask);
+            LOGGER_ATOMIC_STORE(t->log_level, level);
+            break;
+        }
+    }
+    logger_spin_unlock_(&thread_lock);
+    return t ? 0 : -1;
+}
+
+
+// Remove overrides for thread tid.
+int logger_thread_clear_override(long tid)
+{
+    return logger_thread_set_override(tid, 0, 0, 0);
+}
+
+
+
+// ###################################  SAMPLING  ###################################
+
+
+// sampling rate and mode for 32 debug features followed by 32 trace features
+unsigned logger_sample_rate_[64];
+unsigned logger_sample_mode_[64];
+
+
+static void logger_set_sampling_(unsigned features, unsigned base, unsigned rate, int mode)
+{
+    unsigned i;
+
+    if(rate < 2) rate = 0;
+    for(i = 0; i < 32; i++)
+    {
+        if(features & (1u << i))
+        {
+            LOGGER_ATOMIC_STORE(logger_sample_mode_[base + i], (unsigned) mode);
+            LOGGER_ATOMIC_STORE(logger_sample_rate_[base + i], rate);
+        }
+    }
+}
+
+
+// Set sampling for all debug features in features (bitmask). rate 0 or 1 disables sampling.
+void logger_set_debug_sampling(unsigned features, unsigned rate, int mode)
+{
+    logger_set_sampling_(features, 0, rate, mode);
+}
+
+
+// Set sampling for all trace features in features (bitmask). rate 0 or 1 disables sampling.
+void logger_set_trace_sampling(unsigned features, unsigned rate, int mode)
+{
+    logger_set_sampling_(features, 32, rate, mode);
+}
+
+
+// Sampling decision for feature. Returns 0 if line should be skipped or weight of the line.
+unsigned logger_sample_(unsigned feature, unsigned base)
+{
+    logger_thread_t* t = &logger_thread_;
+    unsigned i, rate;
+
+    if(!feature) return 1;
+    for(i = 0; !(feature & (1u << i)); i++) ;
+    i += base;
+
+    rate = LOGGER_ATOMIC_LOAD(logger_sample_rate_[i]);
+    if(!rate) return 1;
+
+    if(LOGGER_ATOMIC_LOAD(logger_sample_mode_[i]) == LOGGER_SAMPLE_RANDOM)
+    {
+        // xorshift32, seeded from thread id
+        unsigned x = t->random;
+        if(!x) x = (unsigned) GETPID() * 2654435761u + 1;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        t->random = x;
+        // x * rate / 2^32 is uniform in 0 .. rate-1
+        return ((unsigned long long) x * rate >> 32) == 0 ? rate : 0;
+    }
+
+    if(++t->sample_count[i] < rate) return 0;
+    t->sample_count[i] = 0;
+    return rate;
+}
+
+
+
+// ###################################  CONFIGURATION FILE  ###################################
+
+
+// strip leading and trailing white space, modifies string in place
+static char* logger_strtrim(char* s)
+{
+    char *e;
+
+    while(isspace((unsigned char)*s)) ++s;
+    e = s + strlen(s);
+    while(e > s && isspace((unsigned char)e[-1])) --e;
+    *e = 0;
+    return s;
+}
+
+
+// parse number (decimal, hex or octal, can be negative like -1 for all bits)
+static int logger_parse_number(const char* value, unsigned* result)
+{
+    char* end;
+
+    if(!*value) return -1;
+    if(*value == '-') *result = (unsigned) strtol(value, &end, 0);
+    else *result = (unsigned) strtoul(value, &end, 0);
+    return *end ? -1 : 0;
+}
+
+
+static int logger_parse_level(const char* value, unsigned* level)
+{
+    static const char* const names[] = { "fatal", "error", "warn", "info", "debug", "trace" };
+    unsigned i;
+
+    if(!strcasecmp(value, "warning")) value = "warn";
+    for(i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if(!strcasecmp(value, names[i]))
+        {
+            *level = i;
+            return 0;
+        }
+    }
+    return logger_parse_number(value, level);
+}
+
+
+static int logger_parse_bool(const char* value)
+{
+    if(!strcasecmp(value, "on") || !strcasecmp(value, "yes") || !strcasecmp(value, "true") || !strcmp(value, "1")) return 1;
+    if(!strcasecmp(value, "off") || !strcasecmp(value, "no") || !strcasecmp(value, "false") || !strcmp(value, "0")) return 0;
+    return -1;
+}
+
+
+// Read configuration file and apply it. Returns 0 on success or -1 if file can't
+// be opened or has syntax error. In case of error nothing is changed.
+int logger_load_config(const char* config_file)
+{
+    static const struct
+    {
+        const char* name;
+        unsigned option;
+    } option_names[] =
+    {
+        { "file",           LOGGER_OPTION_FILE },
+        { "stderr",         LOGGER_OPTION_STDERR },
+        { "syslog",         LOGGER_OPTION_SYSLOG },
+        { "flush",          LOGGER_OPTION_FLUSH_FILE },
+        { "keep_open",      LOGGER_OPTION_KEEP_FILE_OPEN },
+        { "reopen",         LOGGER_OPTION_REOPEN },
+        { "milliseconds",   LOGGER_OPTION_MILLISECONDS },
+        { "microseconds",   LOGGER_OPTION_MICROSECONDS },
+        { "nanoseconds",    LOGGER_OPTION_NANOSECONDS },
+        { "index",          LOGGER_OPTION_INDEX },
+    };
+    enum { HAVE_LEVEL = 1, HAVE_DEBUG_MASK = 2, HAVE_TRACE_MASK = 4 };
+    enum { MAX_CATEGORIES = 32 };
+    unsigned have = 0, level = 0, debug_mask = 0, trace_mask = 0;
+    unsigned set_options = 0, clear_options = 0;
+    struct
+    {
+        char name[64];
+        unsigned level;
+    } categories[MAX_CATEGORIES];
+    unsigned ncategories = 0, i;
+    char line[256];
+    int error = 0;
+    FILE* f;
+
+    f = fopen(config_file, "r");
+    if(!f) return -1;
+
+    // first parse whole file so we can apply all or nothing
+    while(!error && fgets(line, sizeof(line), f))
+    {
+        char *key, *value, *p;
+
+        p = strchr(line, '#');
+        if(p) *p = 0;
+        key = logger_strtrim(line);
+        if(!*key) continue;
+        p = strchr(key, '=');
+        if(!p)
+        {
+            error = 1;
+            break;
+        }
+        *p = 0;
+        key = logger_strtrim(key);
+        value = logger_strtrim(p + 1);
+
+        if(!strcmp(key, "level"))
+        {
+            error = logger_parse_level(value, &level);
+            have |= HAVE_LEVEL;
+        }
+        else if(!strncmp(key, "level.", 6))
+        {
+            // category level, e.g. level.net.http = debug
+            if(ncategories == MAX_CATEGORIES || strlen(key + 6) >= sizeof(categories[0].name)) error = 1;
+            else
+            {
+                strcpy(categories[ncategories].name, key + 6);
+                error = logger_parse_level(value, &categories[ncategories].level);
+                ncategories++;
+            }
+        }
+        else if(!strcmp(key, "debug_mask"))
+        {
+            error = logger_parse_number(value, &debug_mask);
+            have |= HAVE_DEBUG_MASK;
+        }
+        else if(!strcmp(key, "trace_mask"))
+        {
+            error = logger_parse_number(value, &trace_mask);
+            have |= HAVE_TRACE_MASK;
+        }
+        else
+        {
+            for(i = 0; i < sizeof(option_names) / sizeof(option_names[0]); i++)
+            {
+                if(!strcmp(key, option_names[i].name)) break;
+            }
+            if(i == sizeof(option_names) / sizeof(option_names[0])) error = 1;
+            else
+            {
+                int on = logger_parse_bool(value);
+                if(on < 0) error = 1;
+                else if(on) set_options |= option_names[i].option;
+                else clear_options |= option_names[i].option;
+            }
+        }
+    }
+    fclose(f);
+    if(error) return -1;
+
+    // apply everything as single update
+    unsigned seq = logger_config_write_begin_(&logger_config_);
+    if(have & HAVE_DEBUG_MASK) LOGGER_ATOMIC_STORE(logger_default_.requested.debug_mask, debug_mask);
+    if(have & HAVE_TRACE_MASK) LOGGER_ATOMIC_STORE(logger_default_.requested.trace_mask, trace_mask);
+    if(set_options | clear_options)
+    {
+        LOGGER_ATOMIC_STORE(logger_default_.requested.options, (logger_default_.requested.options & ~clear_options) | set_options);
+    }
+    if(have & HAVE_LEVEL) LOGGER_ATOMIC_STORE(logger_default_.requested.log_level, level);
+    logger_publish_(&logger_default_);
+    logger_config_write_end_(&logger_config_, seq);
+
+    // categories from configuration file are registered so they can be configured
+    // before code that uses them registers them
+    for(i = 0; i < ncategories; i++)
+    {
+        logger_category_register(categories[i].name);
+        logger_category_set_level(categories[i].name, categories[i].level);
+    }
+    return 0;
+}
+
+
+#if LOGGER_WATCH
+
+static void* logger_watch_thread_(void* arg)
+{
+    // inotify_event must be aligned
+    char buff[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd[2];
+
+    (void) arg;
+    pfd[0].fd = watch_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = watch_pipe[0];
+    pfd[1].events = POLLIN;
+
+    for(;;)
+    {
+        ssize_t n;
+        char *p;
+        int changed = 0;
+
+        if(poll(pfd, 2, -1) < 0)
+        {
+            if(errno == EINTR) continue;
+            break;
+        }
+        if(pfd[1].revents) break;   // logger_watch_stop()
+
+        n = read(watch_fd, buff, sizeof(buff));
+        if(n <= 0) continue;
+
+        // we are watching directory so editors that write new file and rename it
+        // over the old one are handled too
+        for(p = buff; p < buff + n; )
+        {
+            const struct inotify_event* ev = (const struct inotify_event*) p;
+            if(ev->len && !strcmp(ev->name, watch_name)) changed = 1;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        if(changed) logger_load_config(watch_file);
+    }
+    return 0;
+}
+
+
+// Start a thread which watches config_file using inotify and applies it (using
+// logger_load_config()) every time it is written or replaced (renamed over).
+int logger_watch_start(const char* config_file)
+{
+    char* p;
+
+    if(watch_running) logger_watch_stop();
+
+    watch_file = strdup(config_file);
+    if(!watch_file) return -1;
+
+    watch_fd = inotify_init1(IN_CLOEXEC);
+    if(watch_fd < 0) goto error;
+
+    // watch the directory, not the file
+    p = strrchr(watch_file, '/');
+    if(p)
+    {
+        *p = 0;
+        if(inotify_add_watch(watch_fd, p == watch_file ? "/" : watch_file, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        {
+            *p = '/';
+            goto error;
+        }
+        *p = '/';
+        watch_name = p + 1;
+    }
+    else
+    {
+        if(inotify_add_watch(watch_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) goto error;
+        watch_name = watch_file;
+    }
+
+    if(pipe(watch_pipe) < 0) goto error;
+    if(pthread_create(&watch_thread, 0, logger_watch_thread_, 0)) goto error;
+    watch_running = 1;
+
+    logger_load_config(watch_file);
+    return 0;
+
+error:
+    if(watch_pipe[0] >= 0)
+    {
+        close(watch_pipe[0]);
+        close(watch_pipe[1]);
+        watch_pipe[0] = watch_pipe[1] = -1;
+    }
+    if(watch_fd >= 0)
+    {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+    free(watch_file);
+    watch_file = 0;
+    return -1;
+}
+
+
+// Stop watcher thread started by logger_watch_start().
+void logger_watch_stop(void)
+{
+    if(!watch_running) return;
+
+    ssize_t n = write(watch_pipe[1], "x", 1);
+    (void) n;
+    pthread_join(watch_thread, 0);
+    watch_running = 0;
+
+    close(watch_pipe[0]);
+    close(watch_pipe[1]);
+    watch_pipe[0] = watch_pipe[1] = -1;
+    close(watch_fd);
+    watch_fd = -1;
+    free(watch_file);
+    watch_file = 0;
+    watch_name = 0;
+}
+
+#endif // LOGGER_WATCH
+
+
+
+// ###################################  CLOCK  ###################################
+
+// Timestamps are read as raw ticks and converted to calendar time only when line is rendered.
+// On x86-64 with invariant TSC ticks are TSC cycles. TSC rate is measured against
+// CLOCK_MONOTONIC_RAW (which NTP doesn't slew) and TSC is anchored to CLOCK_REALTIME when
+// logger is opened and then every LOGGER_CLOCK_CALIBRATE_MS milliseconds, by the thread
+// which renders the first line after that time. Without TSC ticks are CLOCK_MONOTONIC ns and
+// offset to wall clock is sampled again at the same interval (on Windows ticks are wall
+// clock ns). Both rendered timestamp and logger_monotonic_ns() time of a line come from one
+// tick read.
+
+#if LOGGER_TSC
+static struct
+{
+    unsigned seq;                   // seqlock for anchor and mult
+    unsigned calibrating;           // one thread calibrates at a time
+    int state;                      // 0 not initialized, 1 TSC is used, -1 TSC is not usable
+    unsigned long long anchor_tsc;  // wall ns = anchor_ns + ((tsc - anchor_tsc) * mult >> 32)
+    unsigned long long anchor_ns;
+    unsigned long long anchor_mono; // same for CLOCK_MONOTONIC
+    unsigned long long mult;
+    unsigned long long base_tsc;    // start of rate measurement
+    unsigned long long base_raw;
+    unsigned long long next_tsc;    // calibrate again when TSC gets here
+} logger_clock_;
+
+
+static unsigned long long logger_clock_gettime_(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// Read clock id together with TSC, TSC is taken in the middle of the shortest of 3 reads.
+static unsigned long long logger_clock_sample_(clockid_t id, unsigned long long* tsc)
+{
+    unsigned long long best = ~0ULL, ns = 0;
+    int i;
+
+    *tsc = 0;
+    for(i = 0; i < 3; i++)
+    {
+        unsigned long long t0 = __rdtsc();
+        unsigned long long t = logger_clock_gettime_(id);
+        unsigned long long t1 = __rdtsc();
+        if(t1 - t0 < best)
+        {
+            best = t1 - t0;
+            ns = t;
+            *tsc = t0 + (t1 - t0) / 2;
+        }
+    }
+    return ns;
+}
+
+
+// Use TSC only if CPU says it is invariant (constant rate, runs in all C states).
+static void logger_clock_init_(void)
+{
+    unsigned a, b, c, d;
+    int state = -1;
+
+    if(LOGGER_ATOMIC_LOAD(logger_clock_.state)) return;
+    if(__get_cpuid(0x80000000, &a, &b, &c, &d) && a >= 0x80000007 &&
+       __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1u << 8))) state = 1;
+    if(state > 0) logger_clock_calibrate();
+    LOGGER_ATOMIC_STORE(logger_clock_.state, state);
+}
+#endif // LOGGER_TSC
+
+
+// Measure TSC rate and anchor TSC to wall clock again. Done automatically, but it can be
+// called after wall clock is set. Does nothing if TSC is not used.
+void logger_clock_calibrate(void)
+{
+#if LOGGER_TSC
+    unsigned long long tsc, raw, ns, mult, d;
+    unsigned expected = 0;
+
+    if(LOGGER_ATOMIC_LOAD(logger_clock_.state) < 0) return;
+    if(!LOGGER_ATOMIC_CAS(logger_clock_.calibrating, expected, 1)) return;
+
+    // first calibration measures rate over LOGGER_CLOCK_INIT_US, later ones over time since then
+    if(!logger_clock_.base_tsc)
+    {
+        logger_clock_.base_raw = logger_clock_sample_(CLOCK_MONOTONIC_RAW, &logger_clock_.base_tsc);
+        do raw = logger_clock_sample_(CLOCK_MONOTONIC_RAW, &tsc);
+        while(raw - logger_clock_.base_raw < LOGGER_CLOCK_INIT_US * 1000ULL);
+    }
+    else raw = logger_clock_sample_(CLOCK_MONOTONIC_RAW, &tsc);
+    mult = (unsigned long long)(((unsigned __int128)(raw - logger_clock_.base_raw) << 32) / (tsc - logger_clock_.base_tsc));
+
+    // rate that changed more than 1% means TSC or raw clock jumped (suspend, VM migration),
+    // so keep old rate and start measuring again from here
+    d = mult > logger_clock_.mult ? mult - logger_clock_.mult : logger_clock_.mult - mult;
+    if(logger_clock_.mult && d > logger_clock_.mult / 100)
+    {
+        mult = logger_clock_.mult;
+        logger_clock_.base_tsc = tsc;
+        logger_clock_.base_raw = raw;
+    }
+
+    ns = logger_clock_sample_(CLOCK_REALTIME, &tsc);
+    unsigned long long mono_tsc, mono = logger_clock_sample_(CLOCK_MONOTONIC, &mono_tsc);
+    mono -= (unsigned long long)(((unsigned __int128)(mono_tsc - tsc) * mult) >> 32);
+    unsigned seq = LOGGER_ATOMIC_LOAD(logger_clock_.seq) + 1;
+    LOGGER_ATOMIC_STORE(logger_clock_.seq, seq);
+    LOGGER_FENCE();
+    __atomic_store_n(&logger_clock_.anchor_tsc, tsc, __ATOMIC_RELAXED);
+    __atomic_store_n(&logger_clock_.anchor_ns, ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&logger_clock_.anchor_mono, mono, __ATOMIC_RELAXED);
+    __atomic_store_n(&logger_clock_.mult, mult, __ATOMIC_RELAXED);
+    LOGGER_FENCE_RELEASE();
+    LOGGER_ATOMIC_STORE(logger_clock_.seq, seq + 1);
+
+    __atomic_store_n(&logger_clock_.next_tsc,
+        tsc + (((unsigned __int128) LOGGER_CLOCK_CALIBRATE_MS * 1000000ULL << 32) / mult), __ATOMIC_RELAXED);
+    LOGGER_ATOMIC_STORE(logger_clock_.calibrating, 0);
+#endif // LOGGER_TSC
+}
+
+
+// Returns 1 if timestamps are taken from TSC.
+int logger_clock_is_tsc(void)
+{
+#if LOGGER_TSC
+    return LOGGER_ATOMIC_LOAD(logger_clock_.state) > 0;
+#else
+    return 0;
+#endif // LOGGER_TSC
+}
+
+
+// Current time in raw ticks.
+static unsigned long long logger_clock_ticks_(void)
+{
+#if LOGGER_TSC
+    if(LOGGER_ATOMIC_LOAD(logger_clock_.state) > 0) return __rdtsc();
+#endif // LOGGER_TSC
+
+#ifdef WIN32
+    /* 64-bit value representing the number of 100-nanosecond intervals since January 1, 1601 00:00 UTC */
+    FILETIME               filetime;
+    ULARGE_INTEGER         x;
+    /* 100 ns intervals betweeen Jan 1,1601 and Jan 1,1970 */
+    static const ULONGLONG epoch_offset = 116444736000000000ULL;
+
+//#if _WIN32_WINNT >= _WIN32_WINNT_WIN8
+//    GetSystemTimePreciseAsFileTime(&filetime);
+//#else
+    GetSystemTimeAsFileTime(&filetime);
+//#endif
+    x.LowPart =  filetime.dwLowDateTime;
+    x.HighPart = filetime.dwHighDateTime;
+    return (x.QuadPart - epoch_offset) * 100;
+#else // ! WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif // WIN32
+}
+
+
+#if !defined(WIN32)
+// wall clock - CLOCK_MONOTONIC when TSC is not used
+static unsigned long long logger_clock_offset_;
+static unsigned long long logger_clock_offset_next_;
+
+// Returns offset of wall clock to CLOCK_MONOTONIC ticks, sampled again every
+// LOGGER_CLOCK_CALIBRATE_MS so NTP steps get into timestamps.
+static unsigned long long logger_clock_wall_offset_(unsigned long long ticks)
+{
+    if(ticks >= __atomic_load_n(&logger_clock_offset_next_, __ATOMIC_RELAXED))
+    {
+        struct timespec rt, mt;
+        clock_gettime(CLOCK_REALTIME, &rt);
+        clock_gettime(CLOCK_MONOTONIC, &mt);
+        __atomic_store_n(&logger_clock_offset_,
+            ((unsigned long long) rt.tv_sec - mt.tv_sec) * 1000000000ULL + rt.tv_nsec - mt.tv_nsec, __ATOMIC_RELAXED);
+        __atomic_store_n(&logger_clock_offset_next_, ticks + LOGGER_CLOCK_CALIBRATE_MS * 1000000ULL, __ATOMIC_RELAXED);
+    }
+    return __atomic_load_n(&logger_clock_offset_, __ATOMIC_RELAXED);
+}
+#endif // WIN32
+
+
+// Convert ticks from logger_clock_ticks_() to wall clock ns since the epoch and, if mono
+// is not 0, to logger_monotonic_ns() time.
+static unsigned long long logger_clock_to_ns_(unsigned long long ticks, unsigned long long* mono)
+{
+#if LOGGER_TSC
+    unsigned long long anchor_tsc, anchor_ns, anchor_mono, mult, d;
+    unsigned seq;
+
+    if(LOGGER_ATOMIC_LOAD(logger_clock_.state) <= 0) goto no_tsc;
+    if(ticks >= __atomic_load_n(&logger_clock_.next_tsc, __ATOMIC_RELAXED)) logger_clock_calibrate();
+
+    for(;;)
+    {
+        seq = LOGGER_ATOMIC_LOAD(logger_clock_.seq);
+        LOGGER_FENCE_ACQUIRE();
+        if(seq & 1)
+        {
+            LOGGER_PAUSE();
+            continue;
+        }
+        anchor_tsc = __atomic_load_n(&logger_clock_.anchor_tsc, __ATOMIC_RELAXED);
+        anchor_ns = __atomic_load_n(&logger_clock_.anchor_ns, __ATOMIC_RELAXED);
+        anchor_mono = __atomic_load_n(&logger_clock_.anchor_mono, __ATOMIC_RELAXED);
+        mult = __atomic_load_n(&logger_clock_.mult, __ATOMIC_RELAXED);
+        LOGGER_FENCE_ACQUIRE();
+        if(LOGGER_ATOMIC_LOAD(logger_clock_.seq) == seq) break;
+    }
+
+    // ticks can be taken just before anchor was moved
+    if(ticks >= anchor_tsc)
+    {
+        d = (unsigned long long)(((unsigned __int128)(ticks - anchor_tsc) * mult) >> 32);
+        if(mono) *mono = anchor_mono + d;
+        return anchor_ns + d;
+    }
+    d = (unsigned long long)(((unsigned __int128)(anchor_tsc - ticks) * mult) >> 32);
+    if(mono) *mono = anchor_mono - d;
+    return anchor_ns - d;
+
+no_tsc:
+#endif // LOGGER_TSC
+#ifdef WIN32
+    // wall clock ticks can't be used for durations
+    if(mono) *mono = logger_monotonic_ns();
+    return ticks;
+#else
+    if(mono) *mono = ticks;
+    return ticks + logger_clock_wall_offset_(ticks);
+#endif // WIN32
+}
+
+
+// Render ticks as local time with precision selected by options. Calendar conversion is
+// done once per second per thread, other lines of the same second reuse it.
+static void logger_render_time_(char* buffer, unsigned buff_size, unsigned options, unsigned long long ticks, unsigned long long* mono)
+{
+    static LOGGER_THREAD_LOCAL time_t cached_sec;
+    static LOGGER_THREAD_LOCAL char cached[32];
+    unsigned long long ns = logger_clock_to_ns_(ticks, mono);
+    time_t sec = (time_t)(ns / 1000000000ULL);
+    unsigned frac = (unsigned)(ns % 1000000000ULL);
+
+    if(sec != cached_sec || !cached[0])
+    {
+        struct tm TM;
+#ifdef WIN32
+        localtime_s(&TM, &sec);
+#else
+        localtime_r(&sec, &TM);
+#endif // WIN32
+        snprintf(cached, sizeof(cached), "%04u-%02u-%02u %02u:%02u:%02u",
+            (unsigned short)(TM.tm_year + 1900), (unsigned char)(TM.tm_mon + 1), (unsigned char) TM.tm_mday,
+            (unsigned char) TM.tm_hour, (unsigned char) TM.tm_min, (unsigned char) TM.tm_sec);
+        cached_sec = sec;
+    }
+
+    if(options & LOGGER_OPTION_NANOSECONDS) snprintf(buffer, buff_size, "%s.%09u", cached, frac);
+    else if(options & LOGGER_OPTION_MICROSECONDS) snprintf(buffer, buff_size, "%s.%06u", cached, frac / 1000);
+    else if(options & LOGGER_OPTION_MILLISECONDS) snprintf(buffer, buff_size, "%s.%03u", cached, frac / 1000000);
+    else snprintf(buffer, buff_size, "%s", cached);
+}
+
+
+// Render current time to buffer, returns logger_monotonic_ns() time of the same clock read.
+static unsigned long long make_timestamp(char* buffer, unsigned buff_size, unsigned options)
+{
+    unsigned long long mono;
+
+    logger_render_time_(buffer, buff_size, options, logger_clock_ticks_(), &mono);
+    return mono;
+}
+
+
+void logger_lock(void)
+{
+    logger_lock_of(&logger_default_);
+}
+
+
+void logger_unlock(void)
+{
+    logger_unlock_of(&logger_default_);
+}
+
+
+void logger_lock_of(logger_t* lg)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&lg->mutex);
+#else
+    pthread_mutex_lock(&lg->mutex);
+#endif // _WIN32
+}
+
+
+void logger_unlock_of(logger_t* lg)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&lg->mutex);
+#else
+    pthread_mutex_unlock(&lg->mutex);
+#endif // _WIN32
+}
+
+
+static const char* logger_stripfile(logger_t* lg, const char* file)
+{
+    const char *p = lg->file_name_prefix;
+
+    if(!file || !p) return file;
+
+    while(*p && *p == *file) ++p, ++file;
+    return file;
+}
+
+// helper function for C++ class name
+// class name is returned by typeid(*this).name() and on some
+// compilers like GCC/G++ class name have numeric prefix that
+// need to be stripped off.
+static const char* logger_stralpha(const char* name)
+{
+    int i = 0;
+
+    if(!name) return name;
+
+    while(name[i])
+    {
+        if(name[i] >= '0' && name[i] <= '9')
+        {
+            i++;
+            continue;
+        }
+        return name + i;
+    }
+    return name;
+}
+
+
+// ###################################  SINKS  ###################################
+
+
+// Add sink to instance lg.
+logger_sink_t* logger_add_sink(logger_t* lg, const logger_sink_ops_t* ops, void* ctx, unsigned level, unsigned debug_mask, unsigned trace_mask)
+{
+    logger_sink_t* sink = 0;
+    unsigned i;
+
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    for(i = 0; i < LOGGER_MAX_SINKS; i++)
+    {
+        if(lg->sinks[i].active || lg->sinks[i].option || lg->sinks[i].closing) continue;
+        sink = &lg->sinks[i];
+        sink->ops = ops;
+        sink->ctx = ctx;
+        sink->level = level;
+        sink->debug_mask = debug_mask;
+        sink->trace_mask = trace_mask;
+        LOGGER_FENCE_RELEASE();
+        LOGGER_ATOMIC_STORE(sink->active, 1);
+        logger_publish_(lg);
+        break;
+    }
+    logger_config_write_end_(&lg->config, seq);
+    return sink;
+}
+
+
+// Remove sink from instance lg and close it. Close is called after every thread that
+// is writing to it is done. Slot is given back to logger_add_sink() only after close.
+void logger_remove_sink(logger_t* lg, logger_sink_t* sink)
+{
+    const logger_sink_ops_t* ops;
+    void* ctx;
+
+    if(!sink || sink->option) return;
+
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    if(!sink->active)
+    {
+        logger_config_write_end_(&lg->config, seq);
+        return;
+    }
+    ops = sink->ops;
+    ctx = sink->ctx;
+    sink->closing = 1;
+    LOGGER_ATOMIC_STORE(sink->active, 0);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
+
+    logger_lock_of(lg);
+    if(ops->close) ops->close(ctx);
+    logger_unlock_of(lg);
+
+    seq = logger_config_write_begin_(&lg->config);
+    sink->closing = 0;
+    logger_config_write_end_(&lg->config, seq);
+}
+
+
+// Change filter of sink.
+void logger_sink_set_filter(logger_t* lg, logger_sink_t* sink, unsigned level, unsigned debug_mask, unsigned trace_mask)
+{
+    if(!sink) return;
+
+    unsigned seq = logger_config_write_begin_(&lg->config);
+    LOGGER_ATOMIC_STORE(sink->level, level);
+    LOGGER_ATOMIC_STORE(sink->debug_mask, debug_mask);
+    LOGGER_ATOMIC_STORE(sink->trace_mask, trace_mask);
+    logger_publish_(lg);
+    logger_config_write_end_(&lg->config, seq);
+}
+
+
+// Get built in sink.
+logger_sink_t* logger_get_sink(logger_t* lg, unsigned option)
+{
+    unsigned i;
+
+    for(i = 0; i < LOGGER_MAX_SINKS; i++)
+    {
+        if(lg->sinks[i].option == option) return &lg->sinks[i];
+    }
+    return 0;
+}
+
+
+#if LOGGER_ASYNC
+static void logger_async_wait_(logger_t* lg, int locked);
+#endif // LOGGER_ASYNC
+
+
+// Returns nonzero if sink s is enabled and accepts line of given level and debug (trace = 0)
+// or trace (trace = 1) feature.
+static int logger_sink_wants_(struct logger_sink_s* s, unsigned options, int level, unsigned feature, int trace)
+{
+    if(!LOGGER_ATOMIC_LOAD(s->active)) return 0;
+    LOGGER_FENCE_ACQUIRE();
+    if(s->option && !(options & s->option)) return 0;
+    if((unsigned) level > LOGGER_ATOMIC_LOAD(s->level)) return 0;
+    if(feature && !((trace ? LOGGER_ATOMIC_LOAD(s->trace_mask) : LOGGER_ATOMIC_LOAD(s->debug_mask)) & feature)) return 0;
+    return 1;
+}
+
+
+void logger_flush(void)
+{
+    logger_flush_of(&logger_default_);
+}
+
+
+void logger_flush_of(logger_t* lg)
+{
+    unsigned options = LOGGER_ATOMIC_LOAD(lg->config.options);
+    unsigned i;
+
+#if LOGGER_ASYNC
+    logger_async_wait_(lg, 0);
+#endif // LOGGER_ASYNC
+
+    logger_lock_of(lg);
+    for(i = 0; i < LOGGER_MAX_SINKS; i++)
+    {
+        struct logger_sink_s* s = &lg->sinks[i];
+        if(!logger_sink_wants_(s, options, LOGGER_LEVEL_FATAL, 0, 0)) continue;
+        if(s->ops->flush) s->ops->flush(s->ctx);
+    }
+    logger_unlock_of(lg);
+}
+
+
+
+// Write n records to sinks. wanted[i] has bit set for every sink that wanted record i
+// when it was logged, sink filters are checked again because they could be changed since.
+// Every sink gets all of it's records in one write_batch() call.
+static void logger_write_records_(logger_t* lg, const logger_record_t* records, const unsigned* wanted, unsigned n)
+{
+    unsigned options = LOGGER_ATOMIC_LOAD(lg->config.options);
+    logger_record_t batch[64];
+    unsigned i, j;
+
+    logger_lock_of(lg);
+    for(i = 0; i < LOGGER_MAX_SINKS; i++)
+    {
+        struct logger_sink_s* s = &lg->sinks[i];
+        unsigned count = 0;
+
+        for(j = 0; j < n; j++)
+        {
+            if(!(wanted[j] & (1u << i)) || !logger_sink_wants_(s, options, records[j].level, records[j].feature, records[j].trace)) continue;
+            batch[count++] = records[j];
+            if(count == sizeof(batch) / sizeof(batch[0]))
+            {
+                s->ops->write_batch(s->ctx, batch, count);
+                count = 0;
+            }
+        }
+        if(count) s->ops->write_batch(s->ctx, batch, count);
+    }
+    logger_unlock_of(lg);
+
+#if LOGGER_ASYNC
+    // synced lines are on disk before log call returns, but instance is not locked while
+    // waiting for disk
+    if(lg->sync) logger_sync_wait_(lg, records, n);
+#endif // LOGGER_ASYNC
+}
+
+
+void logger_write_records_of(logger_t* lg, const logger_record_t* records, unsigned n)
+{
+    unsigned wanted[64], i;
+
+    for(i = 0; i < 64; i++) wanted[i] = ~0u;
+    while(n)
+    {
+        unsigned count = n < 64 ? n : 64;
+        logger_write_records_(lg, records, wanted, count);
+        records += count;
+        n -= count;
+    }
+}
+
+
+unsigned logger_count_lines(const char* p, unsigned len)
+{
+    unsigned n = 0;
+    const char* end = p + len;
+
+    while(p < end && (p = (const char*) memchr(p, '\n', end - p)) != 0) n++, p++;
+    return n;
+}
+
+
+void logger_line_buffer_append(logger_line_buffer_t* b, const char* line, unsigned len,
+    unsigned long long* dropped_lines, unsigned long long* dropped_bytes)
+{
+    if(len > b->size || (b->len + len > b->size && b->policy == LOGGER_OVERFLOW_DROP_NEWEST))
+    {
+        (*dropped_lines)++;
+        *dropped_bytes += len;
+        return;
+    }
+
+    if(b->len + len > b->size)
+    {
+        // drop whole lines from the beginning, all in one move
+        unsigned need = b->len + len - b->size;
+        const char* p = (const char*) memchr(b->buf + need - 1, '\n', b->len - need + 1);
+        unsigned cut = p ? (unsigned)(p - b->buf) + 1 : b->len;
+
+        *dropped_lines += logger_count_lines(b->buf, cut);
+        *dropped_bytes += cut;
+        memmove(b->buf, b->buf + cut, b->len - cut);
+        b->len -= cut;
+    }
+
+    memcpy(b->buf + b->len, line, len);
+    b->len += len;
+}
+
+
+
+// ###################################  ASYNC  ###################################
+
+#if LOGGER_ASYNC
+
+// Line in async buffer is this header followed by line text, padded to multiple of 8.
+typedef struct logger_qrec_s
+{
+    unsigned size;                  // size of header, text and padding
+    unsigned wanted;                // sinks that wanted the line when it was logged
+    logger_record_t r;              // record, r.line is not used
+} logger_qrec_t;
+
+#define LOGGER_QREC_SIZE_(len) ((sizeof(logger_qrec_t) + (len) + 7) & ~7u)
+
+// Line taken from CPU buffer, lines are sorted by time and then by order they were taken in.
+typedef struct
+{
+    unsigned long long time;
+    unsigned seq;
+    const logger_qrec_t* q;
+} logger_percpu_line_t;
+
+struct logger_percpu_s;
+static unsigned long long logger_percpu_sum_(struct logger_async_s* a, int discarded);
+static int logger_async_start_(logger_t* lg, unsigned buffer_size, int policy, unsigned timeout_ms, int mode);
+static unsigned logger_drain_locked_(logger_t* lg, unsigned budget);
+
+// modes of asynchronous logging
+enum
+{
+    LOGGER_ASYNC_THREAD_,           // writer thread
+    LOGGER_ASYNC_PERCPU_,           // per-CPU buffers and writer thread
+    LOGGER_ASYNC_POLLED_,           // no thread, logger_drain() is called by event loop
+};
+
+struct logger_async_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;            // writer thread waits for lines
+    pthread_cond_t space;           // logging threads wait for room or for their lines to be written
+    pthread_t thread;
+    unsigned active;
+    int stop;
+
+    // lines waiting for writer thread
+    char* buf;
+    unsigned head;                  // lines before head were taken by logger_drain() (polled only)
+    unsigned len;
+    unsigned size;
+    char* out;                      // used by writer thread
+    int policy;
+    unsigned timeout_ms;
+
+    unsigned long long pushed;      // number of lines put in buffer
+    unsigned long long completed;   // number of lines from buffer written or dropped
+
+    unsigned long long dropped[LOGGER_LEVEL_TRACE + 1];
+    unsigned long long reported[LOGGER_LEVEL_TRACE + 1];   // dropped when marker was written
+
+    // per-CPU buffers (see logger_async_start_percpu_of()), buf and out are not used
+    struct logger_percpu_s* cpus;
+    unsigned ncpus;
+    logger_percpu_line_t* lines;    // lines taken from all buffers, sorted by writer thread
+    unsigned lines_size;
+
+    // logger_async_start_polled_of(), notify[0] is readable while buffer is not empty
+    int polled;
+    int notify[2];
+    int draining;                   // some thread is writing lines taken from buffer
+
+    int kick;                       // per-CPU writer thread was woken up before it waited
+};
+
+// Buffer of one CPU. Only threads running on that CPU and writer thread use it so
+// lock is almost never contended and it's cache line stays with it's CPU.
+struct LOGGER_CACHE_ALIGNED logger_percpu_s
+{
+    unsigned lock;
+    unsigned len;
+    char* buf;
+    char* out;                      // used by writer thread
+    unsigned long long pushed;      // number of lines put in buffer
+    unsigned long long discarded;   // number of lines dropped from buffer (LOGGER_OVERFLOW_DROP_OLDEST)
+    unsigned long long dropped[LOGGER_LEVEL_TRACE + 1];
+};
+
+
+static void logger_async_deadline_(struct timespec* ts, unsigned ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if(ts->tv_nsec >= 1000000000L) ts->tv_sec++, ts->tv_nsec -= 1000000000L;
+}
+
+
+// Drop oldest lines until there is need bytes of room, must be called with async mutex held.
+static void logger_async_drop_oldest_(struct logger_async_s* a, unsigned need)
+{
+    unsigned cut = a->head;
+
+    while(cut < a->len && a->len - cut + need > a->size)
+    {
+        logger_qrec_t* q = (logger_qrec_t*)(a->buf + cut);
+        a->dropped[q->r.level]++;
+        a->completed++;
+        cut += q->size;
+    }
+    memmove(a->buf, a->buf + cut, a->len - cut);
+    a->len -= cut;
+    a->head = 0;
+}
+
+
+// Make notification descriptor of polled async logging readable (set = 1) or not readable,
+// must be called with async mutex held.
+static void logger_async_notify_(struct logger_async_s* a, int set)
+{
+    char buf[64];
+    ssize_t n;
+
+    if(set)
+    {
+#ifdef __linux__
+        unsigned long long one = 1;
+        n = write(a->notify[1], &one, sizeof(one));
+#else
+        n = write(a->notify[1], "", 1);
+#endif // __linux__
+    }
+    // eventfd is reset by one read, pipe is read until it is empty
+    else while((n = read(a->notify[0], buf, sizeof(buf))) == sizeof(buf));
+    (void) n;
+}
+
+
+// Put record in async buffer. Returns 0 if asynchronous logging is not active, so
+// record must be written by caller.
+static int logger_async_push_(logger_t* lg, const logger_record_t* r, unsigned wanted)
+{
+    struct logger_async_s* a = lg->async;
+    unsigned need = LOGGER_QREC_SIZE_(r->len), limit;
+    struct timespec deadline;
+    int have_deadline = 0;
+
+    pthread_mutex_lock(&a->mutex);
+    if(!a->active)
+    {
+        pthread_mutex_unlock(&a->mutex);
+        return 0;
+    }
+
+    limit = a->size;
+    if(a->policy == LOGGER_OVERFLOW_DROP_BY_LEVEL)
+    {
+        if(r->level >= LOGGER_LEVEL_DEBUG) limit = a->size / 2;
+        else if(r->level >= LOGGER_LEVEL_WARN) limit = a->size - a->size / 8;
+    }
+
+    while(a->len - a->head + need > limit)
+    {
+        int wait = 0;
+
+        if(need > limit) ;
+        else if(a->policy == LOGGER_OVERFLOW_DROP_OLDEST)
+        {
+            logger_async_drop_oldest_(a, need);
+            continue;
+        }
+        else if(a->policy == LOGGER_OVERFLOW_BLOCK) wait = 1;
+        else if(a->policy == LOGGER_OVERFLOW_DROP_BY_LEVEL) wait = r->level <= LOGGER_LEVEL_ERROR;
+
+        if(!wait)
+        {
+            a->dropped[r->level]++;
+            pthread_mutex_unlock(&a->mutex);
+            return 1;
+        }
+
+        // there is no writer thread to wait for
+        if(a->polled)
+        {
+            logger_drain_locked_(lg, ~0u);
+            continue;
+        }
+
+        if(a->policy == LOGGER_OVERFLOW_BLOCK)
+        {
+            if(!have_deadline) logger_async_deadline_(&deadline, a->timeout_ms), have_deadline = 1;
+            if(pthread_cond_timedwait(&a->space, &a->mutex, &deadline) == ETIMEDOUT && a->len - a->head + need > limit)
+            {
+                a->dropped[r->level]++;
+                pthread_mutex_unlock(&a->mutex);
+                return 1;
+            }
+        }
+        else pthread_cond_wait(&a->space, &a->mutex);
+
+        if(!a->active)
+        {
+            pthread_mutex_unlock(&a->mutex);
+            return 0;
+        }
+    }
+
+    // lines left by logger_drain() are moved to the start only when end of buffer is reached
+    if(a->len + need > a->size)
+    {
+        memmove(a->buf, a->buf + a->head, a->len - a->head);
+        a->len -= a->head;
+        a->head = 0;
+    }
+
+    logger_qrec_t* q = (logger_qrec_t*)(a->buf + a->len);
+    q->size = need;
+    q->wanted = wanted;
+    q->r = *r;
+    memcpy(q + 1, r->line, r->len);
+    // writer thread waits only when buffer is empty
+    if(!a->len && a->polled) logger_async_notify_(a, 1);
+    else if(!a->len) pthread_cond_signal(&a->cond);
+    a->len += need;
+    a->pushed++;
+
+    // process can end right after fatal line, so it must be written before we return
+    if(r->level == LOGGER_LEVEL_FATAL) logger_async_wait_(lg, 1);
+    pthread_mutex_unlock(&a->mutex);
+    return 1;
+}
+
+
+// Sum of pushed (discarded = 0) or discarded (discarded = 1) counters of all CPUs.
+static unsigned long long logger_percpu_sum_(struct logger_async_s* a, int discarded)
+{
+    unsigned long long sum = 0;
+    unsigned i;
+
+    for(i = 0; i < a->ncpus; i++)
+    {
+        if(discarded) sum += __atomic_load_n(&a->cpus[i].discarded, __ATOMIC_RELAXED);
+        else sum += __atomic_load_n(&a->cpus[i].pushed, __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+
+// CPU the calling thread runs on. It is only a hint, thread can be moved to other CPU
+// right after, so buffer is still locked.
+static unsigned logger_cpu_(void)
+{
+#if defined(LOGGER_RSEQ)
+    if(__rseq_size)
+    {
+        const struct rseq* rs = (const struct rseq*)((char*) __builtin_thread_pointer() + __rseq_offset);
+        int cpu = (int) LOGGER_ATOMIC_LOAD(rs->cpu_id);
+        if(cpu >= 0) return cpu;
+    }
+#endif // LOGGER_RSEQ
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    if(cpu >= 0) return cpu;
+#endif // __linux__
+    return (unsigned) GETPID();
+}
+
+
+// Wake up per-CPU writer thread. Flag is kept if it's not waiting, so it doesn't sleep
+// for next LOGGER_PERCPU_INTERVAL_MS milliseconds.
+static void logger_percpu_kick_(struct logger_async_s* a, int locked)
+{
+    if(!locked) pthread_mutex_lock(&a->mutex);
+    a->kick = 1;
+    pthread_cond_signal(&a->cond);
+    if(!locked) pthread_mutex_unlock(&a->mutex);
+}
+
+
+// Put record in buffer of current CPU. Returns 0 if asynchronous logging is not active.
+static int logger_percpu_push_(logger_t* lg, const logger_record_t* r, unsigned wanted)
+{
+    struct logger_async_s* a = lg->async;
+    struct logger_percpu_s* c = &a->cpus[logger_cpu_() % a->ncpus];
+    unsigned need = LOGGER_QREC_SIZE_(r->len), limit = a->size;
+    unsigned waited = 0;
+    int kick;
+    struct timespec ts;
+
+    if(a->policy == LOGGER_OVERFLOW_DROP_BY_LEVEL)
+    {
+        if(r->level >= LOGGER_LEVEL_DEBUG) limit = a->size / 2;
+        else if(r->level >= LOGGER_LEVEL_WARN) limit = a->size - a->size / 8;
+    }
+
+    logger_spin_lock_(&c->lock);
+    for(;;)
+    {
+        int wait = 0;
+
+        // checked under lock, so writer thread which stops sees every line put in buffer
+        if(!LOGGER_ATOMIC_LOAD(a->active))
+        {
+            logger_spin_unlock_(&c->lock);
+            return 0;
+        }
+        if(c->len + need <= limit) break;
+
+        if(need > limit) ;
+        else if(a->policy == LOGGER_OVERFLOW_DROP_OLDEST)
+        {
+            unsigned cut = 0;
+            while(cut < c->len && c->len - cut + need > a->size)
+            {
+                logger_qrec_t* q = (logger_qrec_t*)(c->buf + cut);
+                c->dropped[q->r.level]++;
+                c->discarded++;
+                cut += q->size;
+            }
+            memmove(c->buf, c->buf + cut, c->len - cut);
+            c->len -= cut;
+            continue;
+        }
+        else if(a->policy == LOGGER_OVERFLOW_BLOCK) wait = waited < a->timeout_ms * 1000;
+        else if(a->policy == LOGGER_OVERFLOW_DROP_BY_LEVEL) wait = r->level <= LOGGER_LEVEL_ERROR;
+
+        if(!wait)
+        {
+            c->dropped[r->level]++;
+            logger_spin_unlock_(&c->lock);
+            return 1;
+        }
+
+        // writer thread polls buffers, so there is nobody to wake us
+        logger_spin_unlock_(&c->lock);
+        if(!waited) logger_percpu_kick_(a, 0);
+        ts.tv_sec = 0;
+        ts.tv_nsec = 50000;
+        nanosleep(&ts, 0);
+        waited += 50;
+        logger_spin_lock_(&c->lock);
+    }
+
+    logger_qrec_t* q = (logger_qrec_t*)(c->buf + c->len);
+    q->size = need;
+    q->wanted = wanted;
+    q->r = *r;
+    memcpy(q + 1, r->line, r->len);
+    // writer thread is woken up once when buffer becomes half full
+    kick = c->len < a->size / 2 && c->len + need >= a->size / 2;
+    c->len += need;
+    __atomic_store_n(&c->pushed, c->pushed + 1, __ATOMIC_RELAXED);
+    logger_spin_unlock_(&c->lock);
+
+    if(r->level == LOGGER_LEVEL_FATAL) logger_async_wait_(lg, 0);
+    else if(kick) logger_percpu_kick_(a, 0);
+    return 1;
+}
+
+
+static int logger_percpu_cmp_(const void* x, const void* y)
+{
+    const logger_percpu_line_t* a = (const logger_percpu_line_t*) x;
+    const logger_percpu_line_t* b = (const logger_percpu_line_t*) y;
+
+    if(a->time != b->time) return a->time < b->time ? -1 : 1;
+    return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+
+// Take lines from all CPU buffers and write them to sinks ordered by time.
+// Returns number of lines written.
+static unsigned logger_percpu_write_(logger_t* lg, unsigned* len)
+{
+    struct logger_async_s* a = lg->async;
+    logger_record_t records[64];
+    unsigned wanted[64];
+    unsigned i, pos, n = 0, count = 0, total;
+
+    for(i = 0; i < a->ncpus; i++)
+    {
+        struct logger_percpu_s* c = &a->cpus[i];
+        logger_spin_lock_(&c->lock);
+        char* tmp = c->out;
+        c->out = c->buf;
+        c->buf = tmp;
+        len[i] = c->len;
+        c->len = 0;
+        logger_spin_unlock_(&c->lock);
+        for(pos = 0; pos < len[i]; pos += ((const logger_qrec_t*)(c->out + pos))->size) count++;
+    }
+    if(!count) return 0;
+
+    // time is taken when line prefix is rendered, before CPU lock, so thread that was
+    // preempted or migrated in between puts older line after newer one and no buffer is
+    // strictly ordered. Lines of all buffers are sorted; if there is no memory for that
+    // they are written one buffer after another. Only line which was pushed after writer
+    // took buffers (because thread waited for room) can still come after newer lines.
+    if(count > a->lines_size)
+    {
+        logger_percpu_line_t* p = (logger_percpu_line_t*) realloc(a->lines, count * sizeof(logger_percpu_line_t));
+        if(p) a->lines = p, a->lines_size = count;
+    }
+    total = 0;
+    for(i = 0; i < a->ncpus; i++)
+    {
+        for(pos = 0; pos < len[i]; )
+        {
+            const logger_qrec_t* q = (const logger_qrec_t*)(a->cpus[i].out + pos);
+            if(count <= a->lines_size)
+            {
+                a->lines[total].time = q->r.time;
+                a->lines[total].seq = total;
+                a->lines[total].q = q;
+            }
+            total++;
+            pos += q->size;
+        }
+    }
+    if(count <= a->lines_size) qsort(a->lines, count, sizeof(logger_percpu_line_t), logger_percpu_cmp_);
+
+    total = 0;
+    for(i = 0, pos = 0; total < count; total++)
+    {
+        const logger_qrec_t* q;
+
+        if(count <= a->lines_size) q = a->lines[total].q;
+        else
+        {
+            while(pos >= len[i]) i++, pos = 0;
+            q = (const logger_qrec_t*)(a->cpus[i].out + pos);
+            pos += q->size;
+        }
+        records[n] = q->r;
+        records[n].line = (const char*)(q + 1);
+        wanted[n] = q->wanted;
+        if(++n == sizeof(records) / sizeof(records[0]) || total + 1 == count)
+        {
+            logger_write_records_(lg, records, wanted, n);
+            n = 0;
+        }
+    }
+    return count;
+}
+
+
+// Wait until lines that are in async buffer now are written. locked is nonzero if
+// caller holds async mutex.
+static void logger_async_wait_(logger_t* lg, int locked)
+{
+    struct logger_async_s* a = lg->async;
+
+    if(!a) return;
+    if(!locked) pthread_mutex_lock(&a->mutex);
+    if(a->active && a->polled)
+    {
+        while(a->len || a->draining) logger_drain_locked_(lg, ~0u);
+    }
+    else if(a->active && a->cpus)
+    {
+        unsigned long long target = logger_percpu_sum_(a, 0);
+        logger_percpu_kick_(a, 1);
+        while(a->completed + logger_percpu_sum_(a, 1) < target) pthread_cond_wait(&a->space, &a->mutex);
+    }
+    else if(a->active)
+    {
+        unsigned long long target = a->pushed;
+        pthread_cond_signal(&a->cond);
+        while(a->completed < target) pthread_cond_wait(&a->space, &a->mutex);
+    }
+    if(!locked) pthread_mutex_unlock(&a->mutex);
+}
+
+
+// Write "dropped N lines" marker, counts are numbers of dropped lines since last marker.
+static void logger_async_marker_(logger_t* lg, const unsigned long long* counts)
+{
+    unsigned options = LOGGER_ATOMIC_LOAD(lg->config.options);
+    unsigned long long total = 0;
+    unsigned wanted = 0, i;
+    char line[256];
+
+    for(i = 0; i <= LOGGER_LEVEL_TRACE; i++) total += counts[i];
+    for(i = 0; i < LOGGER_MAX_SINKS; i++)
+    {
+        if(logger_sink_wants_(&lg->sinks[i], options, LOGGER_LEVEL_WARN, 0, 0)) wanted |= 1u << i;
+    }
+    if(!wanted) return;
+
+    unsigned long long now = make_timestamp(line, sizeof(line), options);
+    unsigned body = strlen(line) + 1;
+    snprintf(line + body - 1, sizeof(line) - body + 1,
+        " (%d) [WARN] dropped %llu lines (fatal %llu, error %llu, warn %llu, info %llu, debug %llu, trace %llu)\n",
+        (int) GETPID(), total, counts[0], counts[1], counts[2], counts[3], counts[4], counts[5]);
+
+    logger_record_t record = { 0 };
+
+    record.line = line;
+    record.len = (unsigned) strlen(line);
+    record.body = body;
+    record.level = LOGGER_LEVEL_WARN;
+    record.time = now;
+    logger_write_records_(lg, &record, &wanted, 1);
+}
+
+
+// Write len bytes of records from async buffer to sinks, returns number of records.
+static unsigned logger_async_write_(logger_t* lg, const char* data, unsigned len)
+{
+    logger_record_t records[64];
+    unsigned wanted[64];
+    unsigned pos = 0, n = 0, total = 0;
+
+    while(pos < len)
+    {
+        const logger_qrec_t* q = (const logger_qrec_t*)(data + pos);
+        records[n] = q->r;
+        records[n].line = (const char*)(q + 1);
+        wanted[n] = q->wanted;
+        pos += q->size;
+        if(++n == sizeof(records) / sizeof(records[0]) || pos >= len)
+        {
+            logger_write_records_(lg, records, wanted, n);
+            total += n;
+            n = 0;
+        }
+    }
+    return total;
+}
+
+
+// Writer thread for per-CPU buffers. It polls buffers every LOGGER_PERCPU_INTERVAL_MS
+// milliseconds, logging thread wakes it only when buffer becomes half full or when it
+// waits for lines to be written.
+static void* logger_percpu_thread_(void* arg)
+{
+    logger_t* lg = (logger_t*) arg;
+    struct logger_async_s* a = lg->async;
+    struct timespec last_marker, now, ts;
+    unsigned long long delta[LOGGER_LEVEL_TRACE + 1];
+    unsigned* len = (unsigned*) malloc(a->ncpus * sizeof(unsigned));
+    int stop;
+
+    clock_gettime(CLOCK_MONOTONIC, &last_marker);
+    do
+    {
+        unsigned i, j, n;
+        int marker = 0;
+
+        pthread_mutex_lock(&a->mutex);
+        if(!a->stop && !a->kick)
+        {
+            logger_async_deadline_(&ts, LOGGER_PERCPU_INTERVAL_MS);
+            pthread_cond_timedwait(&a->cond, &a->mutex, &ts);
+        }
+        a->kick = 0;
+        stop = a->stop;
+        pthread_mutex_unlock(&a->mutex);
+
+        n = logger_percpu_write_(lg, len);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        pthread_mutex_lock(&a->mutex);
+        if(stop || (now.tv_sec - last_marker.tv_sec) * 1000 + (now.tv_nsec - last_marker.tv_nsec) / 1000000 >= LOGGER_DROP_MARKER_MS)
+        {
+            for(i = 0; i <= LOGGER_LEVEL_TRACE; i++)
+            {
+                unsigned long long dropped = 0;
+                for(j = 0; j < a->ncpus; j++) dropped += __atomic_load_n(&a->cpus[j].dropped[i], __ATOMIC_RELAXED);
+                a->dropped[i] = dropped;
+                delta[i] = dropped - a->reported[i];
+                if(delta[i]) marker = 1;
+                a->reported[i] = dropped;
+            }
+            if(marker) last_marker = now;
+        }
+        pthread_mutex_unlock(&a->mutex);
+
+        if(marker) logger_async_marker_(lg, delta);
+
+        pthread_mutex_lock(&a->mutex);
+        a->completed += n;
+        pthread_cond_broadcast(&a->space);
+        pthread_mutex_unlock(&a->mutex);
+    }
+    while(!stop);
+
+    free(len);
+    return 0;
+}
+
+
+static void* logger_async_thread_(void* arg)
+{
+    logger_t* lg = (logger_t*) arg;
+    struct logger_async_s* a = lg->async;
+    struct timespec last_marker, now;
+    unsigned long long delta[LOGGER_LEVEL_TRACE + 1];
+
+    clock_gettime(CLOCK_MONOTONIC, &last_marker);
+    pthread_mutex_lock(&a->mutex);
+    for(;;)
+    {
+        struct timespec ts;
+        int stop, marker = 0;
+        unsigned i, len;
+
+        while(!a->len && !a->stop)
+        {
+            logger_async_deadline_(&ts, LOGGER_DROP_MARKER_MS);
+            if(pthread_cond_timedwait(&a->cond, &a->mutex, &ts) == ETIMEDOUT) break;
+        }
+        stop = a->stop;
+
+        // logging threads fill other buffer while this one is written
+        char* tmp = a->out;
+        a->out = a->buf;
+        a->buf = tmp;
+        len = a->len;
+        a->len = 0;
+        pthread_cond_broadcast(&a->space);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(stop || (now.tv_sec - last_marker.tv_sec) * 1000 + (now.tv_nsec - last_marker.tv_nsec) / 1000000 >= LOGGER_DROP_MARKER_MS)
+        {
+            for(i = 0; i <= LOGGER_LEVEL_TRACE; i++)
+            {
+                delta[i] = a->dropped[i] - a->reported[i];
+                if(delta[i]) marker = 1;
+                a->reported[i] = a->dropped[i];
+            }
+            if(marker) last_marker = now;
+        }
+        pthread_mutex_unlock(&a->mutex);
+
+        unsigned n = logger_async_write_(lg, a->out, len);
+        if(marker) logger_async_marker_(lg, delta);
+
+        pthread_mutex_lock(&a->mutex);
+        a->completed += n;
+        pthread_cond_broadcast(&a->space);
+        if(stop && !a->len) break;
+    }
+    pthread_mutex_unlock(&a->mutex);
+    return 0;
+}
+
+
+int logger_async_start(unsigned buffer_size, int policy, unsigned timeout_ms)
+{
+    return logger_async_start_of(&logger_default_, buffer_size, policy, timeout_ms);
+}
+
+
+int logger_async_start_of(logger_t* lg, unsigned buffer_size, int policy, unsigned timeout_ms)
+{
+    return logger_async_start_(lg, buffer_size, policy, timeout_ms, LOGGER_ASYNC_THREAD_);
+}
+
+
+int logger_async_start_percpu(unsigned buffer_size, int policy, unsigned timeout_ms)
+{
+    return logger_async_start_percpu_of(&logger_default_, buffer_size, policy, timeout_ms);
+}
+
+
+int logger_async_start_percpu_of(logger_t* lg, unsigned buffer_size, int policy, unsigned timeout_ms)
+{
+    return logger_async_start_(lg, buffer_size, policy, timeout_ms, LOGGER_ASYNC_PERCPU_);
+}
+
+
+int logger_async_start_polled(unsigned buffer_size, int policy)
+{
+    return logger_async_start_polled_of(&logger_default_, buffer_size, policy);
+}
+
+
+int logger_async_start_polled_of(logger_t* lg, unsigned buffer_size, int policy)
+{
+    return logger_async_start_(lg, buffer_size, policy, 0, LOGGER_ASYNC_POLLED_);
+}
+
+
+// Write at most budget lines from buffer of polled async logging to sinks. Must be called
+// with async mutex held, which is released while lines are written. Returns number of
+// lines written.
+static unsigned logger_drain_locked_(logger_t* lg, unsigned budget)
+{
+    struct logger_async_s* a = lg->async;
+    unsigned long long delta[LOGGER_LEVEL_TRACE + 1];
+    unsigned pos, n = 0, i;
+    int marker = 0;
+
+    // lines are taken from the start of buffer, so drains must not overlap
+    while(a->draining) pthread_cond_wait(&a->space, &a->mutex);
+    if(!a->len || !budget) return 0;
+
+    // slice is copied out and head moves past it, lines after it stay where they are
+    for(pos = a->head; pos < a->len && n < budget; n++) pos += ((const logger_qrec_t*)(a->buf + pos))->size;
+    unsigned bytes = pos - a->head;
+    memcpy(a->out, a->buf + a->head, bytes);
+    a->head = pos;
+    if(a->head == a->len) a->head = a->len = 0;
+    if(!a->len)
+    {
+        logger_async_notify_(a, 0);
+        // dropped lines are reported when buffer is empty
+        for(i = 0; i <= LOGGER_LEVEL_TRACE; i++)
+        {
+            delta[i] = a->dropped[i] - a->reported[i];
+            if(delta[i]) marker = 1;
+            a->reported[i] = a->dropped[i];
+        }
+    }
+    a->draining = 1;
+    pthread_mutex_unlock(&a->mutex);
+
+    n = logger_async_write_(lg, a->out, bytes);
+    if(marker) logger_async_marker_(lg, delta);
+
+    pthread_mutex_lock(&a->mutex);
+    a->completed += n;
+    a->draining = 0;
+    pthread_cond_broadcast(&a->space);
+    return n;
+}
+
+
+unsigned logger_drain(unsigned budget)
+{
+    return logger_drain_of(&logger_default_, budget);
+}
+
+
+unsigned logger_drain_of(logger_t* lg, unsigned budget)
+{
+    struct logger_async_s* a = lg->async;
+    unsigned n = 0;
+
+    if(!a) return 0;
+    pthread_mutex_lock(&a->mutex);
+    if(a->active && a->polled) n = logger_drain_locked_(lg, budget);
+    pthread_mutex_unlock(&a->mutex);
+    return n;
+}
+
+
+// Free per-CPU buffers, must be called with async mutex held while async is not active.
+static void logger_percpu_free_(struct logger_async_s* a)
+{
+    unsigned i;
+
+    if(!a->cpus) return;
+    for(i = 0; i < a->ncpus; i++)
+    {
+        free(a->cpus[i].buf);
+        free(a->cpus[i].out);
+    }
+    free(a->cpus);
+    a->cpus = 0;
+    a->ncpus = 0;
+    free(a->lines);
+    a->lines = 0;
+    a->lines_size = 0;
+}
+
+
+// Allocate per-CPU buffers, returns 0 on success.
+static int logger_percpu_alloc_(struct logger_async_s* a, unsigned buffer_size)
+{
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    unsigned i;
+
+    if(n < 1) n = 1;
+    if(posix_memalign((void**) &a->cpus, LOGGER_CACHE_LINE, n * sizeof(struct logger_percpu_s))) return -1;
+    memset(a->cpus, 0, n * sizeof(struct logger_percpu_s));
+    a->ncpus = n;
+    for(i = 0; i < a->ncpus; i++)
+    {
+        a->cpus[i].buf = (char*) malloc(buffer_size);
+        a->cpus[i].out = (char*) malloc(buffer_size);
+        if(!a->cpus[i].buf || !a->cpus[i].out) return -1;
+    }
+    return 0;
+}
+
+
+// Common part of logger_async_start_of(), logger_async_start_percpu_of() and
+// logger_async_start_polled_of(). Returns 0 or notification descriptor for polled mode on
+// success, -1 on error.
+static int logger_async_start_(logger_t* lg, unsigned buffer_size, int policy, unsigned timeout_ms, int mode)
+{
+    struct logger_async_s* a = lg->async;
+
+    if(!buffer_size) return -1;
+    if(!a)
+    {
+        pthread_condattr_t attr;
+
+        a = (struct logger_async_s*) calloc(1, sizeof(struct logger_async_s));
+        if(!a) return -1;
+        pthread_mutex_init(&a->mutex, 0);
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&a->cond, &attr);
+        pthread_cond_init(&a->space, &attr);
+        pthread_condattr_destroy(&attr);
+        lg->async = a;
+    }
+
+    pthread_mutex_lock(&a->mutex);
+    if(a->active)
+    {
+        pthread_mutex_unlock(&a->mutex);
+        return -1;
+    }
+    free(a->buf);
+    free(a->out);
+    logger_percpu_free_(a);
+    a->buf = a->out = 0;
+    if(mode == LOGGER_ASYNC_PERCPU_)
+    {
+        if(logger_percpu_alloc_(a, buffer_size))
+        {
+            logger_percpu_free_(a);
+            pthread_mutex_unlock(&a->mutex);
+            return -1;
+        }
+    }
+    else
+    {
+        a->buf = (char*) malloc(buffer_size);
+        a->out = (char*) malloc(buffer_size);
+        if(!a->buf || !a->out)
+        {
+            pthread_mutex_unlock(&a->mutex);
+            return -1;
+        }
+    }
+    a->size = buffer_size;
+    a->head = a->len = 0;
+    a->policy = policy;
+    a->timeout_ms = timeout_ms;
+    a->stop = 0;
+    a->pushed = a->completed = 0;
+    memset(a->dropped, 0, sizeof(a->dropped));
+    memset(a->reported, 0, sizeof(a->reported));
+    a->polled = mode == LOGGER_ASYNC_POLLED_;
+    a->draining = 0;
+    if(a->polled)
+    {
+#ifdef __linux__
+        a->notify[0] = a->notify[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(a->notify[0] < 0)
+#else
+        if(pipe(a->notify) || fcntl(a->notify[0], F_SETFL, O_NONBLOCK) || fcntl(a->notify[1], F_SETFL, O_NONBLOCK))
+#endif // __linux__
+        {
+            pthread_mutex_unlock(&a->mutex);
+            return -1;
+        }
+    }
+    else if(pthread_create(&a->thread, 0, mode == LOGGER_ASYNC_PERCPU_ ? logger_percpu_thread_ : logger_async_thread_, lg))
+    {
+        pthread_mutex_unlock(&a->mutex);
+        return -1;
+    }
+    LOGGER_ATOMIC_STORE(a->active, 1);
+    pthread_mutex_unlock(&a->mutex);
+    return a->polled ? a->notify[0] : 0;
+}
+
+
+void logger_async_stop(void)
+{
+    logger_async_stop_of(&logger_default_);
+}
+
+
+void logger_async_stop_of(logger_t* lg)
+{
+    struct logger_async_s* a = lg->async;
+
+    if(!a) return;
+    pthread_mutex_lock(&a->mutex);
+    if(!a->active)
+    {
+        pthread_mutex_unlock(&a->mutex);
+        return;
+    }
+    if(a->polled)
+    {
+        while(a->len || a->draining) logger_drain_locked_(lg, ~0u);
+        LOGGER_ATOMIC_STORE(a->active, 0);
+        close(a->notify[0]);
+        if(a->notify[1] != a->notify[0]) close(a->notify[1]);
+        pthread_mutex_unlock(&a->mutex);
+        return;
+    }
+    // logging threads that are waiting for room write their lines themselves
+    LOGGER_ATOMIC_STORE(a->active, 0);
+    a->stop = 1;
+    pthread_cond_signal(&a->cond);
+    pthread_cond_broadcast(&a->space);
+    pthread_mutex_unlock(&a->mutex);
+    pthread_join(a->thread, 0);
+}
+
+
+// Stop asynchronous logging and free it's resources.
+static void logger_async_free_(logger_t* lg)
+{
+    struct logger_async_s* a = lg->async;
+
+    if(!a) return;
+    logger_async_stop_of(lg);
+    lg->async = 0;
+    pthread_cond_destroy(&a->cond);
+    pthread_cond_destroy(&a->space);
+    pthread_mutex_destroy(&a->mutex);
+    free(a->buf);
+    free(a->out);
+    logger_percpu_free_(a);
+    free(a);
+}
+
+
+void logger_get_dropped(unsigned long long counts[LOGGER_LEVEL_TRACE + 1])
+{
+    logger_get_dropped_of(&logger_default_, counts);
+}
+
+
+void logger_get_dropped_of(logger_t* lg, unsigned long long counts[LOGGER_LEVEL_TRACE + 1])
+{
+    struct logger_async_s* a = lg->async;
+
+    if(!a)
+    {
+        memset(counts, 0, sizeof(unsigned long long) * (LOGGER_LEVEL_TRACE + 1));
+        return;
+    }
+    pthread_mutex_lock(&a->mutex);
+    memcpy(counts, a->dropped, sizeof(a->dropped));
+    if(a->cpus)
+    {
+        unsigned i, j;
+        for(i = 0; i <= LOGGER_LEVEL_TRACE; i++)
+        {
+            counts[i] = 0;
+            for(j = 0; j < a->ncpus; j++) counts[i] += __atomic_load_n(&a->cpus[j].dropped[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&a->mutex);
+}
+
+#endif // LOGGER_ASYNC
+
+
+// ###################################  DURABILITY  ###################################
+
+#if LOGGER_ASYNC
+
+// File sink counts lines of synced levels it has written (written), syncs are done by
+// whoever needs them first: FATAL logging thread or group commit thread. Only one
+// fdatasync() runs at a time and it covers everything written before it started, others
+// wait for it and start next one only if they still need it.
+struct logger_sync_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;            // group commit thread waits for lines
+    pthread_cond_t done;            // waiting for running sync
+    pthread_t thread;
+    int running;
+    int stop;
+    int fd;                         // own descriptor of log file, stdio is not used for sync
+    int next_fd;                    // descriptor of log file opened again, -1 if file is the same
+    unsigned long long dev;         // device and inode of file of next_fd or fd
+    unsigned long long ino;
+    int sync_level;
+    int commit_level;
+    unsigned commit_ms;
+    unsigned long long written;     // lines which need sync and were passed to kernel
+    unsigned long long synced;      // written value covered by last finished sync
+    int syncing;
+    unsigned long long syncs;
+};
+
+
+// Sync until synced reaches target, must be called with s->mutex held.
+static void logger_sync_until_(struct logger_sync_s* s, unsigned long long target)
+{
+    while(s->synced < target)
+    {
+        if(s->syncing)
+        {
+            pthread_cond_wait(&s->done, &s->mutex);
+            continue;
+        }
+        unsigned long long covered = s->written;
+        int old_fd = -1;
+        s->syncing = 1;
+        // descriptor is switched only by the one who syncs, lines written to old file
+        // before it was opened again are synced to it
+        if(s->next_fd >= 0)
+        {
+            old_fd = s->fd;
+            s->fd = s->next_fd;
+            s->next_fd = -1;
+        }
+        pthread_mutex_unlock(&s->mutex);
+        if(old_fd >= 0)
+        {
+#ifdef __APPLE__
+            fsync(old_fd);
+#else
+            fdatasync(old_fd);
+#endif // __APPLE__
+            close(old_fd);
+        }
+#ifdef __APPLE__
+        fsync(s->fd);
+#else
+        fdatasync(s->fd);
+#endif // __APPLE__
+        pthread_mutex_lock(&s->mutex);
+        s->syncing = 0;
+        s->synced = covered;
+        s->syncs++;
+        pthread_cond_broadcast(&s->done);
+    }
+}
+
+
+// Called by file sink with instance lock held after it opened log file. If it is not the
+// file sync descriptor is for (file was rotated or replaced), descriptor of open file is
+// kept and next sync switches to it. Nothing is synced here, so instance lock is not held
+// while waiting for disk. If file is replaced again before next sync, lines written to file
+// in between are not synced.
+static void logger_sync_reopen_(logger_t* lg)
+{
+    struct logger_sync_s* s = lg->sync;
+    struct stat st;
+    int fd;
+
+    if(fstat(fileno(lg->fp), &st)) return;
+    pthread_mutex_lock(&s->mutex);
+    if((unsigned long long) st.st_dev != s->dev || (unsigned long long) st.st_ino != s->ino)
+    {
+        fd = dup(fileno(lg->fp));
+        if(fd >= 0)
+        {
+            if(s->next_fd >= 0) close(s->next_fd);
+            s->next_fd = fd;
+            s->dev = st.st_dev;
+            s->ino = st.st_ino;
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+}
+
+
+// Called by file sink with instance lock held after it wrote lines, level is the most
+// severe level among them. Lines of sync_level are synced by logging thread when instance
+// is unlocked (see logger_sync_wait_()), others by group commit thread.
+static void logger_sync_lines_(logger_t* lg, int level)
+{
+    struct logger_sync_s* s = lg->sync;
+
+    pthread_mutex_lock(&s->mutex);
+    if(level > s->sync_level && level > s->commit_level)
+    {
+        pthread_mutex_unlock(&s->mutex);
+        return;
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    // lines must be in kernel before sync, file is not closed when instance lock is held
+    fflush(lg->fp);
+
+    pthread_mutex_lock(&s->mutex);
+    unsigned long long target = ++s->written;
+    if(level > s->sync_level && s->synced + 1 == target) pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+
+// Called after records were written to sinks, without instance lock. If any of them is of
+// sync_level everything written so far is synced before returning.
+static void logger_sync_wait_(logger_t* lg, const logger_record_t* records, unsigned n)
+{
+    struct logger_sync_s* s = lg->sync;
+    int level = LOGGER_LEVEL_TRACE + 1;
+    unsigned i;
+
+    for(i = 0; i < n; i++) if(records[i].level < level) level = records[i].level;
+    pthread_mutex_lock(&s->mutex);
+    if(level <= s->sync_level) logger_sync_until_(s, s->written);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+
+// Group commit thread. First unsynced line starts commit_ms window, lines written in that
+// window are synced together at it's end.
+static void* logger_sync_thread_(void* arg)
+{
+    struct logger_sync_s* s = (struct logger_sync_s*) arg;
+
+    pthread_mutex_lock(&s->mutex);
+    for(;;)
+    {
+        while(!s->stop && s->synced >= s->written) pthread_cond_wait(&s->cond, &s->mutex);
+        if(s->synced >= s->written) break;
+
+        struct timespec deadline;
+        logger_async_deadline_(&deadline, s->commit_ms);
+        while(!s->stop && pthread_cond_timedwait(&s->cond, &s->mutex, &deadline) != ETIMEDOUT) ;
+        logger_sync_until_(s, s->written);
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return 0;
+}
+
+
+int logger_set_durability(int sync_level, int commit_level, unsigned commit_ms)
+{
+    return logger_set_durability_of(&logger_default_, sync_level, commit_level, commit_ms);
+}
+
+
+int logger_set_durability_of(logger_t* lg, int sync_level, int commit_level, unsigned commit_ms)
+{
+    struct logger_sync_s* s;
+    int ret = 0;
+
+    logger_lock_of(lg);
+    s = lg->sync;
+    if(!s)
+    {
+        pthread_condattr_t attr;
+
+        if(!lg->log_file || !(s = (struct logger_sync_s*) calloc(1, sizeof(struct logger_sync_s))))
+        {
+            logger_unlock_of(lg);
+            return -1;
+        }
+        struct stat st;
+        s->fd = open(lg->log_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if(s->fd < 0 || fstat(s->fd, &st))
+        {
+            if(s->fd >= 0) close(s->fd);
+            free(s);
+            logger_unlock_of(lg);
+            return -1;
+        }
+        s->next_fd = -1;
+        s->dev = st.st_dev;
+        s->ino = st.st_ino;
+        pthread_mutex_init(&s->mutex, 0);
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&s->cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_cond_init(&s->done, 0);
+        s->sync_level = s->commit_level = LOGGER_DURABILITY_NONE;
+        lg->sync = s;
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    s->sync_level = sync_level;
+    s->commit_level = commit_level;
+    s->commit_ms = commit_ms;
+    if(commit_level != LOGGER_DURABILITY_NONE && !s->running)
+    {
+        s->stop = 0;
+        if(pthread_create(&s->thread, 0, logger_sync_thread_, s)) ret = -1;
+        else s->running = 1;
+    }
+    pthread_mutex_unlock(&s->mutex);
+    logger_unlock_of(lg);
+    return ret;
+}
+
+
+unsigned long long logger_get_sync_count_of(logger_t* lg)
+{
+    unsigned long long n = 0;
+
+    if(!lg->sync) return 0;
+    pthread_mutex_lock(&lg->sync->mutex);
+    n = lg->sync->syncs;
+    pthread_mutex_unlock(&lg->sync->mutex);
+    return n;
+}
+
+
+// Sync what is left, stop group commit thread and free durability state.
+static void logger_sync_free_(logger_t* lg)
+{
+    struct logger_sync_s* s = lg->sync;
+
+    if(!s) return;
+    pthread_mutex_lock(&s->mutex);
+    s->stop = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    if(s->running) pthread_join(s->thread, 0);
+
+    lg->sync = 0;
+    close(s->fd);
+    if(s->next_fd >= 0) close(s->next_fd);
+    pthread_cond_destroy(&s->cond);
+    pthread_cond_destroy(&s->done);
+    pthread_mutex_destroy(&s->mutex);
+    free(s);
+}
+
+#endif // LOGGER_ASYNC
+
+
+// ###################################  FLUSH POLICY  ###################################
+
+#if LOGGER_ASYNC
+
+// File is fully buffered in a buffer of buffer_size bytes, so stdio writes it when it is
+// full. Line of level up to flush_level flushes it right away and the first line that stays
+// in buffer wakes flusher thread which flushes it after max_delay_ms.
+struct logger_flusher_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+    int stop;
+    int pending;                    // there are lines which may be in stdio buffer
+    unsigned buffer_size;
+    unsigned max_delay_ms;
+    int flush_level;
+    char* buffer;                   // stdio buffer of log file
+    unsigned long long flushes;     // flushes done by flusher thread
+};
+
+
+// Give stdio buffer to file just opened by file sink.
+static void logger_flusher_setvbuf_(logger_t* lg)
+{
+    struct logger_flusher_s* f = lg->flusher;
+
+    if(f->buffer) setvbuf(lg->fp, f->buffer, _IOFBF, f->buffer_size);
+}
+
+
+// Called by file sink with instance lock held after it wrote lines, level is the most
+// severe level among them. Returns 0 if policy is disabled.
+static int logger_flusher_lines_(logger_t* lg, int level)
+{
+    struct logger_flusher_s* f = lg->flusher;
+    int wake = 0;
+
+    if(!f->buffer) return 0;
+    if(level <= f->flush_level)
+    {
+        fflush(lg->fp);
+        return 1;
+    }
+
+    pthread_mutex_lock(&f->mutex);
+    if(!f->pending) f->pending = wake = 1;
+    pthread_mutex_unlock(&f->mutex);
+    if(wake) pthread_cond_signal(&f->cond);
+    return 1;
+}
+
+
+static void* logger_flusher_thread_(void* arg)
+{
+    logger_t* lg = (logger_t*) arg;
+    struct logger_flusher_s* f = lg->flusher;
+
+    pthread_mutex_lock(&f->mutex);
+    for(;;)
+    {
+        while(!f->stop && !f->pending) pthread_cond_wait(&f->cond, &f->mutex);
+        if(f->stop) break;
+
+        // lines logged in next max_delay_ms are flushed together with the first one
+        struct timespec deadline;
+        logger_async_deadline_(&deadline, f->max_delay_ms);
+        while(!f->stop && pthread_cond_timedwait(&f->cond, &f->mutex, &deadline) != ETIMEDOUT) ;
+        f->pending = 0;
+        f->flushes++;
+        pthread_mutex_unlock(&f->mutex);
+
+        logger_lock_of(lg);
+        if(lg->fp) fflush(lg->fp);
+        logger_unlock_of(lg);
+
+        pthread_mutex_lock(&f->mutex);
+    }
+    pthread_mutex_unlock(&f->mutex);
+    return 0;
+}
+
+
+int logger_set_flush_policy(unsigned buffer_size, unsigned max_delay_ms, int flush_level)
+{
+    return logger_set_flush_policy_of(&logger_default_, buffer_size, max_delay_ms, flush_level);
+}
+
+
+int logger_set_flush_policy_of(logger_t* lg, unsigned buffer_size, unsigned max_delay_ms, int flush_level)
+{
+    struct logger_flusher_s* f;
+    char* buffer = 0;
+    int ret = 0;
+
+    if(buffer_size && !(buffer = (char*) malloc(buffer_size))) return -1;
+
+    logger_lock_of(lg);
+    f = lg->flusher;
+    if(!f)
+    {
+        pthread_condattr_t attr;
+
+        if(!(f = (struct logger_flusher_s*) calloc(1, sizeof(struct logger_flusher_s))))
+        {
+            logger_unlock_of(lg);
+            free(buffer);
+            return -1;
+        }
+        pthread_mutex_init(&f->mutex, 0);
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&f->cond, &attr);
+        pthread_condattr_destroy(&attr);
+        lg->flusher = f;
+    }
+
+    // setvbuf() works only on a file which was not used yet, so file is opened again
+    if(lg->fp)
+    {
+        fclose(lg->fp);
+        lg->fp = 0;
+    }
+    free(f->buffer);
+    f->buffer = buffer;
+    f->buffer_size = buffer_size;
+
+    pthread_mutex_lock(&f->mutex);
+    f->max_delay_ms = max_delay_ms;
+    f->flush_level = flush_level;
+    if(buffer && !f->running)
+    {
+        f->stop = 0;
+        if(pthread_create(&f->thread, 0, logger_flusher_thread_, lg)) ret = -1;
+        else f->running = 1;
+    }
+    pthread_mutex_unlock(&f->mutex);
+
+    // file sink opens file on next line, unless it is kept open from the start
+    if(LOGGER_ATOMIC_LOAD(lg->config.options) & (LOGGER_OPTION_KEEP_FILE_OPEN | LOGGER_OPTION_REOPEN))
+    {
+        logger_file_open_(lg, LOGGER_ATOMIC_LOAD(lg->config.options));
+        if(lg->fp) logger_flusher_setvbuf_(lg);
+    }
+    logger_unlock_of(lg);
+    return ret;
+}
+
+
+unsigned long long logger_get_flush_count_of(logger_t* lg)
+{
+    unsigned long long n = 0;
+
+    if(!lg->flusher) return 0;
+    pthread_mutex_lock(&lg->flusher->mutex);
+    n = lg->flusher->flushes;
+    pthread_mutex_unlock(&lg->flusher->mutex);
+    return n;
+}
+
+
+// Stop flusher thread and free flush policy. File is closed first because it writes what
+// is left in the buffer.
+static void logger_flusher_free_(logger_t* lg)
+{
+    struct logger_flusher_s* f = lg->flusher;
+
+    if(!f) return;
+    pthread_mutex_lock(&f->mutex);
+    f->stop = 1;
+    pthread_cond_signal(&f->cond);
+    pthread_mutex_unlock(&f->mutex);
+    if(f->running) pthread_join(f->thread, 0);
+
+    if(lg->fp)
+    {
+        fclose(lg->fp);
+        lg->fp = 0;
+    }
+    lg->flusher = 0;
+    pthread_cond_destroy(&f->cond);
+    pthread_mutex_destroy(&f->mutex);
+    free(f->buffer);
+    free(f);
+}
+
+#endif // LOGGER_ASYNC
+
+
+
+// ###################################  TRACE SCOPES  ###################################
+
+
+unsigned long long logger_monotonic_ns(void)
+{
+#if LOGGER_TSC
+    // same clock as times of records
+    if(LOGGER_ATOMIC_LOAD(logger_clock_.state) > 0)
+    {
+        unsigned long long mono;
+        logger_clock_to_ns_(__rdtsc(), &mono);
+        return mono;
+    }
+#endif // LOGGER_TSC
+
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if(!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart / freq.QuadPart) * 1000000000ULL +
+        (unsigned long long)(now.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif // _WIN32
+}
+
+
+static int logger_prefix_(logger_t* lg, char* buff, unsigned len, int level, unsigned feature, const char* severity, const char* theclass, const char* func, const char* file, int line, logger_record_t* record, unsigned* wanted);
+static void logger_format_(logger_t* lg, logger_record_t* record, unsigned wanted, const char* format, ...);
+
+
+void logger_scope_end_(logger_scope_t* s)
+{
+    unsigned long long elapsed = logger_monotonic_ns() - s->start;
+    logger_record_t record;
+    unsigned wanted;
+    char buffer[512];
+
+    if(!s->start || elapsed < s->threshold_ns) return;
+    if(!logger_prefix_(s->lg, buffer, sizeof(buffer), s->level, s->feature,
+        s->level == LOGGER_LEVEL_WARN ? "[WARN]" : "  <<>>  ", 0, s->func, s->file, s->line, &record, &wanted)) return;
+
+    // sinks get scope name and duration without parsing the line, message is what follows name
+    record.name = s->name;
+    record.duration = elapsed;
+    record.msg += strlen(s->name) + 1;
+    if(s->threshold_ns)
+    {
+        logger_format_(s->lg, &record, wanted, "%s %s took %llu ns (over %llu ns)\n",
+            buffer, s->name, elapsed, s->threshold_ns);
+    }
+    else logger_format_(s->lg, &record, wanted, "%s %s took %llu ns\n", buffer, s->name, elapsed);
+}
+
+
+// ###################################  BACKTRACE  ###################################
+
+
+struct logger_backtrace_s
+{
+    char* buf;                      // entries, each is logger_backtrace_entry_t followed by line
+    unsigned size;
+    unsigned len;
+    unsigned threshold;             // less severe lines are buffered
+    unsigned level;                 // overrides of attached thread
+    unsigned debug_mask;
+    unsigned trace_mask;
+    unsigned long long dropped;     // lines dropped since buffer was last written or discarded
+    logger_t* dropped_of;           // instance of dropped lines, 0 if they were of more instances
+};
+
+// Line of request can be logged to more instances, each entry remembers it's instance
+// and only entries of instance that writes the buffer are written.
+typedef struct
+{
+    logger_t* lg;
+    logger_record_t r;
+} logger_backtrace_entry_t;
+
+
+// size of entry with line of n bytes, entries are 8 byte aligned
+#define LOGGER_BACKTRACE_ENTRY_(n) ((sizeof(logger_backtrace_entry_t) + (n) + 7u) & ~7u)
+
+
+logger_backtrace_t* logger_backtrace_create(unsigned size, unsigned threshold, unsigned level, unsigned debug_mask, unsigned trace_mask)
+{
+    logger_backtrace_t* bt;
+
+    if(!size) return 0;
+    bt = (logger_backtrace_t*) calloc(1, sizeof(logger_backtrace_t));
+    if(!bt) return 0;
+    bt->buf = (char*) malloc(size);
+    if(!bt->buf)
+    {
+        free(bt);
+        return 0;
+    }
+    bt->size = size;
+    bt->threshold = threshold;
+    bt->level = level;
+    bt->debug_mask = debug_mask;
+    bt->trace_mask = trace_mask;
+    return bt;
+}
+
+
+void logger_backtrace_destroy(logger_backtrace_t* bt)
+{
+    if(!bt) return;
+    if(logger_thread_.backtrace == bt) logger_backtrace_attach(0);
+    free(bt->buf);
+    free(bt);
+}
+
+
+logger_backtrace_t* logger_backtrace_attach(logger_backtrace_t* bt)
+{
+    logger_thread_t* t = &logger_thread_;
+    logger_backtrace_t* old = t->backtrace;
+
+    if(!t->registered) logger_thread_register();
+
+    // overrides are restored before they are saved again, so contexts can be switched
+    if(old)
+    {
+        LOGGER_ATOMIC_STORE(t->debug_mask, t->saved_override[1]);
+        LOGGER_ATOMIC_STORE(t->trace_mask, t->saved_override[2]);
+        LOGGER_ATOMIC_STORE(t->log_level, t->saved_override[0]);
+    }
+    t->backtrace = bt;
+    if(bt)
+    {
+        t->saved_override[0] = LOGGER_ATOMIC_LOAD(t->log_level);
+        t->saved_override[1] = LOGGER_ATOMIC_LOAD(t->debug_mask);
+        t->saved_override[2] = LOGGER_ATOMIC_LOAD(t->trace_mask);
+        LOGGER_ATOMIC_STORE(t->debug_mask, t->saved_override[1] | bt->debug_mask);
+        LOGGER_ATOMIC_STORE(t->trace_mask, t->saved_override[2] | bt->trace_mask);
+        if(bt->level > t->saved_override[0]) LOGGER_ATOMIC_STORE(t->log_level, bt->level);
+    }
+    return old;
+}
+
+
+// Count line of instance lg as dropped.
+static void logger_backtrace_drop_(logger_backtrace_t* bt, logger_t* lg)
+{
+    if(!bt->dropped) bt->dropped_of = lg;
+    else if(bt->dropped_of != lg) bt->dropped_of = 0;
+    bt->dropped++;
+}
+
+
+// Append record of instance lg to buffer. When buffer is full at least a quarter of it is
+// dropped at once, oldest lines first, so lines are not moved for every new line.
+static void logger_backtrace_add_(logger_backtrace_t* bt, logger_t* lg, const logger_record_t* r)
+{
+    unsigned need = LOGGER_BACKTRACE_ENTRY_(r->len);
+    logger_backtrace_entry_t* e;
+
+    if(need > bt->size)
+    {
+        logger_backtrace_drop_(bt, lg);
+        return;
+    }
+    if(bt->len + need > bt->size)
+    {
+        unsigned cut = 0;
+        while(cut < bt->len && (bt->len - cut + need > bt->size || cut < bt->size / 4))
+        {
+            e = (logger_backtrace_entry_t*) (bt->buf + cut);
+            cut += LOGGER_BACKTRACE_ENTRY_(e->r.len);
+            logger_backtrace_drop_(bt, e->lg);
+        }
+        memmove(bt->buf, bt->buf + cut, bt->len - cut);
+        bt->len -= cut;
+    }
+
+    e = (logger_backtrace_entry_t*) (bt->buf + bt->len);
+    e->lg = lg;
+    e->r = *r;
+    memcpy(e + 1, r->line, r->len);
+    bt->len += need;
+}
+
+
+// Write buffered lines of instance lg to it's sinks which have bit set in sinks, without
+// checking their level and feature filters, and remove them from buffer. Lines of other
+// instances stay in buffer. Dropped lines are reported to lg unless they were all of
+// other instance.
+static void logger_backtrace_write_(logger_t* lg, logger_backtrace_t* bt, unsigned sinks)
+{
+    unsigned options = LOGGER_ATOMIC_LOAD(lg->config.options);
+    logger_record_t batch[64];
+    unsigned pos = 0, count = 0, keep = 0, i;
+    int dropped = bt->dropped && (!bt->dropped_of || bt->dropped_of == lg);
+    char marker[256];
+
+    for(pos = 0; pos < bt->len && ((logger_backtrace_entry_t*) (bt->buf + pos))->lg != lg; )
+    {
+        pos += LOGGER_BACKTRACE_ENTRY_(((logger_backtrace_entry_t*) (bt->buf + pos))->r.len);
+    }
+    if(pos == bt->len && !dropped) return;
+
+#if LOGGER_ASYNC
+    // lines logged before buffered ones must be written first
+    logger_async_wait_(lg, 0);
+#endif // LOGGER_ASYNC
+
+    if(dropped)
+    {
+        unsigned long long now = make_timestamp(marker, sizeof(marker), options);
+        unsigned body = strlen(marker) + 1;
+        snprintf(marker + body - 1, sizeof(marker) - body + 1, " (%d) [WARN] backtrace dropped %llu older lines\n",
+            (int) GETPID(), bt->dropped);
+        memset(&batch[count], 0, sizeof(batch[count]));
+        batch[count].line = marker;
+        batch[count].len = (unsigned) strlen(marker);
+        batch[count].body = body;
+        batch[count].level = LOGGER_LEVEL_WARN;
+        batch[count++].time = now;
+    }
+
+    logger_lock_of(lg);
+    while(count || pos < bt->len)
+    {
+        if(pos < bt->len)
+        {
+            logger_backtrace_entry_t* e = (logger_backtrace_entry_t*) (bt->buf + pos);
+            pos += LOGGER_BACKTRACE_ENTRY_(e->r.len);
+            if(e->lg == lg)
+            {
+                batch[count] = e->r;
+                batch[count++].line = (const char*) (e + 1);
+            }
+            if(count < sizeof(batch) / sizeof(batch[0]) && pos < bt->len) continue;
+        }
+        for(i = 0; i < LOGGER_MAX_SINKS && count; i++)
+        {
+            struct logger_sink_s* s = &lg->sinks[i];
+            if(!(sinks & (1u << i)) || !logger_sink_wants_(s, options, LOGGER_LEVEL_FATAL, 0, 0)) continue;
+            s->ops->write_batch(s->ctx, batch, count);
+        }
+        count = 0;
+    }
+    logger_unlock_of(lg);
+
+    // lines of other instances are moved together after written lines are removed
+    for(pos = 0; pos < bt->len; )
+    {
+        logger_backtrace_entry_t* e = (logger_backtrace_entry_t*) (bt->buf + pos);
+        unsigned size = LOGGER_BACKTRACE_ENTRY_(e->r.len);
+        if(e->lg != lg)
+        {
+            if(keep != pos) memmove(bt->buf + keep, e, size);
+            keep += size;
+        }
+        pos += size;
+    }
+    bt->len = keep;
+    if(dropped) bt->dropped = 0;
+}
+
+
+void logger_backtrace_discard(void)
+{
+    logger_backtrace_t* bt = logger_thread_.backtrace;
+
+    if(!bt) return;
+    bt->len = 0;
+    bt->dropped = 0;
+}
+
+
+void logger_backtrace_flush_of(logger_t* lg)
+{
+    logger_backtrace_t* bt = logger_thread_.backtrace;
+    unsigned options = LOGGER_ATOMIC_LOAD(lg->config.options);
+    unsigned sinks = 0, i;
+
+    if(!bt || (!bt->len && !bt->dropped)) return;
+    for(i = 0; i < LOGGER_MAX_SINKS; i++)
+    {
+        if(logger_sink_wants_(&lg->sinks[i], options, LOGGER_LEVEL_ERROR, 0, 0)) sinks |= 1u << i;
+    }
+    logger_backtrace_write_(lg, bt, sinks);
+}
+
+
+
+// ###################################  DIAGNOSTIC CONTEXT  ###################################
+
+
+// diagnostic context of calling thread
+static LOGGER_THREAD_LOCAL logger_mdc_t logger_mdc_;
+
+
+int logger_mdc_push(const char* key, const char* format, ...)
+{
+    logger_mdc_t* m = &logger_mdc_;
+    unsigned pos = m->len ? m->len - 1 : 0;     // closing brace is overwritten
+    va_list args;
+    int n;
+
+    if(m->depth >= LOGGER_MDC_DEPTH) return -1;
+    n = snprintf(m->text + pos, sizeof(m->text) - pos, m->len ? " %s=" : " {%s=", key);
+    if(n >= 0 && pos + n < sizeof(m->text))
+    {
+        unsigned val = pos + n;
+        va_start(args, format);
+        n = vsnprintf(m->text + val, sizeof(m->text) - val, format, args);
+        va_end(args);
+        // room for closing brace is needed too
+        if(n >= 0 && val + n + 1 < sizeof(m->text))
+        {
+            m->text[val + n] = '}';
+            m->text[val + n + 1] = 0;
+            m->ends[m->depth++] = m->len;
+            m->len = val + n + 1;
+            return 0;
+        }
+    }
+
+    // restore previous context
+    if(m->len)
+    {
+        m->text[m->len - 1] = '}';
+        m->text[m->len] = 0;
+    }
+    else m->text[0] = 0;
+    return -1;
+}
+
+
+void logger_mdc_pop(void)
+{
+    logger_mdc_t* m = &logger_mdc_;
+
+    if(!m->depth) return;
+    m->len = m->ends[--m->depth];
+    if(m->len) m->text[m->len - 1] = '}';
+    m->text[m->len] = 0;
+}
+
+
+void logger_mdc_clear(void)
+{
+    logger_mdc_.len = 0;
+    logger_mdc_.depth = 0;
+    logger_mdc_.text[0] = 0;
+}
+
+
+void logger_mdc_get(logger_mdc_t* mdc)
+{
+    *mdc = logger_mdc_;
+}
+
+
+void logger_mdc_set(const logger_mdc_t* mdc)
+{
+    logger_mdc_ = *mdc;
+}
+
+
+
+// ###################################  LOGGING  ###################################
+
+
+// "%s (%d) [FATAL] " format "\n", time_stamp, getpid()
+// "%s (%d) [%s] %s @ %s:%d " format "\n", time_stamp, getpid(), #feature, __func__, __FILE__, __LINE__
+// "%s (%d) [ENTERING %s] @ %s:%d " format "\n", time_stamp, getpid(), __func__, __FILE__, __LINE__
+// "%s (%d) [ENTERING %s::%s] @ %s:%d " format "\n", time_stamp, getpid(), logger_stralpha_(typeid(*this).name()), __func__, __FILE__, __LINE__
+// Check sink filters and render prefix of line (timestamp, thread id, severity, location
+// and diagnostic context) to buff. Fills everything in record except line and len.
+// Returns 0 if line is not wanted.
+static int logger_prefix_(logger_t* lg, char* buff, unsigned len, int level, unsigned feature, const char* severity, const char* theclass, const char* func, const char* file, int line, logger_record_t* record, unsigned* wanted)
+{
+    unsigned options = LOGGER_ATOMIC_LOAD(lg->config.options);
+    unsigned i;
+
+    // register thread so it can be found by logger_thread_set_override()
+    if(!logger_thread_.registered) logger_thread_register();
+
+    // less severe lines of thread with backtrace context are kept until error or discard
+    logger_backtrace_t* bt = logger_thread_.backtrace;
+    int buffered = bt && (unsigned) level > bt->threshold;
+
+    // features of trace lines (log_condtrace_*) are trace features, other are debug features
+    int trace = level == LOGGER_LEVEL_TRACE;
+
+    // line can get here because of thread override, so check sink filters before formatting it
+    *wanted = 0;
+    for(i = 0; i < LOGGER_MAX_SINKS && !buffered; i++)
+    {
+        if(logger_sink_wants_(&lg->sinks[i], options, level, feature, trace)) *wanted |= 1u << i;
+    }
+    if(!*wanted && !buffered) return 0;
+
+    const char* class_name = logger_stralpha(theclass);
+    const char* file_name = logger_stripfile(lg, file);
+    record->time = make_timestamp(buff, len, options);
+    char *p = buff + strlen(buff);
+    record->body = p - buff + 1;
+    record->level = level;
+    record->feature = feature;
+    record->trace = trace;
+    len -= p - buff;
+    unsigned pid = GETPID();
+    record->tid = pid;
+    record->func = func;
+    record->theclass = class_name;
+    record->file = file_name;
+    record->src_line = line;
+    record->phase = 0;
+    record->name = 0;
+    record->duration = 0;
+    if(trace && func)
+    {
+        if(!strcmp(severity, "  >>>>  ")) record->phase = 'B';
+        else if(!strcmp(severity, "  <<<<  ")) record->phase = 'E';
+        else if(!strcmp(severity, "  <<>>  ")) record->phase = 'X';
+    }
+    if(!class_name) class_name = "";
+    if(!file_name) file_name = "";
+
+    // print first part
+    if(!func) snprintf(p, len, " (%d) %s", pid, severity);
+    else if(!theclass) snprintf(p, len, " (%d) %s %s @ %s:%d", pid, severity, func, file_name, line);
+    else snprintf(p, len, " (%d) %s %s::%s @ %s:%d", pid, severity, class_name, func, file_name, line);
+    p[len - 1] = 0;
+
+    // diagnostic context is already rendered
+    if(logger_mdc_.len)
+    {
+        unsigned used = strlen(p);
+        if(used + logger_mdc_.len < len) memcpy(p + used, logger_mdc_.text, logger_mdc_.len + 1);
+    }
+
+    // message follows prefix and one space
+    record->msg = strlen(buff) + 1;
+    return 1;
+}
+
+
+// Pass formatted line to backtrace context, async buffer or sinks.
+static void logger_emit_(logger_t* lg, const logger_record_t* record, unsigned wanted)
+{
+    logger_backtrace_t* bt = logger_thread_.backtrace;
+
+    if(bt && (unsigned) record->level > bt->threshold)
+    {
+        logger_backtrace_add_(bt, lg, record);
+        return;
+    }
+    // context of failed request goes right before the error
+    if(bt && record->level <= LOGGER_LEVEL_ERROR && (bt->len || bt->dropped)) logger_backtrace_write_(lg, bt, wanted);
+
+#if LOGGER_ASYNC
+    if(lg->async && LOGGER_ATOMIC_LOAD(lg->async->active) &&
+       (lg->async->cpus ? logger_percpu_push_(lg, record, wanted) : logger_async_push_(lg, record, wanted))) ;
+    else
+#endif // LOGGER_ASYNC
+    logger_write_records_(lg, record, &wanted, 1);
+}
+
+
+// Format line of record which prefix is already filled by logger_prefix_() and emit it.
+static void logger_vformat_(logger_t* lg, logger_record_t* record, unsigned wanted, const char* format, va_list ap)
+{
+    // whole line is formatted once, for all sinks
+    char stack_line[2048];
+    char* text = stack_line;
+    va_list args;
+    va_copy(args, ap);
+    int n = vsnprintf(stack_line, sizeof(stack_line), format, args);
+    va_end(args);
+    if(n < 0) return;
+    if((unsigned) n >= sizeof(stack_line))
+    {
+        text = (char*) malloc(n + 1);
+        if(!text) n = sizeof(stack_line) - 1, text = stack_line;
+        else
+        {
+            va_copy(args, ap);
+            vsnprintf(text, n + 1, format, args);
+            va_end(args);
+        }
+    }
+
+    record->line = text;
+    record->len = n;
+    logger_emit_(lg, record, wanted);
+
+    if(text != stack_line) free(text);
+}
+
+
+static void logger_format_(logger_t* lg, logger_record_t* record, unsigned wanted, const char* format, ...)
+{
+    va_list args;
+    va_start (args, format);
+    logger_vformat_(lg, record, wanted, format, args);
+    va_end (args);
+}
+
+
+static void logger_vmsg_(logger_t* lg, char* buff, unsigned len, int level, unsigned feature, const char* severity, const char* theclass, const char* func, const char* file, int line, const char* format, va_list ap)
+{
+    logger_record_t record;
+    unsigned wanted;
+
+    if(!logger_prefix_(lg, buff, len, level, feature, severity, theclass, func, file, line, &record, &wanted)) return;
+    logger_vformat_(lg, &record, wanted, format, ap);
+}
+
+
+// Log function for lines without arguments, message is copied after prefix instead of
+// being formatted. Only %% has to be handled, other conversions can't be valid without
+// arguments.
+void logger_msg_const_(logger_t* lg, char* buff, unsigned len, int level, unsigned feature, const char* severity, const char* theclass, const char* func, const char* file, int line, const char* message, unsigned message_len)
+{
+    logger_record_t record;
+    unsigned wanted;
+
+    if(!logger_prefix_(lg, buff, len, level, feature, severity, theclass, func, file, line, &record, &wanted)) return;
+
+    // same line as "%s " format "\n" would make
+    char stack_line[2048];
+    char* text = stack_line;
+    unsigned prefix = strlen(buff);
+    unsigned n = prefix + 1 + message_len + 1;
+    if(n >= sizeof(stack_line))
+    {
+        text = (char*) malloc(n + 1);
+        if(!text) return;
+    }
+    memcpy(text, buff, prefix);
+    text[prefix] = ' ';
+    if(!memchr(message, '%', message_len)) memcpy(text + prefix + 1, message, message_len);
+    else
+    {
+        unsigned i, j = prefix + 1;
+        for(i = 0; i < message_len; i++)
+        {
+            text[j++] = message[i];
+            if(message[i] == '%' && i + 1 < message_len && message[i + 1] == '%') i++;
+        }
+        n = j + 1;
+    }
+    text[n - 1] = '\n';
+    text[n] = 0;
+
+    record.line = text;
+    record.len = n;
+    logger_emit_(lg, &record, wanted);
+
+    if(text != stack_line) free(text);
+}
+
+
+// Core log function for default instance, variadic
+void logger_msg_ex_(char* buff, unsigned len, int level, unsigned feature, const char* severity, const char* theclass, const char* func, const char* file, int line, const char* format, ...)
+{
+    va_list args;
+    va_start (args, format);
+    logger_vmsg_(&logger_default_, buff, len, level, feature, severity, theclass, func, file, line, format, args);
+    va_end (args);
+}
+
+
+// Core log function for instance lg, variadic
+void logger_msg_to_(logger_t* lg, char* buff, unsigned len, int level, unsigned feature, const char* severity, const char* theclass, const char* func, const char* file, int line, const char* format, ...)
+{
+    va_list args;
+    va_start (args, format);
+    logger_vmsg_(lg, buff, len, level, feature, severity, theclass, func, file, line, format, args);
+    va_end (args);
 }
 
 
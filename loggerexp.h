@@ -62,6 +62,20 @@ extern "C" {
     #define LOGGER_SYSLOG 1
 #endif // _WIN32
 
+// watching of configuration file is implemented using inotify so it is Linux only
+#ifdef __linux__
+    #define LOGGER_WATCH 1
+#else
+    #define LOGGER_WATCH 0
+#endif // __linux__
+
+// asynchronous logging (logger_async_start()) uses pthreads
+#ifdef _WIN32
+    #define LOGGER_ASYNC 0
+#else
+    #define LOGGER_ASYNC 1
+#endif // _WIN32
+
 
 // define what to do when ABORT_EXIT() is called
 // #define ABORT_EXIT() exit(1)
@@ -85,10 +99,85 @@ extern "C" {
 #endif // _WIN32
 
 
-extern unsigned logger_log_level_;
-extern unsigned logger_debug_mask_;
-extern unsigned logger_trace_mask_;
-extern unsigned logger_options_;
+// Configuration words can be changed at any time by other threads (see logger_watch_start())
+// so every read in log macros is done as relaxed atomic load. On x86 and ARM this compiles
+// to ordinary load instruction.
+#ifdef _MSC_VER
+    #define LOGGER_ATOMIC_LOAD(x) (*(volatile unsigned*)&(x))
+    #define LOGGER_ATOMIC_STORE(x, v) (*(volatile unsigned*)&(x) = (v))
+    #define LOGGER_ATOMIC_LOAD8(x) (*(volatile unsigned char*)&(x))
+    #define LOGGER_ATOMIC_STORE8(x, v) (*(volatile unsigned char*)&(x) = (unsigned char)(v))
+#else
+    #define LOGGER_ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+    #define LOGGER_ATOMIC_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+    #define LOGGER_ATOMIC_LOAD8(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+    #define LOGGER_ATOMIC_STORE8(x, v) __atomic_store_n(&(x), (unsigned char)(v), __ATOMIC_RELAXED)
+#endif // _MSC_VER
+
+
+// size of cache line, used to keep read-mostly data away from frequently written data
+#define LOGGER_CACHE_LINE 64
+
+#ifdef _MSC_VER
+    #define LOGGER_CACHE_ALIGNED __declspec(align(LOGGER_CACHE_LINE))
+#else
+    #define LOGGER_CACHE_ALIGNED __attribute__ ((aligned(LOGGER_CACHE_LINE)))
+#endif // _MSC_VER
+
+// Logger configuration block. It is read by every log macro and written only when
+// configuration is changed so it is aligned and padded to it's own cache line.
+// Log macros are reading single fields using LOGGER_ATOMIC_LOAD(). Updates of several
+// fields are protected by seq (seqlock) so logger_get_config() and logger core will
+// always see all fields from the same update.
+typedef struct LOGGER_CACHE_ALIGNED logger_config_s
+{
+    unsigned seq;           // odd while update is in progress, incremented by 2 on every update
+    unsigned log_level;     // one of LOGGER_LEVEL_*
+    unsigned debug_mask;    // debug features enabled for log_debug()
+    unsigned trace_mask;    // trace features enabled for log_condtrace_*()
+    unsigned options;       // LOGGER_OPTION_* flags
+} logger_config_t;
+
+// Logger instance. Every instance has it's own log file, lock, level, masks and options.
+// Structure is private to loggerexp.c except that it starts with configuration block.
+typedef struct logger_s logger_t;
+
+// Default instance which is used by logger_open(), log_* macros and all other functions
+// that don't take logger_t* argument.
+extern logger_t logger_default_;
+
+// configuration block of logger instance lg
+#define logger_config_of(lg) ((logger_config_t*) (lg))
+
+// configuration block of default instance
+#define logger_config_ (*logger_config_of(&logger_default_))
+
+
+#ifdef _MSC_VER
+    #define LOGGER_THREAD_LOCAL __declspec(thread)
+#else
+    #define LOGGER_THREAD_LOCAL __thread
+#endif // _MSC_VER
+
+// Per thread overrides of level, debug mask and trace mask. Effective level of a thread
+// is higher of logger_config_.log_level and logger_thread_.log_level and effective masks
+// are logger_config_ masks ORed with logger_thread_ masks. So one thread can be traced
+// while other threads pay only one extra thread local load in disabled log macros.
+typedef struct logger_thread_s
+{
+    unsigned log_level;             // 0 (LOGGER_LEVEL_FATAL) means no override
+    unsigned debug_mask;
+    unsigned trace_mask;
+    unsigned sample_count[64];      // per feature counters for LOGGER_SAMPLE_EVERY
+    unsigned random;                // state of per thread PRNG for LOGGER_SAMPLE_RANDOM
+    int registered;                 // thread is in the list of registered threads
+    long tid;                       // thread id, as returned by GETPID()
+    struct logger_thread_s* next;   // list of registered threads
+    struct logger_backtrace_s* backtrace;   // attached backtrace context, see logger_backtrace_attach()
+    unsigned saved_override[3];     // overrides replaced by attached backtrace context
+} logger_thread_t;
+
+extern LOGGER_THREAD_LOCAL logger_thread_t logger_thread_;
 
 // logger levels
 enum
@@ -112,8 +201,20 @@ enum
     LOGGER_OPTION_SYSLOG            = 1 << 3,   // log to syslog
     LOGGER_OPTION_STDERR            = 1 << 4,   // log to stderr
     LOGGER_OPTION_MILLISECONDS      = 1 << 5,   // enable milliseconds in timestamps
+    LOGGER_OPTION_INDEX             = 1 << 6,   // write sidecar index of log file (see logger_index_entry_t)
+    LOGGER_OPTION_MICROSECONDS      = 1 << 7,   // enable microseconds in timestamps
+    LOGGER_OPTION_NANOSECONDS       = 1 << 8,   // enable nanoseconds in timestamps
+    LOGGER_OPTION_REOPEN            = 1 << 9,   // keep file open, reopen it when it is rotated
 };
 
+// With LOGGER_OPTION_REOPEN file is kept open but every LOGGER_REOPEN_CHECK_MS milliseconds
+// device and inode of file name are compared (stat()) with the open file and file is opened
+// again if it was moved or deleted, so external logrotate works without opening file for
+// every line.
+#ifndef LOGGER_REOPEN_CHECK_MS
+#define LOGGER_REOPEN_CHECK_MS 1000
+#endif // LOGGER_REOPEN_CHECK_MS
+
 // Set log file name and options. Caller must provide storage for string
 // log_file_name. If LOGGER_OPTION_KEEP_FILE_OPEN option is specified we will open
 // named log file and save file handle for later use.
@@ -121,24 +222,43 @@ extern void logger_open_ex(const char* log_file_name, unsigned options, const ch
 #define logger_open(logfile, opt) logger_open_ex((logfile), (opt), __FILE__)
 extern void logger_close(void);
 
+// Timestamps are taken from invariant TSC on x86-64 (build with LOGGER_TSC=0 to disable) and
+// converted to local time only when line is rendered. TSC is calibrated against wall clock
+// by logger_open_ex() (which takes LOGGER_CLOCK_INIT_US) and then every
+// LOGGER_CLOCK_CALIBRATE_MS. Without TSC clock_gettime(CLOCK_MONOTONIC) is used and it's
+// offset to wall clock is sampled again every LOGGER_CLOCK_CALIBRATE_MS.
+#ifndef LOGGER_CLOCK_CALIBRATE_MS
+#define LOGGER_CLOCK_CALIBRATE_MS 1000
+#endif // LOGGER_CLOCK_CALIBRATE_MS
+
+#ifndef LOGGER_CLOCK_INIT_US
+#define LOGGER_CLOCK_INIT_US 2000
+#endif // LOGGER_CLOCK_INIT_US
+
+// Calibrate TSC again (for example after wall clock was set). Does nothing without TSC.
+extern void logger_clock_calibrate(void);
+
+// Returns 1 if timestamps are taken from TSC.
+extern int logger_clock_is_tsc(void);
+
 // Set log level to one of LOGGER_LEVEL_FATAL, LOGGER_LEVEL_ERROR,
 // LOGGER_LEVEL_WARNING, LOGGER_LEVEL_INFO, LOGGER_LEVEL_DEBUG, LOGGER_LEVEL_TRACE.
-// logger_log_level_ will affect logging using log_fatal, log_error,
+// logger_config_.log_level will affect logging using log_fatal, log_error,
 // log_warn, log_info, log_debug and log_trace functions.
 extern void logger_set_log_level(unsigned level);
 
-// This function is used to set bits in logger_debug_mask_
+// This function is used to set bits in logger_config_.debug_mask
 // Every bit in mask controls one feature that you want to debug.
 extern void logger_set_debug_mask(unsigned mask);
 
-// This function is used to get logger_debug_mask_
+// This function is used to get logger_config_.debug_mask
 extern unsigned logger_get_debug_mask(void);
 
-// This function is used to set bits in logger_trace_mask_
+// This function is used to set bits in logger_config_.trace_mask
 // Every bit in mask controls one feature that you want to trace.
 extern void logger_set_trace_mask(unsigned mask);
 
-// This function is used to get logger_trace_mask_
+// This function is used to get logger_config_.trace_mask
 extern unsigned logger_get_trace_mask(void);
 
 
@@ -154,44 +274,520 @@ extern void logger_enable_trace(unsigned feature);
 // Disable trace for feature (bitmask)
 extern void logger_disable_trace(unsigned feature);
 
+// Create new logger instance with it's own file (name is copied), lock, level, masks and
+// options. Log lines are written to instance with log_*_to() macros. Syslog is shared by
+// all instances since there is only one syslog connection per process.
+// Returns 0 if out of memory.
+extern logger_t* logger_create_ex(const char* log_file_name, unsigned options, const char* file);
+#define logger_create(logfile, opt) logger_create_ex((logfile), (opt), __FILE__)
+
+// Close and free logger instance created by logger_create().
+extern void logger_destroy(logger_t* lg);
+
+// Functions for instance lg, same as functions without _of for default instance
+extern void logger_set_log_level_of(logger_t* lg, unsigned level);
+extern void logger_set_debug_mask_of(logger_t* lg, unsigned mask);
+extern void logger_set_trace_mask_of(logger_t* lg, unsigned mask);
+extern void logger_get_config_of(logger_t* lg, logger_config_t* config);
+extern void logger_set_config_of(logger_t* lg, const logger_config_t* config);
+extern void logger_enable_debug_of(logger_t* lg, unsigned feature);
+extern void logger_disable_debug_of(logger_t* lg, unsigned feature);
+extern void logger_enable_trace_of(logger_t* lg, unsigned feature);
+extern void logger_disable_trace_of(logger_t* lg, unsigned feature);
+extern void logger_lock_of(logger_t* lg);
+extern void logger_unlock_of(logger_t* lg);
+
+
+// Sinks
+//
+// Every instance writes rendered log lines to it's sinks. File, stderr and syslog are built in
+// sinks, enabled by LOGGER_OPTION_FILE, LOGGER_OPTION_STDERR and LOGGER_OPTION_SYSLOG. Other
+// sinks are added with logger_add_sink(). Every sink has it's own filter: highest level it
+// accepts and masks of debug and trace features it accepts. Level and masks that log macros
+// check are limited to union of filters of all enabled sinks so line that no sink wants is
+// never formatted.
+// Built in file and stderr sinks accept everything, syslog sink accepts lines up to
+// LOGGER_LEVEL_INFO and no debug or trace features; use logger_sink_set_filter() to change it.
+
+// maximum number of sinks per instance, including built in sinks
+#ifndef LOGGER_MAX_SINKS
+#define LOGGER_MAX_SINKS 8
+#endif // LOGGER_MAX_SINKS
+
+// rendered log line passed to sinks
+typedef struct logger_record_s
+{
+    const char* line;       // whole line, starting with timestamp and ending with '\n'
+    unsigned len;           // length of line
+    unsigned body;          // offset of text after timestamp (what syslog gets)
+    int level;              // one of LOGGER_LEVEL_*
+    unsigned feature;       // debug or trace feature, 0 if line is not debug/trace feature line
+    int trace;              // feature is trace feature, otherwise it is debug feature
+    unsigned long long time;    // logger_monotonic_ns() when line was logged
+    unsigned msg;           // offset of message text, after prefix and diagnostic context
+    long tid;               // thread id written in line prefix
+    const char* func;       // function of log statement, 0 if line has no location
+    const char* theclass;   // class of *_member_* lines, otherwise 0
+    const char* file;       // source file without common prefix and line of log statement
+    int src_line;
+    char phase;             // 'B' for trace enter, 'E' for trace exit, 'X' for scope, otherwise 0
+    const char* name;       // scope name of 'X' line
+    unsigned long long duration;    // scope duration in nanoseconds of 'X' line
+} logger_record_t;
+
+// sink interface, all functions are called with instance lock held
+typedef struct logger_sink_ops_s
+{
+    void (*write_batch)(void* ctx, const logger_record_t* records, unsigned n);
+    void (*flush)(void* ctx);       // can be 0
+    void (*close)(void* ctx);       // called when sink is removed, can be 0
+} logger_sink_ops_t;
+
+typedef struct logger_sink_s logger_sink_t;
+
+// Add sink to instance lg (which must be opened/created). Sink gets lines of level
+// up to and including level. Debug feature lines must also match debug_mask and trace
+// feature lines trace_mask. Returns sink handle or 0 if there are already LOGGER_MAX_SINKS sinks.
+extern logger_sink_t* logger_add_sink(logger_t* lg, const logger_sink_ops_t* ops, void* ctx, unsigned level, unsigned debug_mask, unsigned trace_mask);
+
+// Remove sink and call it's close function. Built in sinks can't be removed, use options.
+extern void logger_remove_sink(logger_t* lg, logger_sink_t* sink);
+
+// Change filter of sink.
+extern void logger_sink_set_filter(logger_t* lg, logger_sink_t* sink, unsigned level, unsigned debug_mask, unsigned trace_mask);
+
+// Get built in sink, option is one of LOGGER_OPTION_FILE, LOGGER_OPTION_STDERR or LOGGER_OPTION_SYSLOG.
+// Example: logger_sink_set_filter(lg, logger_get_sink(lg, LOGGER_OPTION_STDERR), LOGGER_LEVEL_ERROR, 0, 0);
+extern logger_sink_t* logger_get_sink(logger_t* lg, unsigned option);
+
+// Write n already rendered lines (for example lines logged by other process) to sinks of
+// instance lg which accept them. Level and features are checked against sink filters only.
+extern void logger_write_records_of(logger_t* lg, const logger_record_t* records, unsigned n);
+
+// What buffering sinks and asynchronous logging do with new line when their buffer is full
+enum
+{
+    LOGGER_OVERFLOW_DROP_NEWEST = 0,    // new line is dropped
+    LOGGER_OVERFLOW_DROP_OLDEST = 1,    // oldest lines are dropped to make room for new one
+    LOGGER_OVERFLOW_BLOCK = 2,          // logging thread waits for room up to timeout, then line is dropped
+    LOGGER_OVERFLOW_DROP_BY_LEVEL = 3,  // DEBUG and TRACE lines are accepted only while buffer is less
+                                        // than half full, WARN and INFO while it is less than 7/8 full,
+                                        // FATAL and ERROR lines wait for room and are never dropped
+};
+
+// Bounded buffer of whole lines for sinks which hand lines to their own thread (socket and
+// compressed file sinks). It is not locked, sink protects it with it's own lock.
+typedef struct logger_line_buffer_s
+{
+    char* buf;
+    unsigned len;           // bytes in buffer
+    unsigned size;          // size of buf
+    int policy;             // LOGGER_OVERFLOW_DROP_NEWEST or LOGGER_OVERFLOW_DROP_OLDEST
+} logger_line_buffer_t;
+
+// Append line of len bytes to b. When it doesn't fit, line or oldest whole lines are
+// dropped by b->policy and counted in *dropped_lines and *dropped_bytes.
+extern void logger_line_buffer_append(logger_line_buffer_t* b, const char* line, unsigned len,
+    unsigned long long* dropped_lines, unsigned long long* dropped_bytes);
+
+// Number of lines ('\n' characters) in len bytes at p.
+extern unsigned logger_count_lines(const char* p, unsigned len);
+
+// Sidecar index
+//
+// With LOGGER_OPTION_INDEX file sink writes index file (log file name + ".idx") next to
+// log file. Log file is split in blocks of at least LOGGER_INDEX_BLOCK bytes (whole lines)
+// and for every block one entry is appended to index when block is done. Entry has
+// timestamp of the first line in block and bitmaps of levels, debug features and trace
+// features of lines in block so tools (see loggerexp-query) can seek to time window or
+// level without reading whole file.
+// Lines after the last entry are not indexed yet and must be scanned.
+
+#ifndef LOGGER_INDEX_BLOCK
+#define LOGGER_INDEX_BLOCK (64 * 1024)
+#endif // LOGGER_INDEX_BLOCK
+
+typedef struct logger_index_entry_s
+{
+    unsigned long long offset;      // offset of block in log file
+    unsigned long long length;      // length of block
+    char time[32];                  // timestamp of the first line, as in log file, 0 padded
+    unsigned levels;                // bit (1 << level) is set for every level in block
+    unsigned debug_features;        // debug features of lines in block
+    unsigned trace_features;        // trace features of lines in block
+    unsigned reserved;              // entry is 64 bytes
+} logger_index_entry_t;
+
+// Call flush function of all sinks of default instance / instance lg. With asynchronous
+// logging lines that are buffered are written first.
+extern void logger_flush(void);
+extern void logger_flush_of(logger_t* lg);
+
+
+// Hierarchical named categories
+//
+// Categories are named like "net.http.parser" where dot separates levels of hierarchy.
+// Every category has it's own log level (one of LOGGER_LEVEL_*) which is independent
+// from logger_config_.log_level. Category is registered once (typically at startup)
+// and after that it is referenced by small integer id which is index into
+// logger_category_level_ array, so checking category level is single indexed load.
+// Id 0 is root category "" which is parent of all categories.
+//
+// Category handle is declared with LOGGER_CATEGORY_DECLARE(var, static_level) (in a header
+// or .c file) and defined with LOGGER_CATEGORY_DEFINE(var) in one .c file.
+// static_level is highest level that is compiled in for that category, like DEBUG_STATIC_MASK
+// is for debug features. CATEGORY_STATIC_LEVEL (see debug_features.h) is applied to all
+// categories.
+//
+// Example:
+//
+// LOGGER_CATEGORY_DECLARE(cat_parser, LOGGER_LEVEL_DEBUG);
+// LOGGER_CATEGORY_DEFINE(cat_parser);
+//
+// cat_parser = logger_category_register("net.http.parser");
+// logger_category_set_level("net", LOGGER_LEVEL_DEBUG);   // net, net.http, net.http.parser
+// log_cat_debug(cat_parser, "state %d", state);
+
+// maximum number of categories, including root category
+#ifndef LOGGER_MAX_CATEGORIES
+#define LOGGER_MAX_CATEGORIES 256
+#endif // LOGGER_MAX_CATEGORIES
+
+extern unsigned char logger_category_level_[LOGGER_MAX_CATEGORIES];
+
+#define LOGGER_CATEGORY_DECLARE(var, static_level) \
+    enum { var##_static_level_ = (static_level) }; \
+    extern unsigned var
+
+#define LOGGER_CATEGORY_DEFINE(var) unsigned var = 0
+
+// Register category name and return it's id. Missing parent categories are registered
+// too. If name is already registered it's id is returned. New category gets level of
+// it's parent. If there is no more space in category table 0 (root category) is returned.
+extern unsigned logger_category_register(const char* name);
+
+// Find registered category. Returns it's id or -1 if name is not registered.
+extern int logger_category_find(const char* name);
+
+// Set level of category name and all of it's children. Name "" sets all categories.
+// Returns -1 if category is not registered.
+extern int logger_category_set_level(const char* name, unsigned level);
+
+// Get level of category id.
+extern unsigned logger_category_get_level(unsigned id);
+
+// Get name of category id.
+extern const char* logger_category_name(unsigned id);
+
+
+// Register calling thread so it's overrides can be set by other threads using it's thread id
+// (tid printed in every log line). Threads are registered automatically when they log first
+// line. On Linux thread is unregistered automatically when it exits, on Windows thread
+// must call logger_thread_unregister() before exit.
+extern void logger_thread_register(void);
+extern void logger_thread_unregister(void);
+
+// Set level, debug mask and trace mask overrides for thread tid (0 is calling thread).
+// Overrides can only enable more logging for that thread (see logger_thread_t).
+// Returns -1 if there is no registered thread with id tid.
+extern int logger_thread_set_override(long tid, unsigned level, unsigned debug_mask, unsigned trace_mask);
+
+// Remove overrides for thread tid (0 is calling thread).
+extern int logger_thread_clear_override(long tid);
+
+
+// Backtrace (buffer until error) logging. While a backtrace context is attached to a
+// thread, lines of that thread less severe than threshold are not written but kept in
+// context's buffer (size bytes, oldest lines are dropped when it is full). The buffer is
+// discarded by logger_backtrace_discard() when request succeeds, or written right before
+// the next ERROR or FATAL line of the thread, to sinks which get that line, regardless of
+// their level filters. level, debug_mask and trace_mask are set as thread overrides while
+// context is attached, so for example threshold LOGGER_LEVEL_WARN and level
+// LOGGER_LEVEL_DEBUG give debug lines for failed requests at cost of writing only warnings.
+// Context belongs to a request and can be detached from one thread and attached to other,
+// but it can be attached to only one thread at a time.
+typedef struct logger_backtrace_s logger_backtrace_t;
+
+extern logger_backtrace_t* logger_backtrace_create(unsigned size, unsigned threshold, unsigned level, unsigned debug_mask, unsigned trace_mask);
+extern void logger_backtrace_destroy(logger_backtrace_t* bt);
+
+// Attach bt to calling thread (0 detaches), returns previously attached context.
+extern logger_backtrace_t* logger_backtrace_attach(logger_backtrace_t* bt);
+
+// Drop lines buffered in context attached to calling thread.
+extern void logger_backtrace_discard(void);
+
+// Write lines buffered in context attached to calling thread to sinks of instance lg
+// which accept ERROR lines. Only lines logged to lg are written (also by ERROR line),
+// lines of other instances stay in context.
+extern void logger_backtrace_flush_of(logger_t* lg);
+
+
+// Diagnostic context (MDC) of a thread: key=value pairs which are added to every line
+// logged by the thread, after the prefix, as " {req=42 user=bob}". Context is rendered
+// when pair is pushed and copied into lines as it is, popping a pair only truncates it.
+#ifndef LOGGER_MDC_SIZE
+#define LOGGER_MDC_SIZE 128
+#endif // LOGGER_MDC_SIZE
+
+#ifndef LOGGER_MDC_DEPTH
+#define LOGGER_MDC_DEPTH 8
+#endif // LOGGER_MDC_DEPTH
+
+typedef struct logger_mdc_s
+{
+    unsigned len;                   // length of rendered text, 0 if context is empty
+    unsigned depth;                 // number of pushed pairs
+    unsigned ends[LOGGER_MDC_DEPTH];    // len before every push
+    char text[LOGGER_MDC_SIZE];     // rendered context
+} logger_mdc_t;
+
+// Push key and printf formatted value to context of calling thread. Returns -1 if there are
+// LOGGER_MDC_DEPTH pairs already or rendered context would not fit to LOGGER_MDC_SIZE.
+extern int logger_mdc_push(const char* key, const char* format, ...);
+
+// Pop last pushed pair, or all of them.
+extern void logger_mdc_pop(void);
+extern void logger_mdc_clear(void);
+
+// Copy context of calling thread to mdc or replace it with mdc, used to pass context with
+// work item to other thread.
+extern void logger_mdc_get(logger_mdc_t* mdc);
+extern void logger_mdc_set(const logger_mdc_t* mdc);
+
+
+// Sampling of debug and trace features
+//
+// log_debug_sampled() and log_condtrace_sampled() log only 1 of every rate lines for
+// features with sampling enabled. Decision is made before timestamp and message are
+// formatted. Every sampled line carries it's weight as "{w=rate}" so counts can be scaled.
+// Sampling state is per thread so sampling doesn't touch any shared cache line.
+
+// sampling modes
+enum
+{
+    LOGGER_SAMPLE_EVERY     = 0,    // every rate-th line, per thread counter
+    LOGGER_SAMPLE_RANDOM    = 1,    // each line with probability 1/rate, per thread PRNG
+};
+
+// sampling rate and mode for 32 debug features followed by 32 trace features
+extern unsigned logger_sample_rate_[64];
+extern unsigned logger_sample_mode_[64];
+
+// Set sampling for all debug features in features (bitmask). rate 0 or 1 disables sampling.
+extern void logger_set_debug_sampling(unsigned features, unsigned rate, int mode);
+
+// Set sampling for all trace features in features (bitmask). rate 0 or 1 disables sampling.
+extern void logger_set_trace_sampling(unsigned features, unsigned rate, int mode);
+
+
 // lock / unlock functions for logger
 extern void logger_lock(void);
 extern void logger_unlock(void);
 
+// Copy consistent snapshot of configuration block (level, masks and options) to config.
+extern void logger_get_config(logger_config_t* config);
+
+// Atomically replace level, masks and options with the ones from config (seq is ignored).
+// Readers using logger_get_config() will see either old or new configuration, never a mix.
+extern void logger_set_config(const logger_config_t* config);
+
+
+// Read configuration file and apply it. Returns 0 on success or -1 if file can't
+// be opened or has syntax error. In case of error nothing is changed.
+// Configuration file consists of "key = value" lines. Empty lines and lines starting
+// with # are ignored. Keys that are not present in file are not changed.
+//
+//   level = debug          # fatal, error, warn, info, debug, trace or number
+//   level.net.http = info  # level of category net.http and it's children
+//   debug_mask = 0x0041    # numbers can be decimal, hex (0x) or octal (0)
+//   trace_mask = -1
+//   file = on              # LOGGER_OPTION_FILE, on/off, yes/no, true/false, 1/0
+//   stderr = off           # LOGGER_OPTION_STDERR
+//   syslog = off           # LOGGER_OPTION_SYSLOG
+//   flush = on             # LOGGER_OPTION_FLUSH_FILE
+//   keep_open = on         # LOGGER_OPTION_KEEP_FILE_OPEN
+//   reopen = on            # LOGGER_OPTION_REOPEN
+//   milliseconds = on      # LOGGER_OPTION_MILLISECONDS
+//   index = on             # LOGGER_OPTION_INDEX
+extern int logger_load_config(const char* config_file);
+
+#if LOGGER_ASYNC
+// Asynchronous logging
+//
+// Logging thread renders the line and copies it to a bounded buffer, a writer thread passes
+// buffered lines to sinks in batches. When buffer is full policy (LOGGER_OVERFLOW_*) decides
+// what happens. Dropped lines are counted per level and every LOGGER_DROP_MARKER_MS
+// milliseconds in which something was dropped writer thread logs
+// "[WARN] dropped N lines (fatal 0, error 0, warn 0, info 0, debug N, trace 0)".
+// Memory used is 2 * buffer_size because writer thread works on one buffer while
+// logging threads fill the other.
+
+#ifndef LOGGER_DROP_MARKER_MS
+#define LOGGER_DROP_MARKER_MS 1000
+#endif // LOGGER_DROP_MARKER_MS
+
+// Start asynchronous logging for default instance / instance lg. timeout_ms is used only
+// by LOGGER_OVERFLOW_BLOCK policy. Returns 0 on success or -1 on error.
+extern int logger_async_start(unsigned buffer_size, int policy, unsigned timeout_ms);
+extern int logger_async_start_of(logger_t* lg, unsigned buffer_size, int policy, unsigned timeout_ms);
+
+// Start asynchronous logging with one buffer of buffer_size bytes for every CPU. Logging
+// thread puts line in buffer of CPU it runs on (found using rseq area or sched_getcpu()),
+// so logging threads on different CPUs don't share any cache line. Writer thread collects
+// lines from all buffers every LOGGER_PERCPU_INTERVAL_MS milliseconds, or sooner when some
+// buffer becomes half full, and writes them ordered by time. LOGGER_OVERFLOW_BLOCK waits
+// by polling. Linux only.
+#ifndef LOGGER_PERCPU_INTERVAL_MS
+#define LOGGER_PERCPU_INTERVAL_MS 10
+#endif // LOGGER_PERCPU_INTERVAL_MS
+
+extern int logger_async_start_percpu(unsigned buffer_size, int policy, unsigned timeout_ms);
+extern int logger_async_start_percpu_of(logger_t* lg, unsigned buffer_size, int policy, unsigned timeout_ms);
+
+// Start asynchronous logging without writer thread, for programs with their own event loop.
+// Lines are buffered as with logger_async_start() and returned descriptor (eventfd on Linux,
+// read end of a pipe elsewhere) is readable while there are lines in buffer. Event loop
+// calls logger_drain() when it is readable. Log calls which would have to wait (FATAL lines,
+// LOGGER_OVERFLOW_BLOCK and errors with LOGGER_OVERFLOW_DROP_BY_LEVEL on full buffer) and
+// logger_flush() drain the buffer themselves. Descriptor is closed by logger_async_stop().
+// Returns descriptor or -1 on error.
+extern int logger_async_start_polled(unsigned buffer_size, int policy);
+extern int logger_async_start_polled_of(logger_t* lg, unsigned buffer_size, int policy);
+
+// Write at most budget buffered lines to sinks, in calling thread. Returns number of lines
+// written, 0 if buffer is empty or logging is not started with logger_async_start_polled().
+extern unsigned logger_drain(unsigned budget);
+extern unsigned logger_drain_of(logger_t* lg, unsigned budget);
+
+// Write all buffered lines and stop writer thread. It is called from logger_close() and
+// logger_destroy().
+extern void logger_async_stop(void);
+extern void logger_async_stop_of(logger_t* lg);
+
+// Get number of dropped lines for every level since logger_async_start().
+extern void logger_get_dropped(unsigned long long counts[LOGGER_LEVEL_TRACE + 1]);
+extern void logger_get_dropped_of(logger_t* lg, unsigned long long counts[LOGGER_LEVEL_TRACE + 1]);
+#endif // LOGGER_ASYNC
+
+#if LOGGER_ASYNC
+// Durability tiers of file sink
+//
+// LOGGER_OPTION_FLUSH_FILE only passes lines to the kernel. With durability tiers lines of
+// level up to sync_level are on disk (fdatasync()) before log call returns, lines up to
+// commit_level are synced by group commit thread at most commit_ms milliseconds after they
+// were written and other lines are never synced. Syncs are coalesced, one sync covers all
+// lines written before it started, so a burst of errors costs one or two disk flushes.
+// LOGGER_DURABILITY_NONE disables a tier. Usual setting is
+// logger_set_durability(LOGGER_LEVEL_FATAL, LOGGER_LEVEL_ERROR, 50).
+// Returns 0 on success or -1 on error (instance has no log file).
+#define LOGGER_DURABILITY_NONE (-1)
+
+extern int logger_set_durability(int sync_level, int commit_level, unsigned commit_ms);
+extern int logger_set_durability_of(logger_t* lg, int sync_level, int commit_level, unsigned commit_ms);
+
+// Number of syncs done for durability tiers of instance lg.
+extern unsigned long long logger_get_sync_count_of(logger_t* lg);
+#endif // LOGGER_ASYNC
+
+#if LOGGER_ASYNC
+// Flush policy of file sink
+//
+// Instead of flushing every line (LOGGER_OPTION_FLUSH_FILE) lines are kept in a buffer of
+// buffer_size bytes which is written with one write() when it is full, at most
+// max_delay_ms milliseconds after the first line that was not written (by flusher thread)
+// and right after any line of level up to flush_level. This bounds how old unwritten lines
+// can be while syscalls are made per batch. Policy replaces LOGGER_OPTION_FLUSH_FILE and
+// needs LOGGER_OPTION_KEEP_FILE_OPEN or LOGGER_OPTION_REOPEN, buffer_size 0 disables it.
+// Example: logger_set_flush_policy(64 * 1024, 200, LOGGER_LEVEL_ERROR);
+// Returns 0 on success or -1 on error.
+extern int logger_set_flush_policy(unsigned buffer_size, unsigned max_delay_ms, int flush_level);
+extern int logger_set_flush_policy_of(logger_t* lg, unsigned buffer_size, unsigned max_delay_ms, int flush_level);
+
+// Number of flushes done by flusher thread of instance lg.
+extern unsigned long long logger_get_flush_count_of(logger_t* lg);
+#endif // LOGGER_ASYNC
+
+#if LOGGER_WATCH
+// Start a thread which watches config_file using inotify and applies it (using
+// logger_load_config()) every time it is written or replaced (renamed over).
+// Configuration file is also applied once before this function returns.
+// File doesn't have to exist at the time of the call but it's directory must.
+// Returns 0 on success or -1 on error.
+extern int logger_watch_start(const char* config_file);
+
+// Stop watcher thread started by logger_watch_start(). It is called from logger_close().
+extern void logger_watch_stop(void);
+#endif // LOGGER_WATCH
+
 
 // macro for testing log level and debug mask
+// every test checks global configuration first and thread override only if that fails
 // test is info level enabled
-#define logger_is_info() (logger_log_level_ >= LOGGER_LEVEL_INFO)
+#define logger_is_info() (LOGGER_ATOMIC_LOAD(logger_config_.log_level) >= LOGGER_LEVEL_INFO || \
+                          LOGGER_ATOMIC_LOAD(logger_thread_.log_level) >= LOGGER_LEVEL_INFO)
 
 // test is warning level enabled
-#define logger_is_warn() (logger_log_level_ >= LOGGER_LEVEL_WARN)
+#define logger_is_warn() (LOGGER_ATOMIC_LOAD(logger_config_.log_level) >= LOGGER_LEVEL_WARN || \
+                          LOGGER_ATOMIC_LOAD(logger_thread_.log_level) >= LOGGER_LEVEL_WARN)
 
 // test is error level enabled
-#define logger_is_error() (logger_log_level_ >= LOGGER_LEVEL_ERROR)
+#define logger_is_error() (LOGGER_ATOMIC_LOAD(logger_config_.log_level) >= LOGGER_LEVEL_ERROR || \
+                           LOGGER_ATOMIC_LOAD(logger_thread_.log_level) >= LOGGER_LEVEL_ERROR)
 
 // test is debug level enabled
-#define logger_is_debug() (logger_log_level_ >= LOGGER_LEVEL_DEBUG)
+#define logger_is_debug() (LOGGER_ATOMIC_LOAD(logger_config_.log_level) >= LOGGER_LEVEL_DEBUG || \
+                           LOGGER_ATOMIC_LOAD(logger_thread_.log_level) >= LOGGER_LEVEL_DEBUG)
 
 // test is trace level enabled
-#define logger_is_trace() (logger_log_level_ >= LOGGER_LEVEL_TRACE)
+#define logger_is_trace() (LOGGER_ATOMIC_LOAD(logger_config_.log_level) >= LOGGER_LEVEL_TRACE || \
+                           LOGGER_ATOMIC_LOAD(logger_thread_.log_level) >= LOGGER_LEVEL_TRACE)
 
 // test is debug feature enabled. feature is bitfield mask
-#define logger_is_debug_feature(feature) ( logger_debug_mask_ & ( feature ) )
+#define logger_is_debug_feature(feature) ( (LOGGER_ATOMIC_LOAD(logger_config_.debug_mask) & ( feature )) || \
+                                           (LOGGER_ATOMIC_LOAD(logger_thread_.debug_mask) & ( feature )) )
 
 // test is trace feature enabled. feature is bitfield mask
-#define logger_is_trace_feature(feature) ( logger_trace_mask_ & ( feature ) )
+#define logger_is_trace_feature(feature) ( (LOGGER_ATOMIC_LOAD(logger_config_.trace_mask) & ( feature )) || \
+                                           (LOGGER_ATOMIC_LOAD(logger_thread_.trace_mask) & ( feature )) )
+
+// test is level enabled for instance lg
+#define logger_is_level_of(lg, level) (LOGGER_ATOMIC_LOAD(logger_config_of(lg)->log_level) >= (level) || \
+                                       LOGGER_ATOMIC_LOAD(logger_thread_.log_level) >= (level))
+
+// test is debug feature enabled for instance lg
+#define logger_is_debug_feature_of(lg, feature) ( (LOGGER_ATOMIC_LOAD(logger_config_of(lg)->debug_mask) & ( feature )) || \
+                                                  (LOGGER_ATOMIC_LOAD(logger_thread_.debug_mask) & ( feature )) )
 
+// test is trace feature enabled for instance lg
+#define logger_is_trace_feature_of(lg, feature) ( (LOGGER_ATOMIC_LOAD(logger_config_of(lg)->trace_mask) & ( feature )) || \
+                                                  (LOGGER_ATOMIC_LOAD(logger_thread_.trace_mask) & ( feature )) )
+
+// test is level enabled for category id
+#define logger_is_category(id, level) ( LOGGER_ATOMIC_LOAD8(logger_category_level_[(id)]) >= (level) )
+
+
+// Lines without arguments (sizeof(#__VA_ARGS__) is 1) go to logger_msg_const_() which copies
+// message after prefix without vsnprintf(), message length is known at compile time.
+// Other lines are formatted by logger_msg_to_(). Only one of the calls is compiled in.
+#define LOGGER_MSG_(lg, buffer, level, feature, severity, theclass, func, file, line, format, ...) \
+    do { \
+        if(sizeof(#__VA_ARGS__) == 1) \
+            logger_msg_const_((lg), buffer, sizeof(buffer), level, feature, severity, theclass, func, file, line, format, sizeof(format) - 1); \
+        else \
+            logger_msg_to_((lg), buffer, sizeof(buffer), level, feature, severity, theclass, func, file, line, "%s " format "\n", buffer, ##__VA_ARGS__ ); \
+    } while(0)
 
 #define log_fatal(format, ...) \
     do { \
         char logger_tmp_buffer__[512]; \
-        logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), 0, "[FATAL]", 0, 0, 0, 0, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+        LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_FATAL, 0, "[FATAL]", 0, 0, 0, 0, format, ##__VA_ARGS__); \
     } while(0)
 
 #define log_fatal_exit(format, ...) \
     do { \
         char logger_tmp_buffer__[512]; \
-        logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), 0, "[FATAL]", 0, 0, 0, 0, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+        LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_FATAL, 0, "[FATAL]", 0, 0, 0, 0, format, ##__VA_ARGS__); \
         logger_close(); ABORT_EXIT(); \
     } while(0)
 
@@ -199,7 +795,7 @@ extern void logger_unlock(void);
     do { \
         if(logger_is_error()) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), 1, "[ERROR]", 0, 0, 0, 0, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_ERROR, 0, "[ERROR]", 0, 0, 0, 0, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
@@ -208,7 +804,7 @@ extern void logger_unlock(void);
     do { \
         if(logger_is_warn()) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), 2, "[WARN]", 0, 0, 0, 0, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_WARN, 0, "[WARN]", 0, 0, 0, 0, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
@@ -216,34 +812,34 @@ extern void logger_unlock(void);
     do { \
         if(logger_is_info()) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), 2, "[INFO]", 0, 0, 0, 0, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_INFO, 0, "[INFO]", 0, 0, 0, 0, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
 
 #define log_debug(feature, format, ...) \
     do { \
-        if( (feature) & DEBUG_STATIC_MASK && logger_is_debug() && logger_is_debug_feature( (feature) ) && logger_options_ & (LOGGER_OPTION_FILE | LOGGER_OPTION_STDERR)) { \
+        if( (feature) & DEBUG_STATIC_MASK && logger_is_debug() && logger_is_debug_feature( (feature) )) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), -1, "[" #feature "]", 0, __func__, __FILE__, __LINE__, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_DEBUG, (feature), "[" #feature "]", 0, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
 
 #define log_trace_enter(format, ...) \
     do { \
-        if( logger_is_trace() && logger_options_ & (LOGGER_OPTION_FILE | LOGGER_OPTION_STDERR)) { \
+        if( logger_is_trace()) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), -1, "  >>>>  ", 0, __func__, __FILE__, __LINE__, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_TRACE, 0, "  >>>>  ", 0, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
 
 #define log_trace_exit(format, ...) \
     do { \
-        if( logger_is_trace() && logger_options_ & (LOGGER_OPTION_FILE | LOGGER_OPTION_STDERR)) { \
+        if( logger_is_trace()) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), -1, "  <<<<  ", 0, __func__, __FILE__, __LINE__, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_TRACE, 0, "  <<<<  ", 0, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
@@ -251,18 +847,41 @@ extern void logger_unlock(void);
 
 #define log_condtrace_enter(cond, format, ...) \
     do { \
-        if( (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond)) && logger_options_ & (LOGGER_OPTION_FILE | LOGGER_OPTION_STDERR)) { \
+        if( (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond))) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), -1, "  >>>>  ", 0, __func__, __FILE__, __LINE__, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_TRACE, (cond), "  >>>>  ", 0, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
 
 #define log_condtrace_exit(cond, format, ...) \
     do { \
-        if( (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond)) && logger_options_ & (LOGGER_OPTION_FILE | LOGGER_OPTION_STDERR)) { \
+        if( (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond))) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), -1, "  <<<<  ", 0, __func__, __FILE__, __LINE__, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_TRACE, (cond), "  <<<<  ", 0, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+
+// sampled variants of log_debug and log_condtrace, see logger_set_debug_sampling()
+#define log_debug_sampled(feature, format, ...) \
+    do { \
+        unsigned logger_weight__; \
+        if( (feature) & DEBUG_STATIC_MASK && logger_is_debug() && logger_is_debug_feature( (feature) ) && \
+            (logger_weight__ = logger_sample_(feature, 0)) != 0) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_DEBUG, (feature), "[" #feature "]", 0, __func__, __FILE__, __LINE__, "%s {w=%u} " format "\n", logger_tmp_buffer__, logger_weight__, ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+
+#define log_condtrace_sampled(cond, format, ...) \
+    do { \
+        unsigned logger_weight__; \
+        if( (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond)) && \
+            (logger_weight__ = logger_sample_(cond, 32)) != 0) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_TRACE, (cond), "[" #cond "]", 0, __func__, __FILE__, __LINE__, "%s {w=%u} " format "\n", logger_tmp_buffer__, logger_weight__, ##__VA_ARGS__ ); \
         } \
     } while(0)
 
@@ -272,9 +891,9 @@ extern void logger_unlock(void);
 
 #define log_trace_member_enter(format, ...) \
     do { \
-        if( logger_is_trace() && logger_options_ & (LOGGER_OPTION_FILE | LOGGER_OPTION_STDERR)) { \
+        if( logger_is_trace()) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), -1, "  >>>>  ", typeid(*this).name(), __func__, __FILE__, __LINE__, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_TRACE, 0, "  >>>>  ", typeid(*this).name(), __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
@@ -282,41 +901,366 @@ extern void logger_unlock(void);
 
 #define log_trace_member_exit(format, ...) \
     do { \
-        if( logger_is_trace() && logger_options_ & (LOGGER_OPTION_FILE | LOGGER_OPTION_STDERR)) { \
+        if( logger_is_trace()) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), -1, "  <<<<  ", typeid(*this).name(), __func__, __FILE__, __LINE__, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_TRACE, 0, "  <<<<  ", typeid(*this).name(), __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
 #define log_condtrace_member_enter(cond, format, ...) \
     do { \
-        if( (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond)) && logger_options_ & (LOGGER_OPTION_FILE | LOGGER_OPTION_STDERR)) { \
+        if( (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond))) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), -1, "  >>>>  ", typeid(*this).name(), __func__, __FILE__, __LINE__, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_TRACE, (cond), "  >>>>  ", typeid(*this).name(), __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
 
 #define log_condtrace_member_exit(cond, format, ...) \
     do { \
-        if( (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond)) && logger_options_ & (LOGGER_OPTION_FILE | LOGGER_OPTION_STDERR)) { \
+        if( (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond))) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_(&logger_default_, logger_tmp_buffer__, LOGGER_LEVEL_TRACE, (cond), "  <<<<  ", typeid(*this).name(), __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#endif
+
+
+// Scoped timing. log_trace_scope(name) takes monotonic timestamp where it is declared and
+// logs a single line with elapsed nanoseconds when enclosing scope is left (destructor in
+// C++, cleanup attribute in C with GCC or clang). Level and features are checked at entry.
+// *_over variants log only if elapsed time is at least threshold_ns, so fast calls cost two
+// clock reads and no formatting. log_warn_scope_over() logs at WARN level to catch slow
+// paths with tracing disabled.
+typedef struct
+{
+    logger_t* lg;                       // instance line is logged to
+    unsigned long long start;           // monotonic ns at entry, 0 if scope is disabled
+    unsigned long long threshold_ns;
+    int level;
+    unsigned feature;
+    const char* name;
+    const char* func;
+    const char* file;
+    int line;
+} logger_scope_t;
+
+// monotonic clock in nanoseconds
+extern unsigned long long logger_monotonic_ns(void);
+
+// logs scope s if it is enabled and took at least threshold_ns
+extern void logger_scope_end_(logger_scope_t* s);
+
+#define LOGGER_SCOPE_INIT_(lg, enabled, level, feature, threshold_ns, name) \
+    { (lg), (enabled) ? logger_monotonic_ns() : 0, (threshold_ns), (level), (feature), (name), __func__, __FILE__, __LINE__ }
+
+#define LOGGER_CONCAT2_(a, b) a ## b
+#define LOGGER_CONCAT_(a, b) LOGGER_CONCAT2_(a, b)
+#ifdef __COUNTER__
+#define LOGGER_SCOPE_VAR_ LOGGER_CONCAT_(logger_scope__, __COUNTER__)
+#else
+#define LOGGER_SCOPE_VAR_ LOGGER_CONCAT_(logger_scope__, __LINE__)
+#endif
+
+#ifdef __cplusplus
+
+struct logger_scope_guard_
+{
+    logger_scope_t s;
+    ~logger_scope_guard_() { if(s.start) logger_scope_end_(&s); }
+};
+
+#define LOGGER_SCOPE_(lg, enabled, level, feature, threshold_ns, name) \
+    logger_scope_guard_ LOGGER_SCOPE_VAR_ = { LOGGER_SCOPE_INIT_(lg, enabled, level, feature, threshold_ns, name) }
+
+#elif defined(__GNUC__)
+
+static inline void logger_scope_cleanup_(logger_scope_t* s)
+{
+    if(s->start) logger_scope_end_(s);
+}
+
+#define LOGGER_SCOPE_(lg, enabled, level, feature, threshold_ns, name) \
+    logger_scope_t LOGGER_SCOPE_VAR_ __attribute__((cleanup(logger_scope_cleanup_))) = \
+        LOGGER_SCOPE_INIT_(lg, enabled, level, feature, threshold_ns, name)
+
+#endif
+
+#ifdef LOGGER_SCOPE_
+
+#define log_trace_scope(name) \
+    LOGGER_SCOPE_(&logger_default_, logger_is_trace(), LOGGER_LEVEL_TRACE, 0, 0, (name))
+
+#define log_trace_scope_over(threshold_ns, name) \
+    LOGGER_SCOPE_(&logger_default_, logger_is_trace(), LOGGER_LEVEL_TRACE, 0, (threshold_ns), (name))
+
+#define log_condtrace_scope(cond, name) \
+    LOGGER_SCOPE_(&logger_default_, (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond)), \
+                  LOGGER_LEVEL_TRACE, (cond), 0, (name))
+
+#define log_condtrace_scope_over(cond, threshold_ns, name) \
+    LOGGER_SCOPE_(&logger_default_, (cond) & TRACE_STATIC_MASK && logger_is_trace() && logger_is_trace_feature((cond)), \
+                  LOGGER_LEVEL_TRACE, (cond), (threshold_ns), (name))
+
+#define log_warn_scope_over(threshold_ns, name) \
+    LOGGER_SCOPE_(&logger_default_, logger_is_warn(), LOGGER_LEVEL_WARN, 0, (threshold_ns), (name))
+
+// scopes logged to instance lg created by logger_create()
+#define log_trace_scope_to(lg, name) \
+    LOGGER_SCOPE_((lg), logger_is_level_of((lg), LOGGER_LEVEL_TRACE), LOGGER_LEVEL_TRACE, 0, 0, (name))
+
+#define log_trace_scope_over_to(lg, threshold_ns, name) \
+    LOGGER_SCOPE_((lg), logger_is_level_of((lg), LOGGER_LEVEL_TRACE), LOGGER_LEVEL_TRACE, 0, (threshold_ns), (name))
+
+#define log_condtrace_scope_to(lg, cond, name) \
+    LOGGER_SCOPE_((lg), (cond) & TRACE_STATIC_MASK && logger_is_level_of((lg), LOGGER_LEVEL_TRACE) && logger_is_trace_feature_of((lg), (cond)), \
+                  LOGGER_LEVEL_TRACE, (cond), 0, (name))
+
+#define log_condtrace_scope_over_to(lg, cond, threshold_ns, name) \
+    LOGGER_SCOPE_((lg), (cond) & TRACE_STATIC_MASK && logger_is_level_of((lg), LOGGER_LEVEL_TRACE) && logger_is_trace_feature_of((lg), (cond)), \
+                  LOGGER_LEVEL_TRACE, (cond), (threshold_ns), (name))
+
+#define log_warn_scope_over_to(lg, threshold_ns, name) \
+    LOGGER_SCOPE_((lg), logger_is_level_of((lg), LOGGER_LEVEL_WARN), LOGGER_LEVEL_WARN, 0, (threshold_ns), (name))
+
+#endif // LOGGER_SCOPE_
+
+
+// log macros for instance lg created by logger_create()
+#define log_fatal_to(lg, format, ...) \
+    do { \
+        char logger_tmp_buffer__[512]; \
+        LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_FATAL, 0, "[FATAL]", 0, 0, 0, 0, format, ##__VA_ARGS__); \
+    } while(0)
+
+#define log_error_to(lg, format, ...) \
+    do { \
+        if(logger_is_level_of((lg), LOGGER_LEVEL_ERROR)) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_ERROR, 0, "[ERROR]", 0, 0, 0, 0, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_warn_to(lg, format, ...) \
+    do { \
+        if(logger_is_level_of((lg), LOGGER_LEVEL_WARN)) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_WARN, 0, "[WARN]", 0, 0, 0, 0, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_info_to(lg, format, ...) \
+    do { \
+        if(logger_is_level_of((lg), LOGGER_LEVEL_INFO)) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_INFO, 0, "[INFO]", 0, 0, 0, 0, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_debug_to(lg, feature, format, ...) \
+    do { \
+        if( (feature) & DEBUG_STATIC_MASK && logger_is_level_of((lg), LOGGER_LEVEL_DEBUG) && logger_is_debug_feature_of((lg), (feature))) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_DEBUG, (feature), "[" #feature "]", 0, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_trace_enter_to(lg, format, ...) \
+    do { \
+        if( logger_is_level_of((lg), LOGGER_LEVEL_TRACE)) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_TRACE, 0, "  >>>>  ", 0, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_trace_exit_to(lg, format, ...) \
+    do { \
+        if( logger_is_level_of((lg), LOGGER_LEVEL_TRACE)) { \
             char logger_tmp_buffer__[512]; \
-            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), -1, "  <<<<  ", typeid(*this).name(), __func__, __FILE__, __LINE__, "%s " format "\n", logger_tmp_buffer__, ##__VA_ARGS__ ); \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_TRACE, 0, "  <<<<  ", 0, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_condtrace_enter_to(lg, cond, format, ...) \
+    do { \
+        if( (cond) & TRACE_STATIC_MASK && logger_is_level_of((lg), LOGGER_LEVEL_TRACE) && logger_is_trace_feature_of((lg), (cond))) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_TRACE, (cond), "  >>>>  ", 0, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_condtrace_exit_to(lg, cond, format, ...) \
+    do { \
+        if( (cond) & TRACE_STATIC_MASK && logger_is_level_of((lg), LOGGER_LEVEL_TRACE) && logger_is_trace_feature_of((lg), (cond))) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_TRACE, (cond), "  <<<<  ", 0, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_debug_sampled_to(lg, feature, format, ...) \
+    do { \
+        unsigned logger_weight__; \
+        if( (feature) & DEBUG_STATIC_MASK && logger_is_level_of((lg), LOGGER_LEVEL_DEBUG) && logger_is_debug_feature_of((lg), (feature)) && \
+            (logger_weight__ = logger_sample_(feature, 0)) != 0) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_to_((lg), logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_DEBUG, (feature), "[" #feature "]", 0, __func__, __FILE__, __LINE__, "%s {w=%u} " format "\n", logger_tmp_buffer__, logger_weight__, ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+#define log_condtrace_sampled_to(lg, cond, format, ...) \
+    do { \
+        unsigned logger_weight__; \
+        if( (cond) & TRACE_STATIC_MASK && logger_is_level_of((lg), LOGGER_LEVEL_TRACE) && logger_is_trace_feature_of((lg), (cond)) && \
+            (logger_weight__ = logger_sample_(cond, 32)) != 0) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_to_((lg), logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_TRACE, (cond), "[" #cond "]", 0, __func__, __FILE__, __LINE__, "%s {w=%u} " format "\n", logger_tmp_buffer__, logger_weight__, ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+#ifdef __cplusplus
+
+#define log_trace_member_enter_to(lg, format, ...) \
+    do { \
+        if( logger_is_level_of((lg), LOGGER_LEVEL_TRACE)) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_TRACE, 0, "  >>>>  ", typeid(*this).name(), __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_trace_member_exit_to(lg, format, ...) \
+    do { \
+        if( logger_is_level_of((lg), LOGGER_LEVEL_TRACE)) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_TRACE, 0, "  <<<<  ", typeid(*this).name(), __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_condtrace_member_enter_to(lg, cond, format, ...) \
+    do { \
+        if( (cond) & TRACE_STATIC_MASK && logger_is_level_of((lg), LOGGER_LEVEL_TRACE) && logger_is_trace_feature_of((lg), (cond))) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_TRACE, (cond), "  >>>>  ", typeid(*this).name(), __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define log_condtrace_member_exit_to(lg, cond, format, ...) \
+    do { \
+        if( (cond) & TRACE_STATIC_MASK && logger_is_level_of((lg), LOGGER_LEVEL_TRACE) && logger_is_trace_feature_of((lg), (cond))) { \
+            char logger_tmp_buffer__[512]; \
+            LOGGER_MSG_((lg), logger_tmp_buffer__, LOGGER_LEVEL_TRACE, (cond), "  <<<<  ", typeid(*this).name(), __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
         } \
     } while(0)
 
 #endif
 
 
+// category log macros, cat is category handle declared with LOGGER_CATEGORY_DECLARE()
+#define log_cat_error(cat, format, ...) \
+    do { \
+        if( LOGGER_LEVEL_ERROR <= CATEGORY_STATIC_LEVEL && LOGGER_LEVEL_ERROR <= (int) cat##_static_level_ && logger_is_category(cat, LOGGER_LEVEL_ERROR)) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_ERROR, 0, "[ERROR]", 0, 0, 0, 0, "%s %s " format "\n", logger_tmp_buffer__, logger_category_name(cat), ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+#define log_cat_warn(cat, format, ...) \
+    do { \
+        if( LOGGER_LEVEL_WARN <= CATEGORY_STATIC_LEVEL && LOGGER_LEVEL_WARN <= (int) cat##_static_level_ && logger_is_category(cat, LOGGER_LEVEL_WARN)) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_WARN, 0, "[WARN]", 0, 0, 0, 0, "%s %s " format "\n", logger_tmp_buffer__, logger_category_name(cat), ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+#define log_cat_info(cat, format, ...) \
+    do { \
+        if( LOGGER_LEVEL_INFO <= CATEGORY_STATIC_LEVEL && LOGGER_LEVEL_INFO <= (int) cat##_static_level_ && logger_is_category(cat, LOGGER_LEVEL_INFO)) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_INFO, 0, "[INFO]", 0, 0, 0, 0, "%s %s " format "\n", logger_tmp_buffer__, logger_category_name(cat), ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+#define log_cat_debug(cat, format, ...) \
+    do { \
+        if( LOGGER_LEVEL_DEBUG <= CATEGORY_STATIC_LEVEL && LOGGER_LEVEL_DEBUG <= (int) cat##_static_level_ && logger_is_category(cat, LOGGER_LEVEL_DEBUG)) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_DEBUG, 0, "[DEBUG]", 0, __func__, __FILE__, __LINE__, "%s %s " format "\n", logger_tmp_buffer__, logger_category_name(cat), ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+#define log_cat_trace(cat, format, ...) \
+    do { \
+        if( LOGGER_LEVEL_TRACE <= CATEGORY_STATIC_LEVEL && LOGGER_LEVEL_TRACE <= (int) cat##_static_level_ && logger_is_category(cat, LOGGER_LEVEL_TRACE)) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_ex_(logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_TRACE, 0, "[TRACE]", 0, __func__, __FILE__, __LINE__, "%s %s " format "\n", logger_tmp_buffer__, logger_category_name(cat), ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+
+
+// category log macros for instance lg created by logger_create(), category levels are
+// shared by all instances
+#define log_cat_error_to(lg, cat, format, ...) \
+    do { \
+        if( LOGGER_LEVEL_ERROR <= CATEGORY_STATIC_LEVEL && LOGGER_LEVEL_ERROR <= (int) cat##_static_level_ && logger_is_category(cat, LOGGER_LEVEL_ERROR)) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_to_((lg), logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_ERROR, 0, "[ERROR]", 0, 0, 0, 0, "%s %s " format "\n", logger_tmp_buffer__, logger_category_name(cat), ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+#define log_cat_warn_to(lg, cat, format, ...) \
+    do { \
+        if( LOGGER_LEVEL_WARN <= CATEGORY_STATIC_LEVEL && LOGGER_LEVEL_WARN <= (int) cat##_static_level_ && logger_is_category(cat, LOGGER_LEVEL_WARN)) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_to_((lg), logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_WARN, 0, "[WARN]", 0, 0, 0, 0, "%s %s " format "\n", logger_tmp_buffer__, logger_category_name(cat), ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+#define log_cat_info_to(lg, cat, format, ...) \
+    do { \
+        if( LOGGER_LEVEL_INFO <= CATEGORY_STATIC_LEVEL && LOGGER_LEVEL_INFO <= (int) cat##_static_level_ && logger_is_category(cat, LOGGER_LEVEL_INFO)) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_to_((lg), logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_INFO, 0, "[INFO]", 0, 0, 0, 0, "%s %s " format "\n", logger_tmp_buffer__, logger_category_name(cat), ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+#define log_cat_debug_to(lg, cat, format, ...) \
+    do { \
+        if( LOGGER_LEVEL_DEBUG <= CATEGORY_STATIC_LEVEL && LOGGER_LEVEL_DEBUG <= (int) cat##_static_level_ && logger_is_category(cat, LOGGER_LEVEL_DEBUG)) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_to_((lg), logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_DEBUG, 0, "[DEBUG]", 0, __func__, __FILE__, __LINE__, "%s %s " format "\n", logger_tmp_buffer__, logger_category_name(cat), ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
+#define log_cat_trace_to(lg, cat, format, ...) \
+    do { \
+        if( LOGGER_LEVEL_TRACE <= CATEGORY_STATIC_LEVEL && LOGGER_LEVEL_TRACE <= (int) cat##_static_level_ && logger_is_category(cat, LOGGER_LEVEL_TRACE)) { \
+            char logger_tmp_buffer__[512]; \
+            logger_msg_to_((lg), logger_tmp_buffer__, sizeof(logger_tmp_buffer__), LOGGER_LEVEL_TRACE, 0, "[TRACE]", 0, __func__, __FILE__, __LINE__, "%s %s " format "\n", logger_tmp_buffer__, logger_category_name(cat), ##__VA_ARGS__ ); \
+        } \
+    } while(0)
+
 
 // ###################################  LOGGER PRIVETE API  ###################################
 
 
 // Core log function, variadic
-extern void logger_msg_ex_(char* logger_tmp_buffer__, unsigned len, int nseverity, const char* severity,
+extern void logger_msg_ex_(char* logger_tmp_buffer__, unsigned len, int level, unsigned feature, const char* severity,
                            const char* theclass, const char* func, const char* file,
                            int line, const char* format, ...);
 
+// Core log function for instance lg, variadic
+extern void logger_msg_to_(logger_t* lg, char* logger_tmp_buffer__, unsigned len, int level, unsigned feature, const char* severity,
+                           const char* theclass, const char* func, const char* file,
+                           int line, const char* format, ...);
+extern void logger_msg_const_(logger_t* lg, char* logger_tmp_buffer__, unsigned len, int level, unsigned feature, const char* severity,
+                              const char* theclass, const char* func, const char* file,
+                              int line, const char* message, unsigned message_len);
+
+// Sampling decision for feature (index of it's lowest bit + base). Returns 0 if line
+// should be skipped or weight of the line (1 if sampling is disabled).
+extern unsigned logger_sample_(unsigned feature, unsigned base);
+
 
 #ifdef __cplusplus
 }
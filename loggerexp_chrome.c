@@ -0,0 +1,191 @@
+/*  Copyright (c) 2014, 2019, Mario Ivančić
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Chrome trace sink for loggerexp
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loggerexp_chrome.h"
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif // _WIN32
+
+
+struct logger_chrome_sink_s
+{
+    FILE* fp;
+    char* buf;
+    unsigned len;
+    unsigned size;
+    int pid;
+    unsigned long long events;
+};
+
+
+// Write buffered events to file with single fwrite.
+static void logger_chrome_write_(logger_chrome_sink_t* s)
+{
+    if(!s->len) return;
+    fwrite(s->buf, 1, s->len, s->fp);
+    fflush(s->fp);
+    s->len = 0;
+}
+
+
+// Append at most max bytes of JSON escaped text to p, returns end of escaped text.
+static char* logger_chrome_escape_(char* p, const char* text, unsigned len, unsigned max)
+{
+    const char* end = text + len;
+    char* limit = p + max;
+
+    while(text < end && p + 6 < limit)
+    {
+        unsigned char c = (unsigned char) *text++;
+        if(c == '"' || c == '\\') *p++ = '\\', *p++ = c;
+        else if(c >= 0x20) *p++ = c;
+        else p += sprintf(p, "\\u%04x", c);
+    }
+    return p;
+}
+
+
+static void logger_chrome_write_batch_(void* ctx, const logger_record_t* records, unsigned n)
+{
+    logger_chrome_sink_t* s = (logger_chrome_sink_t*) ctx;
+    unsigned i;
+
+    for(i = 0; i < n; i++)
+    {
+        const logger_record_t* r = &records[i];
+        unsigned long long ts = r->time, dur = r->duration;
+        unsigned msg = r->msg < r->len ? r->msg : r->len;
+        unsigned msg_len = r->len - msg;
+        char* p;
+        char* limit;
+
+        if(r->level != LOGGER_LEVEL_TRACE || !r->phase) continue;
+        if(msg_len && r->line[r->len - 1] == '\n') msg_len--;
+
+        // scope line is logged at it's end, event starts duration before it
+        if(r->phase == 'X') ts = dur < ts ? ts - dur : 0;
+
+        if(s->len + LOGGER_CHROME_EVENT_MAX > s->size) logger_chrome_write_(s);
+
+        // name and location are limited to a quarter of event each, message to what is left
+        p = s->buf + s->len;
+        limit = p + LOGGER_CHROME_EVENT_MAX / 4;
+        p += sprintf(p, "%s{\"name\":\"", s->events ? ",\n" : "");
+        if(r->phase == 'X' && r->name) p = logger_chrome_escape_(p, r->name, strlen(r->name), limit - p);
+        else
+        {
+            if(r->theclass)
+            {
+                p = logger_chrome_escape_(p, r->theclass, strlen(r->theclass), limit - p);
+                p = logger_chrome_escape_(p, "::", 2, limit - p);
+            }
+            if(r->func) p = logger_chrome_escape_(p, r->func, strlen(r->func), limit - p);
+        }
+        p += sprintf(p, "\",\"cat\":\"trace\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%ld,\"ts\":%llu.%03u",
+            r->phase, s->pid, r->tid, ts / 1000, (unsigned)(ts % 1000));
+        if(r->phase == 'X') p += sprintf(p, ",\"dur\":%llu.%03u", dur / 1000, (unsigned)(dur % 1000));
+        p += sprintf(p, ",\"args\":{\"at\":\"");
+        if(r->file)
+        {
+            limit = p + LOGGER_CHROME_EVENT_MAX / 4 - 16;
+            p = logger_chrome_escape_(p, r->file, strlen(r->file), limit - p);
+            p += sprintf(p, ":%d", r->src_line);
+        }
+        if(r->feature) p += sprintf(p, "\",\"feature\":\"0x%x", r->feature);
+        p += sprintf(p, "\",\"msg\":\"");
+        p = logger_chrome_escape_(p, r->line + msg, msg_len, s->buf + s->len + LOGGER_CHROME_EVENT_MAX - 8 - p);
+        p += sprintf(p, "\"}}");
+        s->len = p - s->buf;
+        s->events++;
+    }
+}
+
+
+static void logger_chrome_flush_(void* ctx)
+{
+    logger_chrome_write_((logger_chrome_sink_t*) ctx);
+}
+
+
+static void logger_chrome_close_(void* ctx)
+{
+    logger_chrome_sink_destroy((logger_chrome_sink_t*) ctx);
+}
+
+
+const logger_sink_ops_t logger_chrome_sink_ops = { logger_chrome_write_batch_, logger_chrome_flush_, logger_chrome_close_ };
+
+
+logger_chrome_sink_t* logger_chrome_sink_create(const char* file_name, unsigned buffer_size)
+{
+    logger_chrome_sink_t* s;
+
+    if(!file_name) return 0;
+    if(buffer_size < 2 * LOGGER_CHROME_EVENT_MAX) buffer_size = 2 * LOGGER_CHROME_EVENT_MAX;
+    s = (logger_chrome_sink_t*) calloc(1, sizeof(logger_chrome_sink_t));
+    if(!s) return 0;
+
+    s->size = buffer_size;
+    s->buf = (char*) malloc(buffer_size);
+    s->fp = fopen(file_name, "w");
+    if(!s->buf || !s->fp)
+    {
+        if(s->fp) fclose(s->fp);
+        free(s->buf);
+        free(s);
+        return 0;
+    }
+    s->pid = (int) getpid();
+    fputs("[\n", s->fp);
+    return s;
+}
+
+
+void logger_chrome_sink_destroy(logger_chrome_sink_t* s)
+{
+    if(!s) return;
+
+    logger_chrome_write_(s);
+    fputs("\n]\n", s->fp);
+    fclose(s->fp);
+    free(s->buf);
+    free(s);
+}
+
+
+unsigned long long logger_chrome_sink_events(logger_chrome_sink_t* s)
+{
+    return s->events;
+}
@@ -0,0 +1,78 @@
+/*  Copyright (c) 2014, 2019, Mario Ivančić
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// loggerexp_chrome.h
+
+/*
+    Chrome trace sink for loggerexp.
+
+    Writes trace enter/exit lines (log_trace_enter(), log_trace_exit(), log_condtrace_*() and
+    member variants) as B/E events and trace scopes (log_trace_scope() etc.) as complete X
+    events of Chrome Trace Event format, with thread id and microsecond timestamps. Other
+    lines are ignored. Events are collected in a buffer and written in bulk when it is full,
+    on logger_flush() and when sink is removed. File is JSON array which is closed when sink
+    is destroyed, but chrome://tracing and Perfetto also open unterminated file left by crash.
+
+    Example:
+
+    logger_chrome_sink_t* s = logger_chrome_sink_create("trace.json", 256 * 1024);
+    logger_add_sink(&logger_default_, &logger_chrome_sink_ops, s, LOGGER_LEVEL_TRACE, ~0u, ~0u);
+*/
+
+#ifndef LOGGEREXP_CHROME_H_INCLUDED__
+#define LOGGEREXP_CHROME_H_INCLUDED__
+
+#include "loggerexp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// maximum length of event, longer messages are truncated
+#ifndef LOGGER_CHROME_EVENT_MAX
+#define LOGGER_CHROME_EVENT_MAX 1024
+#endif // LOGGER_CHROME_EVENT_MAX
+
+typedef struct logger_chrome_sink_s logger_chrome_sink_t;
+
+// sink functions, ctx is logger_chrome_sink_t*
+extern const logger_sink_ops_t logger_chrome_sink_ops;
+
+// Create trace sink writing to file_name (which is truncated). Events are written when
+// buffer_size bytes are collected. Returns 0 on error.
+// Sink is freed by logger_remove_sink() or logger_chrome_sink_destroy().
+extern logger_chrome_sink_t* logger_chrome_sink_create(const char* file_name, unsigned buffer_size);
+
+// Write buffered events, close JSON array and file and free sink.
+// Must not be called for sink that is still added to logger instance.
+extern void logger_chrome_sink_destroy(logger_chrome_sink_t* s);
+
+// Number of events written or buffered by sink s.
+extern unsigned long long logger_chrome_sink_events(logger_chrome_sink_t* s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOGGEREXP_CHROME_H_INCLUDED__
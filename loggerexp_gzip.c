@@ -0,0 +1,267 @@
+/*  Copyright (c) 2014, 2019, Mario Ivančić
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// compressed file sink for loggerexp
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <zlib.h>
+
+#include "loggerexp_gzip.h"
+
+
+struct logger_gzip_sink_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int stop;
+    int flush;
+
+    // lines waiting for writer thread, protected by mutex
+    logger_line_buffer_t lines;
+
+    // used only by writer thread
+    char* out;
+    unsigned char* zbuf;
+    unsigned zsize;
+    z_stream z;
+    int fd;
+    int failed;                     // file couldn't be truncated after failed write, nothing is written
+
+    // counters, protected by mutex
+    logger_gzip_stats_t stats;
+};
+
+
+static void logger_gzip_write_batch_(void* ctx, const logger_record_t* records, unsigned n)
+{
+    logger_gzip_sink_t* s = (logger_gzip_sink_t*) ctx;
+    unsigned i;
+
+    pthread_mutex_lock(&s->mutex);
+    for(i = 0; i < n; i++)
+    {
+        logger_line_buffer_append(&s->lines, records[i].line, records[i].len,
+            &s->stats.dropped_lines, &s->stats.dropped_bytes);
+    }
+    if(s->lines.len >= LOGGER_GZIP_FRAME) pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+
+static void logger_gzip_flush_(void* ctx)
+{
+    logger_gzip_sink_t* s = (logger_gzip_sink_t*) ctx;
+
+    pthread_mutex_lock(&s->mutex);
+    s->flush = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+
+static void logger_gzip_close_(void* ctx)
+{
+    logger_gzip_sink_destroy((logger_gzip_sink_t*) ctx);
+}
+
+
+const logger_sink_ops_t logger_gzip_sink_ops = { logger_gzip_write_batch_, logger_gzip_flush_, logger_gzip_close_ };
+
+
+// Compress len bytes of s->out as one gzip member and write it. Returns number of bytes
+// written or 0 on error. Used only by writer thread.
+static unsigned logger_gzip_frame_(logger_gzip_sink_t* s, unsigned len)
+{
+    unsigned long bound = deflateBound(&s->z, len);
+    unsigned done = 0, total;
+    off_t start;
+
+    if(s->failed) return 0;
+    if(bound > s->zsize)
+    {
+        unsigned char* p = (unsigned char*) realloc(s->zbuf, bound);
+        if(!p) return 0;
+        s->zbuf = p;
+        s->zsize = bound;
+    }
+
+    deflateReset(&s->z);
+    s->z.next_in = (unsigned char*) s->out;
+    s->z.avail_in = len;
+    s->z.next_out = s->zbuf;
+    s->z.avail_out = s->zsize;
+    if(deflate(&s->z, Z_FINISH) != Z_STREAM_END) return 0;
+    total = s->zsize - s->z.avail_out;
+
+    // whole member is written at once. If write fails in the middle of member file is
+    // truncated back to where member started, so readers never see broken member. When
+    // that fails too nothing more is written, members after broken one couldn't be read.
+    start = lseek(s->fd, 0, SEEK_END);
+    while(done < total)
+    {
+        ssize_t n = write(s->fd, s->zbuf + done, total - done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0)
+        {
+            if(done && (start < 0 || ftruncate(s->fd, start))) s->failed = 1;
+            return 0;
+        }
+        done += n;
+    }
+    return total;
+}
+
+
+static void* logger_gzip_thread_(void* arg)
+{
+    logger_gzip_sink_t* s = (logger_gzip_sink_t*) arg;
+    int stop;
+
+    pthread_mutex_lock(&s->mutex);
+    for(;;)
+    {
+        while(!s->stop && !s->flush && s->lines.len < LOGGER_GZIP_FRAME)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += LOGGER_GZIP_INTERVAL_MS / 1000;
+            ts.tv_nsec += (LOGGER_GZIP_INTERVAL_MS % 1000) * 1000000L;
+            if(ts.tv_nsec >= 1000000000L) ts.tv_sec++, ts.tv_nsec -= 1000000000L;
+            if(pthread_cond_timedwait(&s->cond, &s->mutex, &ts) == ETIMEDOUT) break;
+        }
+        s->flush = 0;
+        stop = s->stop;
+
+        char* tmp = s->out;
+        unsigned len = s->lines.len;
+        s->out = s->lines.buf;
+        s->lines.buf = tmp;
+        s->lines.len = 0;
+        pthread_mutex_unlock(&s->mutex);
+
+        unsigned written = len ? logger_gzip_frame_(s, len) : 0;
+
+        pthread_mutex_lock(&s->mutex);
+        if(written)
+        {
+            s->stats.input_bytes += len;
+            s->stats.output_bytes += written;
+            s->stats.frames++;
+        }
+        else if(len)
+        {
+            s->stats.dropped_lines += logger_count_lines(s->out, len);
+            s->stats.dropped_bytes += len;
+        }
+        if(stop && !s->lines.len) break;
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return 0;
+}
+
+
+logger_gzip_sink_t* logger_gzip_sink_create(const char* file_name, int level, unsigned buffer_size, int policy)
+{
+    logger_gzip_sink_t* s;
+    pthread_condattr_t attr;
+
+    // sink can't block logging thread or wait for room, so only dropping policies are allowed
+    if(!file_name || !buffer_size || (policy != LOGGER_OVERFLOW_DROP_NEWEST && policy != LOGGER_OVERFLOW_DROP_OLDEST)) return 0;
+    s = (logger_gzip_sink_t*) calloc(1, sizeof(logger_gzip_sink_t));
+    if(!s) return 0;
+
+    s->lines.size = buffer_size;
+    s->lines.policy = policy;
+    s->lines.buf = (char*) malloc(buffer_size);
+    s->out = (char*) malloc(buffer_size);
+    s->fd = open(file_name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    // windowBits 15 + 16 makes gzip header and trailer
+    if(!s->lines.buf || !s->out || s->fd < 0 ||
+       deflateInit2(&s->z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        if(s->fd >= 0) close(s->fd);
+        free(s->lines.buf);
+        free(s->out);
+        free(s);
+        return 0;
+    }
+
+    pthread_mutex_init(&s->mutex, 0);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if(pthread_create(&s->thread, 0, logger_gzip_thread_, s))
+    {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->mutex);
+        deflateEnd(&s->z);
+        close(s->fd);
+        free(s->lines.buf);
+        free(s->out);
+        free(s);
+        return 0;
+    }
+    return s;
+}
+
+
+void logger_gzip_sink_destroy(logger_gzip_sink_t* s)
+{
+    if(!s) return;
+
+    pthread_mutex_lock(&s->mutex);
+    s->stop = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    pthread_join(s->thread, 0);
+
+    deflateEnd(&s->z);
+    close(s->fd);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->mutex);
+    free(s->lines.buf);
+    free(s->out);
+    free(s->zbuf);
+    free(s);
+}
+
+
+void logger_gzip_sink_stats(logger_gzip_sink_t* s, logger_gzip_stats_t* stats)
+{
+    pthread_mutex_lock(&s->mutex);
+    *stats = s->stats;
+    pthread_mutex_unlock(&s->mutex);
+}
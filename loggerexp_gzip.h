@@ -0,0 +1,94 @@
+/*  Copyright (c) 2014, 2019, Mario Ivančić
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// loggerexp_gzip.h
+
+/*
+    Compressed file sink for loggerexp.
+
+    Lines are collected in a buffer and compressed by a writer thread, so logging thread only
+    copies the line. Every LOGGER_GZIP_FRAME bytes of lines (or every LOGGER_GZIP_INTERVAL_MS
+    milliseconds, or on logger_flush()) are compressed as independent gzip member and written
+    with single write(). Concatenated gzip members are valid gzip file so zcat, zgrep and
+    loggerexp-cat can read it. A crash loses only lines that were not yet written and reader
+    can start decompressing at the beginning of any member.
+
+    Example:
+
+    logger_gzip_sink_t* s = logger_gzip_sink_create("debug.log.gz", 1, 4 << 20, LOGGER_OVERFLOW_DROP_NEWEST);
+    logger_add_sink(&logger_default_, &logger_gzip_sink_ops, s, LOGGER_LEVEL_TRACE, ~0u, ~0u);
+
+    Sink uses zlib and it is POSIX only.
+*/
+
+#ifndef LOGGEREXP_GZIP_H_INCLUDED__
+#define LOGGEREXP_GZIP_H_INCLUDED__
+
+#include "loggerexp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef LOGGER_GZIP_FRAME
+#define LOGGER_GZIP_FRAME (256 * 1024)
+#endif // LOGGER_GZIP_FRAME
+
+#ifndef LOGGER_GZIP_INTERVAL_MS
+#define LOGGER_GZIP_INTERVAL_MS 1000
+#endif // LOGGER_GZIP_INTERVAL_MS
+
+typedef struct logger_gzip_sink_s logger_gzip_sink_t;
+
+typedef struct logger_gzip_stats_s
+{
+    unsigned long long input_bytes;     // bytes of lines compressed
+    unsigned long long output_bytes;    // bytes written to file
+    unsigned long long frames;          // gzip members written
+    unsigned long long dropped_lines;
+    unsigned long long dropped_bytes;
+} logger_gzip_stats_t;
+
+// sink functions, ctx is logger_gzip_sink_t*
+extern const logger_sink_ops_t logger_gzip_sink_ops;
+
+// Create compressed file sink and start it's writer thread. File is opened for appending.
+// level is zlib compression level (1 is fastest), buffer_size is maximum number of bytes
+// waiting for writer thread (at least 2 * LOGGER_GZIP_FRAME is recommended) and policy is
+// LOGGER_OVERFLOW_DROP_NEWEST or LOGGER_OVERFLOW_DROP_OLDEST.
+// Returns 0 on error or if policy is other (LOGGER_OVERFLOW_BLOCK, LOGGER_OVERFLOW_DROP_BY_LEVEL). Sink is freed by logger_remove_sink() or logger_gzip_sink_destroy().
+extern logger_gzip_sink_t* logger_gzip_sink_create(const char* file_name, int level, unsigned buffer_size, int policy);
+
+// Stop writer thread (buffered lines are written), close file and free sink.
+// Must not be called for sink that is still added to logger instance.
+extern void logger_gzip_sink_destroy(logger_gzip_sink_t* s);
+
+// Get counters of sink s.
+extern void logger_gzip_sink_stats(logger_gzip_sink_t* s, logger_gzip_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOGGEREXP_GZIP_H_INCLUDED__
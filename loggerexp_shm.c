@@ -0,0 +1,541 @@
+/*  Copyright (c) 2014, 2019, Mario Ivančić
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// shared memory log ring for loggerexp
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "loggerexp_shm.h"
+
+
+#define LOGGER_SHM_MAGIC_ 0x524c4f4cu   // "LOLR"
+
+// Ring header at the start of shared memory, counters which writers and collector change
+// are on their own cache lines.
+typedef struct
+{
+    unsigned magic;
+    unsigned slots;                 // power of 2
+    char pad0[LOGGER_CACHE_LINE - 2 * sizeof(unsigned)];
+    unsigned long long head;        // next position to reserve, changed by writers
+    unsigned long long dropped;
+    char pad1[LOGGER_CACHE_LINE - 2 * sizeof(unsigned long long)];
+    unsigned long long tail;        // next position to collect, changed only by collector
+    unsigned long long collected;
+    unsigned long long reclaimed;
+    char pad2[LOGGER_CACHE_LINE - 3 * sizeof(unsigned long long)];
+} logger_shm_header_t;
+
+// Slot at position pos is free when seq == pos, committed when seq == pos + 1 and collector
+// frees it for the next round by setting seq to pos + slots.
+typedef struct
+{
+    unsigned long long seq;
+    char data[LOGGER_SHM_SLOT - sizeof(unsigned long long)];
+} logger_shm_slot_t;
+
+// Line header in the first slot of a line, line text follows it and continues in next slots.
+// Function, class, file and scope name strings (with their '\0') follow line text because
+// pointers of writer are not valid in collector.
+typedef struct
+{
+    unsigned pid;                   // writer, written right after slots are reserved
+    unsigned nslots;
+    unsigned len;
+    unsigned body;
+    int level;
+    unsigned feature;
+    int trace;
+    unsigned msg;
+    unsigned long long time;
+    unsigned long long duration;
+    int tid;
+    int src_line;
+    char phase;
+    unsigned short names[4];        // lengths of strings after line including '\0', 0 for null
+} logger_shm_rec_t;
+
+#define LOGGER_SHM_DATA_ (LOGGER_SHM_SLOT - sizeof(unsigned long long))
+#define LOGGER_SHM_BATCH_ 64
+
+// process local handle of ring
+struct logger_shm_ring_s
+{
+    logger_shm_header_t* hdr;
+    logger_shm_slot_t* slot;
+    size_t map_size;
+    char* name;                     // set if ring was created by this process
+    pid_t creator;
+
+    // collector
+    pthread_t thread;
+    pid_t collector;                // process running collector thread, 0 if not started
+    volatile int stop;
+    logger_t* lg;
+    unsigned long long stuck_pos;   // position of uncommitted line and when it was found
+    unsigned long long stuck_since;
+    unsigned long long reported;    // dropped lines already reported
+    char* buf;                      // lines of one batch copied out of the ring
+    unsigned buf_size;
+};
+
+
+static unsigned long long logger_shm_ms_(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// Reserve n slots, returns first position or ~0 if ring is full.
+static unsigned long long logger_shm_reserve_(logger_shm_ring_t* ring, unsigned n)
+{
+    logger_shm_header_t* h = ring->hdr;
+    unsigned long long mask = h->slots - 1;
+
+    for(;;)
+    {
+        unsigned long long pos = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+        unsigned long long last = pos + n - 1;
+        unsigned long long seq = __atomic_load_n(&ring->slot[last & mask].seq, __ATOMIC_ACQUIRE);
+
+        // collector frees slots in order, so if the last slot is free all are
+        if(seq == last)
+        {
+            if(__atomic_compare_exchange_n(&h->head, &pos, pos + n, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return pos;
+        }
+        else if((long long)(seq - last) < 0) return ~0ULL;
+    }
+}
+
+
+// Copy n bytes between src and line data of line at position pos, starting at offset off
+// of line data (line data starts after header in first slot). Copies to ring if in is set.
+static void logger_shm_copy_(logger_shm_ring_t* ring, unsigned long long pos, unsigned off, char* src, unsigned n, int in)
+{
+    unsigned long long mask = ring->hdr->slots - 1;
+
+    while(n)
+    {
+        unsigned at = off + sizeof(logger_shm_rec_t);
+        char* data = ring->slot[(pos + at / LOGGER_SHM_DATA_) & mask].data + at % LOGGER_SHM_DATA_;
+        unsigned chunk = LOGGER_SHM_DATA_ - at % LOGGER_SHM_DATA_;
+
+        if(chunk > n) chunk = n;
+        if(in) memcpy(data, src, chunk);
+        else memcpy(src, data, chunk);
+        src += chunk;
+        off += chunk;
+        n -= chunk;
+    }
+}
+
+
+static void logger_shm_write_batch_(void* ctx, const logger_record_t* records, unsigned n)
+{
+    logger_shm_ring_t* ring = (logger_shm_ring_t*) ctx;
+    logger_shm_header_t* h = ring->hdr;
+    unsigned long long mask = h->slots - 1;
+    unsigned pid = (unsigned) getpid();
+    unsigned i, j;
+
+    for(i = 0; i < n; i++)
+    {
+        const logger_record_t* r = &records[i];
+        const char* names[4] = { r->func, r->theclass, r->file, r->name };
+        unsigned short names_len[4];
+        unsigned size = r->len;
+
+        for(j = 0; j < 4; j++)
+        {
+            size_t len = names[j] ? strlen(names[j]) + 1 : 0;
+            names_len[j] = len < 0xffff ? (unsigned short) len : 0;
+            size += names_len[j];
+        }
+
+        unsigned k = (unsigned)((sizeof(logger_shm_rec_t) + size + LOGGER_SHM_DATA_ - 1) / LOGGER_SHM_DATA_);
+        unsigned long long pos = k <= h->slots ? logger_shm_reserve_(ring, k) : ~0ULL;
+
+        if(pos == ~0ULL)
+        {
+            __atomic_fetch_add(&h->dropped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        logger_shm_slot_t* first = &ring->slot[pos & mask];
+        logger_shm_rec_t* rec = (logger_shm_rec_t*) first->data;
+        __atomic_store_n(&rec->pid, pid, __ATOMIC_RELAXED);
+        __atomic_store_n(&rec->nslots, k, __ATOMIC_RELAXED);
+        rec->len = r->len;
+        rec->body = r->body;
+        rec->level = r->level;
+        rec->feature = r->feature;
+        rec->trace = r->trace;
+        rec->msg = r->msg;
+        rec->time = r->time;
+        rec->duration = r->duration;
+        rec->tid = (int) r->tid;
+        rec->src_line = r->src_line;
+        rec->phase = r->phase;
+
+        logger_shm_copy_(ring, pos, 0, (char*) r->line, r->len, 1);
+        size = r->len;
+        for(j = 0; j < 4; j++)
+        {
+            rec->names[j] = names_len[j];
+            logger_shm_copy_(ring, pos, size, (char*) names[j], names_len[j], 1);
+            size += names_len[j];
+        }
+
+        // first slot is committed last, so collector sees whole line. Commit fails if
+        // collector took this writer for dead and reclaimed slots.
+        for(j = k; j-- > 0; )
+        {
+            unsigned long long expected = pos + j;
+            __atomic_compare_exchange_n(&ring->slot[(pos + j) & mask].seq, &expected, pos + j + 1, 0,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+const logger_sink_ops_t logger_shm_sink_ops = { logger_shm_write_batch_, 0, 0 };
+
+
+// Free n slots starting at position pos for next round. Any slot can be first slot of a line
+// in next round, so it's writer pid is cleared: writer which dies before it stores it's pid
+// leaves 0 there, not pid of old writer which may still be alive.
+static void logger_shm_free_(logger_shm_ring_t* ring, unsigned long long pos, unsigned n)
+{
+    logger_shm_header_t* h = ring->hdr;
+    unsigned long long mask = h->slots - 1;
+    unsigned j;
+
+    for(j = 0; j < n; j++)
+    {
+        logger_shm_slot_t* s = &ring->slot[(pos + j) & mask];
+        logger_shm_rec_t* rec = (logger_shm_rec_t*) s->data;
+        __atomic_store_n(&rec->pid, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&rec->nslots, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->seq, pos + j + h->slots, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&h->tail, pos + n, __ATOMIC_RELEASE);
+}
+
+
+// Uncommitted line at tail: reclaim it's slots if writer is dead. Returns number of slots
+// reclaimed (0 if writer can still commit) and pid of the writer.
+static unsigned logger_shm_reclaim_(logger_shm_ring_t* ring, unsigned long long tail, unsigned* pid)
+{
+    logger_shm_header_t* h = ring->hdr;
+    unsigned long long mask = h->slots - 1;
+    logger_shm_rec_t* rec = (logger_shm_rec_t*) ring->slot[tail & mask].data;
+    unsigned long long now = logger_shm_ms_();
+    unsigned k, j;
+
+    if(ring->stuck_pos != tail || !ring->stuck_since)
+    {
+        ring->stuck_pos = tail;
+        ring->stuck_since = now;
+        return 0;
+    }
+    if(now - ring->stuck_since < LOGGER_SHM_DEAD_MS) return 0;
+
+    // pid 0 means writer died right after it reserved slots, before it wrote anything
+    *pid = __atomic_load_n(&rec->pid, __ATOMIC_RELAXED);
+    if(*pid && (kill((pid_t) *pid, 0) == 0 || errno != ESRCH)) return 0;
+    k = __atomic_load_n(&rec->nslots, __ATOMIC_RELAXED);
+    if(!*pid || !k || k > h->slots) k = 1;
+
+    // take back only slots which still belong to this line
+    for(j = 0; j < k; j++)
+    {
+        unsigned long long seq = __atomic_load_n(&ring->slot[(tail + j) & mask].seq, __ATOMIC_ACQUIRE);
+        if(seq != tail + j && seq != tail + j + 1) break;
+    }
+    ring->stuck_since = 0;
+    return j ? j : 1;
+}
+
+
+unsigned logger_shm_collect(logger_shm_ring_t* ring, logger_t* lg, unsigned max)
+{
+    logger_shm_header_t* h = ring->hdr;
+    unsigned long long mask = h->slots - 1;
+    unsigned long long tail = __atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+    logger_record_t records[LOGGER_SHM_BATCH_];
+    unsigned n = 0, used = 0, total = 0, j;
+
+    while(total < max)
+    {
+        logger_shm_slot_t* s = &ring->slot[tail & mask];
+        unsigned long long seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        int flush = 0, more = 1;
+        unsigned pid = 0, reclaimed = 0;
+
+        if(seq == tail + 1)
+        {
+            const logger_shm_rec_t* rec = (const logger_shm_rec_t*) s->data;
+            unsigned k = rec->nslots, len = rec->len;
+
+            for(j = 0; j < 4; j++) len += rec->names[j];
+            if(!k || k > h->slots || sizeof(logger_shm_rec_t) + len > k * LOGGER_SHM_DATA_) k = 1, len = 0;
+            if(used + len > ring->buf_size)
+            {
+                if(n) flush = 1;
+                else
+                {
+                    char* p = (char*) realloc(ring->buf, len);
+                    if(!p) len = 0;
+                    else ring->buf = p, ring->buf_size = len;
+                }
+            }
+            if(!flush)
+            {
+                // copy line out of the ring so slots can be freed right away
+                char* dst = ring->buf + used;
+                const char** names[4] = { &records[n].func, &records[n].theclass, &records[n].file, &records[n].name };
+                unsigned off = len ? rec->len : 0;
+
+                logger_shm_copy_(ring, tail, 0, dst, len, 0);
+                records[n].line = dst;
+                records[n].len = off;
+                records[n].body = rec->body;
+                records[n].level = rec->level;
+                records[n].feature = rec->feature;
+                records[n].trace = rec->trace;
+                records[n].msg = rec->msg;
+                records[n].time = rec->time;
+                records[n].duration = rec->duration;
+                records[n].tid = rec->tid;
+                records[n].src_line = rec->src_line;
+                records[n].phase = rec->phase;
+                for(j = 0; j < 4; j++)
+                {
+                    *names[j] = len && rec->names[j] ? dst + off : 0;
+                    if(len) off += rec->names[j];
+                }
+                used += len;
+                n++;
+                total++;
+                logger_shm_free_(ring, tail, k);
+                tail += k;
+                if(n == LOGGER_SHM_BATCH_) flush = 1;
+            }
+        }
+        else if(seq == tail && __atomic_load_n(&h->head, __ATOMIC_ACQUIRE) != tail &&
+                (reclaimed = logger_shm_reclaim_(ring, tail, &pid)) != 0)
+        {
+            logger_shm_free_(ring, tail, reclaimed);
+            tail += reclaimed;
+            __atomic_fetch_add(&h->reclaimed, 1, __ATOMIC_RELAXED);
+            flush = 1;
+        }
+        else more = 0;
+
+        if((flush || !more) && n)
+        {
+            logger_write_records_of(lg, records, n);
+            __atomic_fetch_add(&h->collected, n, __ATOMIC_RELAXED);
+            n = 0;
+            used = 0;
+        }
+        if(reclaimed) log_warn_to(lg, "shm ring: skipped line of dead process %u, %u slots", pid, reclaimed);
+        if(!more) break;
+    }
+    if(n)
+    {
+        logger_write_records_of(lg, records, n);
+        __atomic_fetch_add(&h->collected, n, __ATOMIC_RELAXED);
+    }
+
+    unsigned long long dropped = __atomic_load_n(&h->dropped, __ATOMIC_RELAXED);
+    if(dropped != ring->reported)
+    {
+        log_warn_to(lg, "shm ring: dropped %llu lines", dropped - ring->reported);
+        ring->reported = dropped;
+    }
+    return total;
+}
+
+
+static logger_shm_ring_t* logger_shm_map_(int fd, size_t size)
+{
+    logger_shm_ring_t* ring = (logger_shm_ring_t*) calloc(1, sizeof(logger_shm_ring_t));
+    void* p;
+
+    if(!ring) return 0;
+    p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED)
+    {
+        free(ring);
+        return 0;
+    }
+    ring->hdr = (logger_shm_header_t*) p;
+    ring->slot = (logger_shm_slot_t*)(ring->hdr + 1);
+    ring->map_size = size;
+    ring->buf_size = 64 * 1024;
+    ring->buf = (char*) malloc(ring->buf_size);
+    if(!ring->buf) ring->buf_size = 0;
+    return ring;
+}
+
+
+logger_shm_ring_t* logger_shm_create(const char* name, unsigned slots)
+{
+    logger_shm_ring_t* ring;
+    unsigned n = 2, i;
+    size_t size;
+    int fd;
+
+    while(n < slots && n < (1u << 30)) n <<= 1;
+    size = sizeof(logger_shm_header_t) + (size_t) n * sizeof(logger_shm_slot_t);
+
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0) return 0;
+    if(ftruncate(fd, size) || !(ring = logger_shm_map_(fd, size)))
+    {
+        close(fd);
+        shm_unlink(name);
+        return 0;
+    }
+    close(fd);
+
+    ring->hdr->slots = n;
+    for(i = 0; i < n; i++) ring->slot[i].seq = i;
+    __atomic_store_n(&ring->hdr->magic, LOGGER_SHM_MAGIC_, __ATOMIC_RELEASE);
+    ring->name = strdup(name);
+    ring->creator = getpid();
+    return ring;
+}
+
+
+logger_shm_ring_t* logger_shm_open(const char* name)
+{
+    logger_shm_ring_t* ring;
+    logger_shm_header_t* h;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0) return 0;
+    if(fstat(fd, &st) || (size_t) st.st_size < sizeof(logger_shm_header_t) || !(ring = logger_shm_map_(fd, st.st_size)))
+    {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    h = ring->hdr;
+    if(__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != LOGGER_SHM_MAGIC_ || !h->slots || (h->slots & (h->slots - 1)) ||
+       sizeof(logger_shm_header_t) + (size_t) h->slots * sizeof(logger_shm_slot_t) > ring->map_size)
+    {
+        munmap(ring->hdr, ring->map_size);
+        free(ring->buf);
+        free(ring);
+        return 0;
+    }
+    return ring;
+}
+
+
+void logger_shm_close(logger_shm_ring_t* ring)
+{
+    if(!ring) return;
+
+    logger_shm_collector_stop(ring);
+    munmap(ring->hdr, ring->map_size);
+    if(ring->name && ring->creator == getpid()) shm_unlink(ring->name);
+    free(ring->name);
+    free(ring->buf);
+    free(ring);
+}
+
+
+static void* logger_shm_thread_(void* arg)
+{
+    logger_shm_ring_t* ring = (logger_shm_ring_t*) arg;
+    struct timespec ts = { 0, LOGGER_SHM_POLL_MS * 1000000L };
+
+    while(!ring->stop)
+    {
+        if(!logger_shm_collect(ring, ring->lg, 1024)) nanosleep(&ts, 0);
+    }
+    return 0;
+}
+
+
+int logger_shm_collector_start(logger_shm_ring_t* ring, logger_t* lg)
+{
+    if(ring->collector) return -1;
+    ring->lg = lg;
+    ring->stop = 0;
+    if(pthread_create(&ring->thread, 0, logger_shm_thread_, ring)) return -1;
+    ring->collector = getpid();
+    return 0;
+}
+
+
+void logger_shm_collector_stop(logger_shm_ring_t* ring)
+{
+    struct timespec ts = { 0, LOGGER_SHM_POLL_MS * 1000000L };
+    unsigned long long idle_since;
+
+    // handle copied to child by fork() has no collector thread
+    if(!ring->collector || ring->collector != getpid()) return;
+    ring->stop = 1;
+    pthread_join(ring->thread, 0);
+    ring->collector = 0;
+
+    // collect what is left, waiting long enough to reclaim lines of dead writers
+    idle_since = logger_shm_ms_();
+    while(__atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&ring->hdr->tail, __ATOMIC_RELAXED) &&
+          logger_shm_ms_() - idle_since <= 2 * LOGGER_SHM_DEAD_MS)
+    {
+        if(logger_shm_collect(ring, ring->lg, ~0u)) idle_since = logger_shm_ms_();
+        else nanosleep(&ts, 0);
+    }
+}
+
+
+void logger_shm_stats(logger_shm_ring_t* ring, logger_shm_stats_t* stats)
+{
+    stats->collected = __atomic_load_n(&ring->hdr->collected, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&ring->hdr->dropped, __ATOMIC_RELAXED);
+    stats->reclaimed = __atomic_load_n(&ring->hdr->reclaimed, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,120 @@
+/*  Copyright (c) 2014, 2019, Mario Ivančić
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// loggerexp_shm.h
+
+/*
+    Shared memory log ring for loggerexp.
+
+    Many processes (for example pre-forked workers) log to a ring in POSIX shared memory
+    and one collector (thread in any process) takes lines from the ring and writes them to
+    sinks of it's own logger instance, so only collector touches log file.
+
+    Ring is array of LOGGER_SHM_SLOT byte slots. Writer reserves slots for a line with one
+    compare and swap of ring head, copies the line and commits slots. Nothing is locked, so
+    writer that dies can't block other writers. Reserved slots which are not committed for
+    LOGGER_SHM_DEAD_MS milliseconds and whose owner process doesn't exist any more are
+    reclaimed by collector. When ring is full new lines are dropped and counted, and
+    collector logs how many were dropped.
+
+    Example:
+
+    // parent, before fork()
+    logger_shm_ring_t* ring = logger_shm_create("/myapp-log", 4096);
+    logger_t* lg = logger_create("myapp.log", LOGGER_OPTION_FILE | LOGGER_OPTION_KEEP_FILE_OPEN);
+    logger_shm_collector_start(ring, lg);
+
+    // worker, after fork() (or logger_shm_open("/myapp-log") in unrelated process)
+    logger_open(0, 0);
+    logger_add_sink(&logger_default_, &logger_shm_sink_ops, ring, LOGGER_LEVEL_TRACE, ~0u, ~0u);
+
+    Ring is POSIX only.
+*/
+
+#ifndef LOGGEREXP_SHM_H_INCLUDED__
+#define LOGGEREXP_SHM_H_INCLUDED__
+
+#include "loggerexp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// size of one ring slot, line takes as many slots as it needs
+#ifndef LOGGER_SHM_SLOT
+#define LOGGER_SHM_SLOT 256
+#endif // LOGGER_SHM_SLOT
+
+// reserved slot not committed for this long is checked for dead owner
+#ifndef LOGGER_SHM_DEAD_MS
+#define LOGGER_SHM_DEAD_MS 1000
+#endif // LOGGER_SHM_DEAD_MS
+
+// collector thread checks empty ring this often
+#ifndef LOGGER_SHM_POLL_MS
+#define LOGGER_SHM_POLL_MS 10
+#endif // LOGGER_SHM_POLL_MS
+
+typedef struct logger_shm_ring_s logger_shm_ring_t;
+
+typedef struct logger_shm_stats_s
+{
+    unsigned long long collected;   // lines written to collector sinks
+    unsigned long long dropped;     // lines dropped because ring was full
+    unsigned long long reclaimed;   // lines of dead writers which were skipped
+} logger_shm_stats_t;
+
+// sink functions, ctx is logger_shm_ring_t*
+extern const logger_sink_ops_t logger_shm_sink_ops;
+
+// Create shared memory object name (see shm_open()) with ring of slots slots (rounded up to
+// power of 2). Existing object is replaced. Returns 0 on error.
+extern logger_shm_ring_t* logger_shm_create(const char* name, unsigned slots);
+
+// Map existing ring created by other process. Returns 0 on error.
+extern logger_shm_ring_t* logger_shm_open(const char* name);
+
+// Stop collector (if started), unmap ring and remove shared memory object if ring was
+// created by logger_shm_create() in this process.
+extern void logger_shm_close(logger_shm_ring_t* ring);
+
+// Write up to max lines from ring to sinks of instance lg. Returns number of lines taken
+// from ring. Only one process or thread may collect from a ring.
+extern unsigned logger_shm_collect(logger_shm_ring_t* ring, logger_t* lg, unsigned max);
+
+// Start thread which collects lines from ring to instance lg.
+// Returns 0 on success or -1 on error.
+extern int logger_shm_collector_start(logger_shm_ring_t* ring, logger_t* lg);
+
+// Collect all committed lines and stop collector thread.
+extern void logger_shm_collector_stop(logger_shm_ring_t* ring);
+
+// Get counters of ring.
+extern void logger_shm_stats(logger_shm_ring_t* ring, logger_shm_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOGGEREXP_SHM_H_INCLUDED__
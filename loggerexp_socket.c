@@ -0,0 +1,388 @@
+/*  Copyright (c) 2014, 2019, Mario Ivančić
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// stream socket sink for loggerexp
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "loggerexp_socket.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif // MSG_NOSIGNAL
+
+
+struct logger_socket_sink_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int stop;
+    int flush;
+
+    // lines waiting for sender thread, protected by mutex
+    logger_line_buffer_t lines;
+
+    // batch being sent, used only by sender thread
+    char* out;
+    unsigned out_len;
+    unsigned out_pos;
+    int fd;
+    unsigned backoff;
+    unsigned long long next_attempt;
+    unsigned connects;
+
+    // address
+    int unix_socket;
+    char* host;
+    char* port;
+
+    // counters, protected by mutex
+    logger_socket_stats_t stats;
+};
+
+
+static unsigned long long logger_socket_now_ms_(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static void logger_socket_write_batch_(void* ctx, const logger_record_t* records, unsigned n)
+{
+    logger_socket_sink_t* s = (logger_socket_sink_t*) ctx;
+    unsigned i;
+
+    pthread_mutex_lock(&s->mutex);
+    for(i = 0; i < n; i++)
+    {
+        logger_line_buffer_append(&s->lines, records[i].line, records[i].len,
+            &s->stats.dropped_lines, &s->stats.dropped_bytes);
+    }
+    if(s->lines.len >= LOGGER_SOCKET_BATCH) pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+
+static void logger_socket_flush_(void* ctx)
+{
+    logger_socket_sink_t* s = (logger_socket_sink_t*) ctx;
+
+    pthread_mutex_lock(&s->mutex);
+    s->flush = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+
+static void logger_socket_close_(void* ctx)
+{
+    logger_socket_sink_destroy((logger_socket_sink_t*) ctx);
+}
+
+
+const logger_sink_ops_t logger_socket_sink_ops = { logger_socket_write_batch_, logger_socket_flush_, logger_socket_close_ };
+
+
+// Connect to collector, returns socket or -1.
+static int logger_socket_connect_(logger_socket_sink_t* s)
+{
+    int fd = -1;
+
+    if(s->unix_socket)
+    {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, s->host, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd >= 0 && connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else
+    {
+        struct addrinfo hints, *res, *ai;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if(getaddrinfo(s->host, s->port, &hints, &res)) return -1;
+        for(ai = res; ai; ai = ai->ai_next)
+        {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if(fd < 0) continue;
+            if(!connect(fd, ai->ai_addr, ai->ai_addrlen)) break;
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+    }
+
+    if(fd >= 0)
+    {
+        // collector which doesn't read must not block sender thread forever
+        struct timeval tv = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+    return fd;
+}
+
+
+// Returns nonzero if collector closed connection. Collector is not supposed to send anything
+// so readable socket means EOF or error.
+static int logger_socket_closed_(int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    char c;
+
+    if(poll(&pfd, 1, 0) <= 0) return 0;
+    if(pfd.revents & (POLLERR | POLLHUP)) return 1;
+    return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+
+// Send batch, used only by sender thread. If connection is lost, batch is rewound to
+// the beginning of partially sent line, so new connection gets only whole lines.
+static unsigned logger_socket_send_(logger_socket_sink_t* s)
+{
+    unsigned sent = 0;
+
+    while(s->out_pos < s->out_len)
+    {
+        ssize_t n = send(s->fd, s->out + s->out_pos, s->out_len - s->out_pos, MSG_NOSIGNAL);
+        if(n > 0)
+        {
+            s->out_pos += n;
+            sent += n;
+            continue;
+        }
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        close(s->fd);
+        s->fd = -1;
+        while(s->out_pos && s->out[s->out_pos - 1] != '\n') s->out_pos--;
+        s->next_attempt = logger_socket_now_ms_();
+        break;
+    }
+    if(s->out_pos == s->out_len) s->out_pos = s->out_len = 0;
+    return sent;
+}
+
+
+static void* logger_socket_thread_(void* arg)
+{
+    logger_socket_sink_t* s = (logger_socket_sink_t*) arg;
+    int stop;
+
+    pthread_mutex_lock(&s->mutex);
+    for(;;)
+    {
+        // wait for full batch, flush, timeout or time to reconnect
+        for(;;)
+        {
+            struct timespec ts;
+            unsigned long long now = logger_socket_now_ms_(), wake;
+
+            if(s->stop) break;
+            if(s->fd < 0 && (s->lines.len || s->out_len))
+            {
+                if(now >= s->next_attempt) break;
+                wake = s->next_attempt;
+            }
+            else if(s->flush || s->lines.len >= LOGGER_SOCKET_BATCH) break;
+            else wake = now + LOGGER_SOCKET_INTERVAL_MS;
+
+            ts.tv_sec = wake / 1000;
+            ts.tv_nsec = (wake % 1000) * 1000000;
+            if(pthread_cond_timedwait(&s->cond, &s->mutex, &ts) == ETIMEDOUT && s->fd >= 0) break;
+        }
+        s->flush = 0;
+        stop = s->stop;
+        pthread_mutex_unlock(&s->mutex);
+
+        if(s->fd >= 0 && logger_socket_closed_(s->fd))
+        {
+            close(s->fd);
+            s->fd = -1;
+        }
+        if(s->fd < 0 && !stop && logger_socket_now_ms_() >= s->next_attempt)
+        {
+            s->fd = logger_socket_connect_(s);
+            if(s->fd >= 0)
+            {
+                s->backoff = LOGGER_SOCKET_BACKOFF_MIN_MS;
+                s->connects++;
+            }
+            else
+            {
+                s->next_attempt = logger_socket_now_ms_() + s->backoff;
+                s->backoff *= 2;
+                if(s->backoff > LOGGER_SOCKET_BACKOFF_MAX_MS) s->backoff = LOGGER_SOCKET_BACKOFF_MAX_MS;
+            }
+        }
+
+        pthread_mutex_lock(&s->mutex);
+        // lines are taken from buffer only when they can be sent, so while disconnected
+        // all of them are subject to overflow policy
+        if(s->fd >= 0 && !s->out_len && s->lines.len)
+        {
+            char* tmp = s->out;
+            s->out = s->lines.buf;
+            s->out_len = s->lines.len;
+            s->out_pos = 0;
+            s->lines.buf = tmp;
+            s->lines.len = 0;
+        }
+        pthread_mutex_unlock(&s->mutex);
+
+        unsigned sent = s->fd >= 0 ? logger_socket_send_(s) : 0;
+
+        pthread_mutex_lock(&s->mutex);
+        s->stats.sent_bytes += sent;
+        s->stats.connected = s->fd >= 0;
+        s->stats.reconnects = s->connects ? s->connects - 1 : 0;
+        // on stop sender keeps sending what was left in buffer while it makes progress
+        if(stop && (s->fd < 0 || !sent || (!s->lines.len && !s->out_len))) break;
+    }
+
+    // what couldn't be sent is lost
+    s->stats.dropped_lines += logger_count_lines(s->lines.buf, s->lines.len) +
+        logger_count_lines(s->out + s->out_pos, s->out_len - s->out_pos);
+    s->stats.dropped_bytes += s->lines.len + s->out_len - s->out_pos;
+    s->lines.len = s->out_len = s->out_pos = 0;
+    pthread_mutex_unlock(&s->mutex);
+    return 0;
+}
+
+
+logger_socket_sink_t* logger_socket_sink_create(const char* address, unsigned buffer_size, int policy)
+{
+    logger_socket_sink_t* s;
+    pthread_condattr_t attr;
+
+    // sink can't block logging thread or wait for room, so only dropping policies are allowed
+    if(!address || !buffer_size || (policy != LOGGER_OVERFLOW_DROP_NEWEST && policy != LOGGER_OVERFLOW_DROP_OLDEST)) return 0;
+    s = (logger_socket_sink_t*) calloc(1, sizeof(logger_socket_sink_t));
+    if(!s) return 0;
+
+    if(!strncmp(address, "unix:", 5))
+    {
+        s->unix_socket = 1;
+        s->host = strdup(address + 5);
+    }
+    else
+    {
+        const char* colon = strrchr(address, ':');
+        if(colon)
+        {
+            s->host = strndup(address, colon - address);
+            s->port = strdup(colon + 1);
+        }
+    }
+
+    s->lines.size = buffer_size;
+    s->lines.policy = policy;
+    s->lines.buf = (char*) malloc(buffer_size);
+    s->out = (char*) malloc(buffer_size);
+    s->fd = -1;
+    s->backoff = LOGGER_SOCKET_BACKOFF_MIN_MS;
+
+    if(!s->host || (!s->unix_socket && !s->port) || !s->lines.buf || !s->out)
+    {
+        free(s->host);
+        free(s->port);
+        free(s->lines.buf);
+        free(s->out);
+        free(s);
+        return 0;
+    }
+
+    pthread_mutex_init(&s->mutex, 0);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if(pthread_create(&s->thread, 0, logger_socket_thread_, s))
+    {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->mutex);
+        free(s->host);
+        free(s->port);
+        free(s->lines.buf);
+        free(s->out);
+        free(s);
+        return 0;
+    }
+    return s;
+}
+
+
+void logger_socket_sink_destroy(logger_socket_sink_t* s)
+{
+    if(!s) return;
+
+    pthread_mutex_lock(&s->mutex);
+    s->stop = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    pthread_join(s->thread, 0);
+
+    if(s->fd >= 0) close(s->fd);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->mutex);
+    free(s->host);
+    free(s->port);
+    free(s->lines.buf);
+    free(s->out);
+    free(s);
+}
+
+
+void logger_socket_sink_stats(logger_socket_sink_t* s, logger_socket_stats_t* stats)
+{
+    pthread_mutex_lock(&s->mutex);
+    *stats = s->stats;
+    stats->buffered = s->lines.len + s->out_len - s->out_pos;
+    pthread_mutex_unlock(&s->mutex);
+}
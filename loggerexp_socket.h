@@ -0,0 +1,103 @@
+/*  Copyright (c) 2014, 2019, Mario Ivančić
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// loggerexp_socket.h
+
+/*
+    Stream socket sink for loggerexp.
+
+    Lines are collected in a buffer and sent by a sender thread to a log collector in large
+    writes, when there is at least LOGGER_SOCKET_BATCH bytes in the buffer, every
+    LOGGER_SOCKET_INTERVAL_MS milliseconds or on logger_flush().
+    If collector is not reachable sender reconnects with exponential backoff
+    (LOGGER_SOCKET_BACKOFF_MIN_MS .. LOGGER_SOCKET_BACKOFF_MAX_MS) and lines are kept in the
+    buffer. When buffer is full lines are dropped by policy given to logger_socket_sink_create()
+    and counted.
+
+    Example:
+
+    logger_socket_sink_t* s = logger_socket_sink_create("127.0.0.1:5170", 1 << 20, LOGGER_OVERFLOW_DROP_OLDEST);
+    logger_add_sink(&logger_default_, &logger_socket_sink_ops, s, LOGGER_LEVEL_INFO, 0, 0);
+
+    Sink is POSIX only.
+*/
+
+#ifndef LOGGEREXP_SOCKET_H_INCLUDED__
+#define LOGGEREXP_SOCKET_H_INCLUDED__
+
+#include "loggerexp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef LOGGER_SOCKET_BATCH
+#define LOGGER_SOCKET_BATCH (64 * 1024)
+#endif // LOGGER_SOCKET_BATCH
+
+#ifndef LOGGER_SOCKET_INTERVAL_MS
+#define LOGGER_SOCKET_INTERVAL_MS 100
+#endif // LOGGER_SOCKET_INTERVAL_MS
+
+#ifndef LOGGER_SOCKET_BACKOFF_MIN_MS
+#define LOGGER_SOCKET_BACKOFF_MIN_MS 100
+#endif // LOGGER_SOCKET_BACKOFF_MIN_MS
+
+#ifndef LOGGER_SOCKET_BACKOFF_MAX_MS
+#define LOGGER_SOCKET_BACKOFF_MAX_MS 5000
+#endif // LOGGER_SOCKET_BACKOFF_MAX_MS
+
+typedef struct logger_socket_sink_s logger_socket_sink_t;
+
+typedef struct logger_socket_stats_s
+{
+    unsigned long long sent_bytes;
+    unsigned long long dropped_lines;
+    unsigned long long dropped_bytes;
+    unsigned reconnects;            // successful connects after the first one
+    unsigned connected;             // 1 if sink is connected now
+    unsigned buffered;              // bytes waiting to be sent
+} logger_socket_stats_t;
+
+// sink functions, ctx is logger_socket_sink_t*
+extern const logger_sink_ops_t logger_socket_sink_ops;
+
+// Create socket sink and start it's sender thread. address is "host:port" for TCP or
+// "unix:/path" for Unix domain socket. buffer_size is maximum number of bytes kept while
+// collector is not reachable, policy is LOGGER_OVERFLOW_DROP_NEWEST or LOGGER_OVERFLOW_DROP_OLDEST.
+// Returns 0 on error or if policy is other (LOGGER_OVERFLOW_BLOCK, LOGGER_OVERFLOW_DROP_BY_LEVEL). Sink is freed by logger_remove_sink() or logger_socket_sink_destroy().
+extern logger_socket_sink_t* logger_socket_sink_create(const char* address, unsigned buffer_size, int policy);
+
+// Stop sender thread (buffered lines are sent if sink is connected) and free sink.
+// Must not be called for sink that is still added to logger instance.
+extern void logger_socket_sink_destroy(logger_socket_sink_t* s);
+
+// Get counters of sink s.
+extern void logger_socket_sink_stats(logger_socket_sink_t* s, logger_socket_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOGGEREXP_SOCKET_H_INCLUDED__